@@ -4,6 +4,129 @@
 #include "profile.h"
 #endif
 
+/* prints information about the new cloud */
+static void print_trace
+  (const problem_data &prob, const particle_cloud &new_cloud,
+   const arma::uword i, const double ess){
+  const unsigned int trace = prob.ctrl.trace;
+  Rprintf("Effective sample size at %4d: %12.1f\n", i + 1L, ess);
+
+  const arma::vec cloud_mean = new_cloud.get_cloud_mean();
+  if(cloud_mean.n_elem < 20L or trace > 2)
+    Rcpp::Rcout << "cloud mean: " << new_cloud.get_cloud_mean().t();
+  arma::vec stats_mean =
+    unpack_stats(new_cloud.get_stats_mean(), prob.ctrl.what_stat);
+  if(prob.ctrl.what_stat != log_densty and (
+      stats_mean.n_elem < 20L or trace > 2)){
+    const unsigned grad_dim =
+      get_grad_dim(stats_mean.n_elem, prob.ctrl.what_stat);
+
+    arma::vec grad(stats_mean.memptr(), grad_dim, false);
+    Rcpp::Rcout << "Stats mean (gradient):\n" << grad.t();
+
+    if(prob.ctrl.what_stat == Hessian){
+      arma::mat hess
+        (stats_mean.memptr() + grad_dim, grad_dim, grad_dim, false);
+      Rcpp::Rcout << "Stats mean (Hessian):\n" << hess;
+
+    }
+
+  }
+
+  Rcpp::Rcout << "log-likelihood contribution is: "
+              << arma::mean(new_cloud.ws) << '\n';
+  if(new_cloud.log_aprx_err.n_elem > 0L)
+    Rcpp::Rcout << "Bound on the approximation error of the contribution is: "
+                << new_cloud.get_ll_aprx_err() << '\n';
+}
+
+/* samples the particle cloud at time i and computes the weights and the
+ * statistics. The old cloud is a null pointer at the first time point */
+static particle_cloud PF_step
+  (const problem_data &prob, const sampler &samp,
+   const stats_comp_helper &trans, const arma::uword i,
+   particle_cloud *old_cloud, const arma::uword N_part)
+{
+  /* get conditional distribution at time i */
+  std::unique_ptr<cdist> dist_holder;
+  const cdist &dist_t = prob.get_obs_dist(i, dist_holder);
+
+  /* sample new cloud and update weights ad set stats */
+  if(old_cloud){
+    particle_cloud new_cloud = samp.sample(prob, dist_t, *old_cloud, i, N_part);
+    trans.set_ll_n_stat(prob, *old_cloud, new_cloud, dist_t, i);
+    return new_cloud;
+
+  }
+
+  particle_cloud new_cloud = samp.sample_first(prob, dist_t, N_part);
+  trans.set_ll_n_stat(prob, new_cloud, dist_t);
+  return new_cloud;
+}
+
+/* normalizes the weights and returns the effective sample size */
+static double normalize_cloud(particle_cloud &new_cloud){
+  new_cloud.ws_normalized = new_cloud.ws;
+  return normalize_log_weights(new_cloud.ws_normalized);
+}
+
+/* returns the bound on the error of the log-likelihood contribution due to
+ * the approximations or NaN if there is no bound */
+static double get_ll_aprx_err(const particle_cloud &cloud){
+  if(cloud.log_aprx_err.n_elem < 1L)
+    return std::numeric_limits<double>::quiet_NaN();
+  return cloud.get_ll_aprx_err();
+}
+
+/* calls PF_step and normalizes the weights. The period is repeated with
+ * more particles if the effective sample size is below the target when the
+ * number of particles is adapted. Similarly, the period is repeated with a
+ * smaller eps if the bound on the error of the log-likelihood contribution
+ * is above the target when the eps of the dual k-d tree method is adapted.
+ * The first reference is set to the number of particles to use at the next
+ * time point and the second reference is set to the effective sample
+ * size */
+static particle_cloud PF_step_n_normalize
+  (const problem_data &prob, const sampler &samp,
+   const stats_comp_helper &trans, const arma::uword i,
+   particle_cloud *old_cloud, arma::uword &N_part, double &ess)
+{
+  const control_obj &ctrl = prob.ctrl;
+  for(;;){
+    particle_cloud new_cloud =
+      PF_step(prob, samp, trans, i, old_cloud, N_part);
+    ess = normalize_cloud(new_cloud);
+
+    const arma::uword N_next = ctrl.get_N_part_next(N_part, ess);
+    const bool redo_N = ctrl.is_adaptive() and ess < ctrl.ess_target and
+      N_next > N_part;
+    N_part = N_next;
+
+    bool redo_eps = false;
+    double ll_err = 0.;
+    if(ctrl.is_KD_eps_adaptive() and new_cloud.log_aprx_err.n_elem > 0L){
+      ll_err = new_cloud.get_ll_aprx_err();
+      const double eps_cur = ctrl.get_KD_eps(),
+        eps_next = ctrl.get_KD_eps_next(eps_cur, ll_err);
+      redo_eps = eps_next < eps_cur;
+      ctrl.set_KD_eps(eps_next);
+    }
+
+    if(!redo_N and !redo_eps)
+      return new_cloud;
+    ctrl.get_cloud_pool().release(new_cloud);
+
+    if(ctrl.trace > 0){
+      if(redo_N)
+        Rprintf("Effective sample size at %4d is %.1f. Repeating with %d particles\n",
+                (int)(i + 1L), ess, (int)N_part);
+      if(redo_eps)
+        Rprintf("Log-likelihood error bound at %4d is %.3g. Repeating with eps %.3g\n",
+                (int)(i + 1L), ll_err, ctrl.get_KD_eps());
+    }
+  }
+}
+
 std::vector<particle_cloud> PF
   (const problem_data &prob, const sampler &samp, const stats_comp_helper &trans)
 {
@@ -12,67 +135,85 @@ std::vector<particle_cloud> PF
 #endif
 
   std::vector<particle_cloud> out;
-  out.reserve(prob.n_periods);
-  const unsigned int trace = prob.ctrl.trace;
+  const arma::uword n_periods = prob.n_periods();
+  out.reserve(n_periods);
+  arma::uword N_part = prob.ctrl.get_N_part_start();
+  prob.ctrl.set_KD_eps(prob.ctrl.aprx_eps);
 
-  for(arma::uword i = 0; i < prob.n_periods; ++i){
+  for(arma::uword i = 0; i < n_periods; ++i){
     if(i % 10L == 0)
       Rcpp::checkUserInterrupt();
-    /* get conditional distribution at time i */
-    std::unique_ptr<cdist> dist_t = prob.get_obs_dist(i);
 
-    /* sample new cloud */
-    if(i == 0)
-      out.emplace_back(samp.sample_first(prob, *dist_t));
-    else
-      out.emplace_back(samp.sample      (prob, *dist_t, out.back(), i));
+    particle_cloud *old_cloud = i > 0 ? &out.back() : nullptr;
+    double ess;
+    out.emplace_back(PF_step_n_normalize(
+        prob, samp, trans, i, old_cloud, N_part, ess));
 
     particle_cloud &new_cloud = out.back();
+    if(prob.ctrl.trace > 0)
+      print_trace(prob, new_cloud, i, ess);
 
-    /* Update weights ad set stats */
-    if(i > 0)
-      trans.set_ll_n_stat(
-        prob, *(out.rbegin() + 1), new_cloud, *dist_t, i);
-    else
-      trans.set_ll_n_stat(
-        prob,                      new_cloud, *dist_t   );
-
-    /* normalize weights */
-    new_cloud.ws_normalized = new_cloud.ws;
-    double ess = normalize_log_weights(new_cloud.ws_normalized);
-    if(trace > 0){
-      Rprintf("Effective sample size at %4d: %12.1f\n", i + 1L, ess);
+    /* we do not need the olds stats anymore */
+    if(i > 0L)
+      prob.ctrl.get_cloud_pool().release((out.rbegin() + 1)->stats);
+  }
 
-      const arma::vec cloud_mean = new_cloud.get_cloud_mean();
-      if(cloud_mean.n_elem < 20L or trace > 2)
-        Rcpp::Rcout << "cloud mean: " << new_cloud.get_cloud_mean().t();
-      arma::vec stats_mean = new_cloud.get_stats_mean();
-      if(prob.ctrl.what_stat != log_densty and (
-          stats_mean.n_elem < 20L or trace > 2)){
-        const unsigned grad_dim =
-          get_grad_dim(stats_mean.n_elem, prob.ctrl.what_stat);
+  return out;
+}
 
-        arma::vec grad(stats_mean.memptr(), grad_dim, false);
-        Rcpp::Rcout << "Stats mean (gradient):\n" << grad.t();
+void PF_stream
+  (const problem_data &prob, const sampler &samp,
+   const stats_comp_helper &trans, std::unique_ptr<particle_cloud> &cloud,
+   const arma::uword start, const pf_callback &callback)
+{
+#ifdef MSSM_PROF
+  profiler prof("PF_stream");
+#endif
 
-        if(prob.ctrl.what_stat == Hessian){
-          arma::mat hess
-            (stats_mean.memptr() + grad_dim, grad_dim, grad_dim, false);
-          Rcpp::Rcout << "Stats mean (Hessian):\n" << hess;
+  if(start > 0L and !cloud)
+    throw std::invalid_argument("PF_stream: no cloud at previous time point");
+  if(start < 1L)
+    prob.ctrl.set_KD_eps(prob.ctrl.aprx_eps);
 
-        }
+  /* find the number of particles to start with */
+  arma::uword N_part = ([&]{
+    if(start < 1L)
+      return prob.ctrl.get_N_part_start();
 
-      }
+    const arma::vec w = arma::exp(cloud->ws_normalized);
+    return prob.ctrl.get_N_part_next(
+      cloud->N_particles(), 1. / arma::dot(w, w));
+  })();
 
-      Rcpp::Rcout << "log-likelihood contribution is: "
-                  << arma::mean(new_cloud.ws) << '\n';
+  const arma::uword n_periods = prob.n_periods();
+  for(arma::uword i = start; i < n_periods; ++i){
+    if(i % 10L == 0)
+      Rcpp::checkUserInterrupt();
 
+    double ess;
+    std::unique_ptr<particle_cloud> new_cloud(new particle_cloud(
+        PF_step_n_normalize(prob, samp, trans, i,
+                            i > 0 ? cloud.get() : nullptr, N_part, ess)));
+
+    if(prob.ctrl.trace > 0)
+      print_trace(prob, *new_cloud, i, ess);
+
+    /* the old cloud is not needed anymore */
+    if(cloud)
+      prob.ctrl.get_cloud_pool().release(*cloud);
+    cloud = std::move(new_cloud);
+
+    if(callback){
+      pf_period_summary summary;
+      const arma::vec &ws = cloud->ws;
+      summary.ll_term =
+        log_sum_log(ws, ws.max()) - std::log((double)ws.n_elem);
+      summary.ess = ess;
+      summary.ll_aprx_err = get_ll_aprx_err(*cloud);
+      summary.cloud_mean = cloud->get_cloud_mean();
+      summary.stats_mean = cloud->get_stats_mean();
+
+      callback(i, *cloud, summary);
     }
-
-    /* we do not need the olds stats anymore */
-    if(i > 0L)
-      (out.rbegin() + 1)->stats.clear();
   }
-
-  return out;
 }
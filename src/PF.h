@@ -4,8 +4,33 @@
 #include "problem_data.h"
 #include "stats-comp-helper.h"
 #include "samplers.h"
+#include <functional>
 
 std::vector<particle_cloud> PF
   (const problem_data&, const sampler&, const stats_comp_helper&);
 
+/* summary of the particle cloud at a given time point */
+struct pf_period_summary {
+  /* log-likelihood contribution and effective sample size */
+  double ll_term, ess;
+  /* bound on the error of the log-likelihood contribution due to the
+   * approximations. It is NaN if there is no bound */
+  double ll_aprx_err;
+  /* weighted mean of the particles and the statistics */
+  arma::vec cloud_mean, stats_mean;
+};
+
+/* function which is called with the time index, the particle cloud, and the
+ * summary after each time point */
+using pf_callback = std::function<void
+  (const arma::uword, const particle_cloud&, const pf_period_summary&)>;
+
+/* same as PF but only keeps the last particle cloud. The filter is run from
+ * the passed time index and up to the last period. The pointer should hold
+ * the cloud at the previous time point unless the time index is zero. It is
+ * replaced by the cloud at the last time point */
+void PF_stream
+  (const problem_data&, const sampler&, const stats_comp_helper&,
+   std::unique_ptr<particle_cloud>&, const arma::uword, const pf_callback&);
+
 #endif
@@ -81,8 +81,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // pf_filter
-Rcpp::List pf_filter(const arma::vec& Y, const arma::vec& cfix, const arma::vec& ws, const arma::vec& offsets, const arma::vec& disp, const arma::mat& X, const arma::mat& Z, const arma::uvec& time_indices_elems, const arma::uvec& time_indices_len, const arma::mat& F, const arma::mat& Q, const arma::mat& Q0, const std::string& fam, const arma::vec& mu0, const arma::uword n_threads, const double nu, const double covar_fac, const double ftol_rel, const arma::uword N_part, const std::string& what, const std::string& which_sampler, const std::string& which_ll_cp, const unsigned int trace, const arma::uword KD_N_max, const double aprx_eps, const bool use_antithetic);
-RcppExport SEXP _mssm_pf_filter(SEXP YSEXP, SEXP cfixSEXP, SEXP wsSEXP, SEXP offsetsSEXP, SEXP dispSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP time_indices_elemsSEXP, SEXP time_indices_lenSEXP, SEXP FSEXP, SEXP QSEXP, SEXP Q0SEXP, SEXP famSEXP, SEXP mu0SEXP, SEXP n_threadsSEXP, SEXP nuSEXP, SEXP covar_facSEXP, SEXP ftol_relSEXP, SEXP N_partSEXP, SEXP whatSEXP, SEXP which_samplerSEXP, SEXP which_ll_cpSEXP, SEXP traceSEXP, SEXP KD_N_maxSEXP, SEXP aprx_epsSEXP, SEXP use_antitheticSEXP) {
+Rcpp::List pf_filter(const arma::vec& Y, const arma::vec& cfix, const arma::vec& ws, const arma::vec& offsets, const arma::vec& disp, const arma::mat& X, const arma::mat& Z, const arma::uvec& time_indices_elems, const arma::uvec& time_indices_len, const arma::mat& F, const arma::mat& Q, const arma::mat& Q0, const std::string& fam, const arma::vec& mu0, const Rcpp::List control);
+RcppExport SEXP _mssm_pf_filter(SEXP YSEXP, SEXP cfixSEXP, SEXP wsSEXP, SEXP offsetsSEXP, SEXP dispSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP time_indices_elemsSEXP, SEXP time_indices_lenSEXP, SEXP FSEXP, SEXP QSEXP, SEXP Q0SEXP, SEXP famSEXP, SEXP mu0SEXP, SEXP controlSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -100,25 +100,39 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const arma::mat& >::type Q0(Q0SEXP);
     Rcpp::traits::input_parameter< const std::string& >::type fam(famSEXP);
     Rcpp::traits::input_parameter< const arma::vec& >::type mu0(mu0SEXP);
-    Rcpp::traits::input_parameter< const arma::uword >::type n_threads(n_threadsSEXP);
-    Rcpp::traits::input_parameter< const double >::type nu(nuSEXP);
-    Rcpp::traits::input_parameter< const double >::type covar_fac(covar_facSEXP);
-    Rcpp::traits::input_parameter< const double >::type ftol_rel(ftol_relSEXP);
-    Rcpp::traits::input_parameter< const arma::uword >::type N_part(N_partSEXP);
-    Rcpp::traits::input_parameter< const std::string& >::type what(whatSEXP);
-    Rcpp::traits::input_parameter< const std::string& >::type which_sampler(which_samplerSEXP);
-    Rcpp::traits::input_parameter< const std::string& >::type which_ll_cp(which_ll_cpSEXP);
-    Rcpp::traits::input_parameter< const unsigned int >::type trace(traceSEXP);
-    Rcpp::traits::input_parameter< const arma::uword >::type KD_N_max(KD_N_maxSEXP);
-    Rcpp::traits::input_parameter< const double >::type aprx_eps(aprx_epsSEXP);
-    Rcpp::traits::input_parameter< const bool >::type use_antithetic(use_antitheticSEXP);
-    rcpp_result_gen = Rcpp::wrap(pf_filter(Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len, F, Q, Q0, fam, mu0, n_threads, nu, covar_fac, ftol_rel, N_part, what, which_sampler, which_ll_cp, trace, KD_N_max, aprx_eps, use_antithetic));
+    Rcpp::traits::input_parameter< const Rcpp::List >::type control(controlSEXP);
+    rcpp_result_gen = Rcpp::wrap(pf_filter(Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len, F, Q, Q0, fam, mu0, control));
+    return rcpp_result_gen;
+END_RCPP
+}
+// pf_filter_summary
+Rcpp::List pf_filter_summary(const arma::vec& Y, const arma::vec& cfix, const arma::vec& ws, const arma::vec& offsets, const arma::vec& disp, const arma::mat& X, const arma::mat& Z, const arma::uvec& time_indices_elems, const arma::uvec& time_indices_len, const arma::mat& F, const arma::mat& Q, const arma::mat& Q0, const std::string& fam, const arma::vec& mu0, const Rcpp::List control);
+RcppExport SEXP _mssm_pf_filter_summary(SEXP YSEXP, SEXP cfixSEXP, SEXP wsSEXP, SEXP offsetsSEXP, SEXP dispSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP time_indices_elemsSEXP, SEXP time_indices_lenSEXP, SEXP FSEXP, SEXP QSEXP, SEXP Q0SEXP, SEXP famSEXP, SEXP mu0SEXP, SEXP controlSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const arma::vec& >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type cfix(cfixSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type ws(wsSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type offsets(offsetsSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type disp(dispSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type X(XSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type Z(ZSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type time_indices_elems(time_indices_elemsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type time_indices_len(time_indices_lenSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type F(FSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type Q(QSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type Q0(Q0SEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type fam(famSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type mu0(mu0SEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List >::type control(controlSEXP);
+    rcpp_result_gen = Rcpp::wrap(pf_filter_summary(Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len, F, Q, Q0, fam, mu0, control));
     return rcpp_result_gen;
 END_RCPP
 }
 // run_Laplace_aprx
-Rcpp::List run_Laplace_aprx(const arma::vec& Y, const arma::vec& cfix, const arma::vec& ws, const arma::vec& offsets, const arma::vec& disp, const arma::mat& X, const arma::mat& Z, const arma::uvec& time_indices_elems, const arma::uvec& time_indices_len, const arma::mat& F, const arma::mat& Q, const arma::mat& Q0, const std::string& fam, const arma::vec& mu0, const arma::uword n_threads, const double nu, const double covar_fac, const double ftol_rel, const arma::uword N_part, const std::string& what, const unsigned int trace, const arma::uword KD_N_max, const double aprx_eps, const double ftol_abs, const double la_ftol_rel, const double ftol_abs_inner, const double la_ftol_rel_inner, const unsigned maxeval, const unsigned maxeval_inner);
-RcppExport SEXP _mssm_run_Laplace_aprx(SEXP YSEXP, SEXP cfixSEXP, SEXP wsSEXP, SEXP offsetsSEXP, SEXP dispSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP time_indices_elemsSEXP, SEXP time_indices_lenSEXP, SEXP FSEXP, SEXP QSEXP, SEXP Q0SEXP, SEXP famSEXP, SEXP mu0SEXP, SEXP n_threadsSEXP, SEXP nuSEXP, SEXP covar_facSEXP, SEXP ftol_relSEXP, SEXP N_partSEXP, SEXP whatSEXP, SEXP traceSEXP, SEXP KD_N_maxSEXP, SEXP aprx_epsSEXP, SEXP ftol_absSEXP, SEXP la_ftol_relSEXP, SEXP ftol_abs_innerSEXP, SEXP la_ftol_rel_innerSEXP, SEXP maxevalSEXP, SEXP maxeval_innerSEXP) {
+Rcpp::List run_Laplace_aprx(const arma::vec& Y, const arma::vec& cfix, const arma::vec& ws, const arma::vec& offsets, const arma::vec& disp, const arma::mat& X, const arma::mat& Z, const arma::uvec& time_indices_elems, const arma::uvec& time_indices_len, const arma::mat& F, const arma::mat& Q, const arma::mat& Q0, const std::string& fam, const arma::vec& mu0, const Rcpp::List control);
+RcppExport SEXP _mssm_run_Laplace_aprx(SEXP YSEXP, SEXP cfixSEXP, SEXP wsSEXP, SEXP offsetsSEXP, SEXP dispSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP time_indices_elemsSEXP, SEXP time_indices_lenSEXP, SEXP FSEXP, SEXP QSEXP, SEXP Q0SEXP, SEXP famSEXP, SEXP mu0SEXP, SEXP controlSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -136,28 +150,14 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const arma::mat& >::type Q0(Q0SEXP);
     Rcpp::traits::input_parameter< const std::string& >::type fam(famSEXP);
     Rcpp::traits::input_parameter< const arma::vec& >::type mu0(mu0SEXP);
-    Rcpp::traits::input_parameter< const arma::uword >::type n_threads(n_threadsSEXP);
-    Rcpp::traits::input_parameter< const double >::type nu(nuSEXP);
-    Rcpp::traits::input_parameter< const double >::type covar_fac(covar_facSEXP);
-    Rcpp::traits::input_parameter< const double >::type ftol_rel(ftol_relSEXP);
-    Rcpp::traits::input_parameter< const arma::uword >::type N_part(N_partSEXP);
-    Rcpp::traits::input_parameter< const std::string& >::type what(whatSEXP);
-    Rcpp::traits::input_parameter< const unsigned int >::type trace(traceSEXP);
-    Rcpp::traits::input_parameter< const arma::uword >::type KD_N_max(KD_N_maxSEXP);
-    Rcpp::traits::input_parameter< const double >::type aprx_eps(aprx_epsSEXP);
-    Rcpp::traits::input_parameter< const double >::type ftol_abs(ftol_absSEXP);
-    Rcpp::traits::input_parameter< const double >::type la_ftol_rel(la_ftol_relSEXP);
-    Rcpp::traits::input_parameter< const double >::type ftol_abs_inner(ftol_abs_innerSEXP);
-    Rcpp::traits::input_parameter< const double >::type la_ftol_rel_inner(la_ftol_rel_innerSEXP);
-    Rcpp::traits::input_parameter< const unsigned >::type maxeval(maxevalSEXP);
-    Rcpp::traits::input_parameter< const unsigned >::type maxeval_inner(maxeval_innerSEXP);
-    rcpp_result_gen = Rcpp::wrap(run_Laplace_aprx(Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len, F, Q, Q0, fam, mu0, n_threads, nu, covar_fac, ftol_rel, N_part, what, trace, KD_N_max, aprx_eps, ftol_abs, la_ftol_rel, ftol_abs_inner, la_ftol_rel_inner, maxeval, maxeval_inner));
+    Rcpp::traits::input_parameter< const Rcpp::List >::type control(controlSEXP);
+    rcpp_result_gen = Rcpp::wrap(run_Laplace_aprx(Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len, F, Q, Q0, fam, mu0, control));
     return rcpp_result_gen;
 END_RCPP
 }
 // smoother_cpp
-Rcpp::List smoother_cpp(const arma::vec& Y, const arma::vec& cfix, const arma::vec& ws, const arma::vec& offsets, const arma::vec& disp, const arma::mat& X, const arma::mat& Z, const arma::uvec& time_indices_elems, const arma::uvec& time_indices_len, const arma::mat& F, const arma::mat& Q, const arma::mat& Q0, const std::string& fam, const arma::vec& mu0, const arma::uword n_threads, const double nu, const double covar_fac, const double ftol_rel, const arma::uword N_part, const std::string& what, const unsigned int trace, const arma::uword KD_N_max, const double aprx_eps, const std::string& which_ll_cp, const Rcpp::List pf_output, const bool use_antithetic);
-RcppExport SEXP _mssm_smoother_cpp(SEXP YSEXP, SEXP cfixSEXP, SEXP wsSEXP, SEXP offsetsSEXP, SEXP dispSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP time_indices_elemsSEXP, SEXP time_indices_lenSEXP, SEXP FSEXP, SEXP QSEXP, SEXP Q0SEXP, SEXP famSEXP, SEXP mu0SEXP, SEXP n_threadsSEXP, SEXP nuSEXP, SEXP covar_facSEXP, SEXP ftol_relSEXP, SEXP N_partSEXP, SEXP whatSEXP, SEXP traceSEXP, SEXP KD_N_maxSEXP, SEXP aprx_epsSEXP, SEXP which_ll_cpSEXP, SEXP pf_outputSEXP, SEXP use_antitheticSEXP) {
+Rcpp::List smoother_cpp(const arma::vec& Y, const arma::vec& cfix, const arma::vec& ws, const arma::vec& offsets, const arma::vec& disp, const arma::mat& X, const arma::mat& Z, const arma::uvec& time_indices_elems, const arma::uvec& time_indices_len, const arma::mat& F, const arma::mat& Q, const arma::mat& Q0, const std::string& fam, const arma::vec& mu0, const Rcpp::List control, const Rcpp::List pf_output);
+RcppExport SEXP _mssm_smoother_cpp(SEXP YSEXP, SEXP cfixSEXP, SEXP wsSEXP, SEXP offsetsSEXP, SEXP dispSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP time_indices_elemsSEXP, SEXP time_indices_lenSEXP, SEXP FSEXP, SEXP QSEXP, SEXP Q0SEXP, SEXP famSEXP, SEXP mu0SEXP, SEXP controlSEXP, SEXP pf_outputSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -175,19 +175,125 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const arma::mat& >::type Q0(Q0SEXP);
     Rcpp::traits::input_parameter< const std::string& >::type fam(famSEXP);
     Rcpp::traits::input_parameter< const arma::vec& >::type mu0(mu0SEXP);
-    Rcpp::traits::input_parameter< const arma::uword >::type n_threads(n_threadsSEXP);
-    Rcpp::traits::input_parameter< const double >::type nu(nuSEXP);
-    Rcpp::traits::input_parameter< const double >::type covar_fac(covar_facSEXP);
-    Rcpp::traits::input_parameter< const double >::type ftol_rel(ftol_relSEXP);
-    Rcpp::traits::input_parameter< const arma::uword >::type N_part(N_partSEXP);
-    Rcpp::traits::input_parameter< const std::string& >::type what(whatSEXP);
-    Rcpp::traits::input_parameter< const unsigned int >::type trace(traceSEXP);
-    Rcpp::traits::input_parameter< const arma::uword >::type KD_N_max(KD_N_maxSEXP);
-    Rcpp::traits::input_parameter< const double >::type aprx_eps(aprx_epsSEXP);
-    Rcpp::traits::input_parameter< const std::string& >::type which_ll_cp(which_ll_cpSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List >::type control(controlSEXP);
     Rcpp::traits::input_parameter< const Rcpp::List >::type pf_output(pf_outputSEXP);
-    Rcpp::traits::input_parameter< const bool >::type use_antithetic(use_antitheticSEXP);
-    rcpp_result_gen = Rcpp::wrap(smoother_cpp(Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len, F, Q, Q0, fam, mu0, n_threads, nu, covar_fac, ftol_rel, N_part, what, trace, KD_N_max, aprx_eps, which_ll_cp, pf_output, use_antithetic));
+    rcpp_result_gen = Rcpp::wrap(smoother_cpp(Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len, F, Q, Q0, fam, mu0, control, pf_output));
+    return rcpp_result_gen;
+END_RCPP
+}
+// pf_session_create
+SEXP pf_session_create(const arma::vec& Y, const arma::vec& cfix, const arma::vec& ws, const arma::vec& offsets, const arma::vec& disp, const arma::mat& X, const arma::mat& Z, const arma::uvec& time_indices_elems, const arma::uvec& time_indices_len, const arma::mat& F, const arma::mat& Q, const arma::mat& Q0, const std::string& fam, const arma::vec& mu0, const Rcpp::List control);
+RcppExport SEXP _mssm_pf_session_create(SEXP YSEXP, SEXP cfixSEXP, SEXP wsSEXP, SEXP offsetsSEXP, SEXP dispSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP time_indices_elemsSEXP, SEXP time_indices_lenSEXP, SEXP FSEXP, SEXP QSEXP, SEXP Q0SEXP, SEXP famSEXP, SEXP mu0SEXP, SEXP controlSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const arma::vec& >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type cfix(cfixSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type ws(wsSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type offsets(offsetsSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type disp(dispSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type X(XSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type Z(ZSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type time_indices_elems(time_indices_elemsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type time_indices_len(time_indices_lenSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type F(FSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type Q(QSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type Q0(Q0SEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type fam(famSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type mu0(mu0SEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List >::type control(controlSEXP);
+    rcpp_result_gen = Rcpp::wrap(pf_session_create(Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len, F, Q, Q0, fam, mu0, control));
+    return rcpp_result_gen;
+END_RCPP
+}
+// pf_session_set_params
+void pf_session_set_params(SEXP ptr, const arma::vec& cfix, const arma::vec& disp, const arma::mat& F, const arma::mat& Q, const arma::mat& Q0, const arma::vec& mu0);
+RcppExport SEXP _mssm_pf_session_set_params(SEXP ptrSEXP, SEXP cfixSEXP, SEXP dispSEXP, SEXP FSEXP, SEXP QSEXP, SEXP Q0SEXP, SEXP mu0SEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ptr(ptrSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type cfix(cfixSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type disp(dispSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type F(FSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type Q(QSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type Q0(Q0SEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type mu0(mu0SEXP);
+    pf_session_set_params(ptr, cfix, disp, F, Q, Q0, mu0);
+    return R_NilValue;
+END_RCPP
+}
+// pf_session_filter
+Rcpp::List pf_session_filter(SEXP ptr);
+RcppExport SEXP _mssm_pf_session_filter(SEXP ptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ptr(ptrSEXP);
+    rcpp_result_gen = Rcpp::wrap(pf_session_filter(ptr));
+    return rcpp_result_gen;
+END_RCPP
+}
+// pf_session_filter_summary
+Rcpp::List pf_session_filter_summary(SEXP ptr);
+RcppExport SEXP _mssm_pf_session_filter_summary(SEXP ptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ptr(ptrSEXP);
+    rcpp_result_gen = Rcpp::wrap(pf_session_filter_summary(ptr));
+    return rcpp_result_gen;
+END_RCPP
+}
+// pf_session_smoother
+Rcpp::List pf_session_smoother(SEXP ptr, const Rcpp::List pf_output);
+RcppExport SEXP _mssm_pf_session_smoother(SEXP ptrSEXP, SEXP pf_outputSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ptr(ptrSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List >::type pf_output(pf_outputSEXP);
+    rcpp_result_gen = Rcpp::wrap(pf_session_smoother(ptr, pf_output));
+    return rcpp_result_gen;
+END_RCPP
+}
+// pf_session_Laplace
+Rcpp::List pf_session_Laplace(SEXP ptr, const Rcpp::List control);
+RcppExport SEXP _mssm_pf_session_Laplace(SEXP ptrSEXP, SEXP controlSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ptr(ptrSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::List >::type control(controlSEXP);
+    rcpp_result_gen = Rcpp::wrap(pf_session_Laplace(ptr, control));
+    return rcpp_result_gen;
+END_RCPP
+}
+// pf_session_append
+void pf_session_append(SEXP ptr, const arma::vec& Y, const arma::vec& ws, const arma::vec& offsets, const arma::mat& X, const arma::mat& Z, const arma::uvec& time_indices_elems, const arma::uvec& time_indices_len);
+RcppExport SEXP _mssm_pf_session_append(SEXP ptrSEXP, SEXP YSEXP, SEXP wsSEXP, SEXP offsetsSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP time_indices_elemsSEXP, SEXP time_indices_lenSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ptr(ptrSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type ws(wsSEXP);
+    Rcpp::traits::input_parameter< const arma::vec& >::type offsets(offsetsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type X(XSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type Z(ZSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type time_indices_elems(time_indices_elemsSEXP);
+    Rcpp::traits::input_parameter< const arma::uvec& >::type time_indices_len(time_indices_lenSEXP);
+    pf_session_append(ptr, Y, ws, offsets, X, Z, time_indices_elems, time_indices_len);
+    return R_NilValue;
+END_RCPP
+}
+// pf_session_stream
+Rcpp::List pf_session_stream(SEXP ptr, const bool restart);
+RcppExport SEXP _mssm_pf_session_stream(SEXP ptrSEXP, SEXP restartSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ptr(ptrSEXP);
+    Rcpp::traits::input_parameter< const bool >::type restart(restartSEXP);
+    rcpp_result_gen = Rcpp::wrap(pf_session_stream(ptr, restart));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -226,9 +332,18 @@ static const R_CallMethodDef CallEntries[] = {
     {"_mssm_FSKA", (DL_FUNC) &_mssm_FSKA, 6},
     {"_mssm_sample_mv_normal", (DL_FUNC) &_mssm_sample_mv_normal, 3},
     {"_mssm_sample_mv_tdist", (DL_FUNC) &_mssm_sample_mv_tdist, 4},
-    {"_mssm_pf_filter", (DL_FUNC) &_mssm_pf_filter, 26},
-    {"_mssm_run_Laplace_aprx", (DL_FUNC) &_mssm_run_Laplace_aprx, 29},
-    {"_mssm_smoother_cpp", (DL_FUNC) &_mssm_smoother_cpp, 26},
+    {"_mssm_pf_filter", (DL_FUNC) &_mssm_pf_filter, 15},
+    {"_mssm_pf_filter_summary", (DL_FUNC) &_mssm_pf_filter_summary, 15},
+    {"_mssm_run_Laplace_aprx", (DL_FUNC) &_mssm_run_Laplace_aprx, 15},
+    {"_mssm_smoother_cpp", (DL_FUNC) &_mssm_smoother_cpp, 16},
+    {"_mssm_pf_session_create", (DL_FUNC) &_mssm_pf_session_create, 15},
+    {"_mssm_pf_session_set_params", (DL_FUNC) &_mssm_pf_session_set_params, 7},
+    {"_mssm_pf_session_filter", (DL_FUNC) &_mssm_pf_session_filter, 1},
+    {"_mssm_pf_session_filter_summary", (DL_FUNC) &_mssm_pf_session_filter_summary, 1},
+    {"_mssm_pf_session_smoother", (DL_FUNC) &_mssm_pf_session_smoother, 2},
+    {"_mssm_pf_session_Laplace", (DL_FUNC) &_mssm_pf_session_Laplace, 2},
+    {"_mssm_pf_session_append", (DL_FUNC) &_mssm_pf_session_append, 8},
+    {"_mssm_pf_session_stream", (DL_FUNC) &_mssm_pf_session_stream, 2},
     {"_mssm_t_dist_antithe_test", (DL_FUNC) &_mssm_t_dist_antithe_test, 4},
     {"_mssm_get_Q0", (DL_FUNC) &_mssm_get_Q0, 2},
     {"run_testthat_tests", (DL_FUNC) &run_testthat_tests, 1},
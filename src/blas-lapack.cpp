@@ -77,6 +77,21 @@ void dsyr2(
       uplo, n, alpha, x, incx, y, incy, a, lda
       FCONE);
 }
+void dspr(
+    const char *uplo, const int *n, const double *alpha,
+    const double *x, const int *incx, double *ap){
+  F77_CALL(dspr)(
+      uplo, n, alpha, x, incx, ap
+      FCONE);
+}
+void dspr2(
+    const char *uplo, const int *n, const double *alpha,
+    const double *x, const int *incx,
+    const double *y, const int *incy, double *ap){
+  F77_CALL(dspr2)(
+      uplo, n, alpha, x, incx, y, incy, ap
+      FCONE);
+}
 void dsbmv(
     const char *uplo, const int *n, const int *k,
     const double *alpha, const double *a, const int *lda,
@@ -38,6 +38,13 @@ void dsyr2(
     const double *x, const int *incx,
     const double *y, const int *incy,
     double *a, const int *lda);
+void dspr(
+    const char *uplo, const int *n, const double *alpha,
+    const double *x, const int *incx, double *ap);
+void dspr2(
+    const char *uplo, const int *n, const double *alpha,
+    const double *x, const int *incx,
+    const double *y, const int *incy, double *ap);
 void dsbmv(
     const char *uplo, const int *n, const int *k,
     const double *alpha, const double *a, const int *lda,
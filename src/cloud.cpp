@@ -1,4 +1,8 @@
 #include "cloud.h"
+#include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 particle_cloud::particle_cloud
   (const arma::uword N_particles, const arma::uword dim_particle,
@@ -19,14 +23,131 @@ arma::vec particle_cloud::get_cloud_mean() const {
   return out;
 }
 
-arma::vec particle_cloud::get_stats_mean() const {
-  arma::vec out(dim_stats(), arma::fill::zeros);
+arma::mat particle_cloud::get_cloud_cov() const {
+  const arma::vec mean = get_cloud_mean();
+  arma::mat out(dim_particle(), dim_particle(), arma::fill::zeros);
+  arma::vec diff(dim_particle());
   const arma::uword n_particles = N_particles();
   const double *w;
   arma::uword i;
   for(i = 0, w = ws_normalized.cbegin();
-      i < n_particles; ++i, ++w)
-    out += std::exp(*w) * stats.col(i);
+      i < n_particles; ++i, ++w){
+    diff = particles.col(i) - mean;
+    arma_dsyr(out, diff, std::exp(*w));
+  }
+
+  return arma::symmatu(out);
+}
+
+arma::vec particle_cloud::get_stats_mean() const {
+  if(dim_stats() < 1L)
+    return arma::vec();
+
+  /* one matrix-vector product */
+  const arma::vec w = arma::exp(ws_normalized);
+  return stats * w;
+}
+
+double particle_cloud::get_ll_aprx_err() const {
+#ifdef MSSM_DEBUG
+  if(log_aprx_err.n_elem != ws_normalized.n_elem)
+    throw std::invalid_argument("get_ll_aprx_err: invalid 'log_aprx_err'");
+#endif
+
+  /* the sum of the weights is within a factor 1 +/- r of the approximate
+   * sum where r is the weighted sum of the relative error bounds */
+  double r = 0.;
+  const double *w = ws_normalized.cbegin();
+  for(auto e : log_aprx_err){
+    const double lw = *w++;
+    if(std::isinf(e) and e < 0)
+      continue;
+    if(std::isinf(e) or std::isnan(lw))
+      return std::numeric_limits<double>::infinity();
+    r += std::exp(lw + e);
+  }
+
+  if(r >= 1.)
+    return std::numeric_limits<double>::infinity();
+  return -std::log1p(-r);
+}
+
+/* moves the memory of the smallest object which is large enough to the
+ * passed object */
+template<typename T>
+void cloud_pool::get_mem
+  (std::vector<T> &pool, T &out, const arma::uword n_ele){
+  auto best = pool.end();
+  for(auto it = pool.begin(); it != pool.end(); ++it)
+    if(it->n_alloc >= n_ele and
+         (best == pool.end() or it->n_alloc < best->n_alloc))
+      best = it;
+
+  if(best == pool.end())
+    return;
+
+  out.swap(*best);
+  pool.erase(best);
+}
+
+template<typename T>
+void cloud_pool::release_mem(std::vector<T> &pool, T &x){
+  if(x.n_alloc < 1L){
+    /* nothing to keep */
+    x.reset();
+    return;
+  }
+
+  if(pool.size() >= max_keep){
+    /* replace the smallest object if the new object is larger */
+    auto smallest = std::min_element(
+      pool.begin(), pool.end(), [](const T &a, const T &b){
+        return a.n_alloc < b.n_alloc;
+      });
+    if(smallest->n_alloc < x.n_alloc)
+      smallest->swap(x);
+    x.reset();
+    return;
+  }
+
+  pool.emplace_back();
+  pool.back().swap(x);
+}
+
+particle_cloud cloud_pool::get
+  (const arma::uword N_particles, const arma::uword dim_particle,
+   const arma::uword dim_stats){
+  particle_cloud out(0L, 0L, 0L);
+  {
+    std::lock_guard<std::mutex> lc(mem_mutex);
+    /* the stats are typically larger */
+    get_mem(mats, out.stats    , dim_stats    * N_particles);
+    get_mem(mats, out.particles, dim_particle * N_particles);
+    get_mem(vecs, out.ws           , N_particles);
+    get_mem(vecs, out.ws_normalized, N_particles);
+  }
+
+  /* the memory is re-used if it is large enough */
+  out.particles    .set_size(dim_particle, N_particles);
+  out.stats        .set_size(dim_stats   , N_particles);
+  out.ws           .set_size(N_particles);
+  out.ws_normalized.set_size(N_particles);
 
   return out;
 }
+
+void cloud_pool::release(particle_cloud &cl){
+  std::lock_guard<std::mutex> lc(mem_mutex);
+  release_mem(mats, cl.particles);
+  release_mem(mats, cl.stats);
+  release_mem(vecs, cl.ws);
+  release_mem(vecs, cl.ws_normalized);
+  release_mem(vecs, cl.log_aprx_err);
+  cl.KD_tree_old = KD_tree_topology();
+  cl.KD_tree_new = KD_tree_topology();
+}
+
+void cloud_pool::release(arma::mat &x){
+  std::lock_guard<std::mutex> lc(mem_mutex);
+  release_mem(mats, x);
+}
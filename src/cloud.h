@@ -1,6 +1,9 @@
 #ifndef CLOUD_H
 #define CLOUD_H
 #include "arma.h"
+#include "kd-tree.h"
+#include <mutex>
+#include <vector>
 
 class particle_cloud {
 public:
@@ -8,12 +11,21 @@ public:
    * not__ be altered */
   arma::mat particles;
   /* [stats dim] x [N particles] object. This can e.g., contain sufficient
-   * statistics if an EM algorithm is used */
+   * statistics if an EM algorithm is used. The Hessian part of the
+   * statistics is stored in packed form with the upper triangular part */
   arma::mat stats;
 
   /* log particle weights */
   arma::vec ws;
   arma::vec ws_normalized; /* normalized log weights */
+  /* log of upper bounds on the absolute errors of the unnormalized weights
+   * relative to the weights due to approximations. It is empty if the
+   * weights are not approximated or no bounds are available */
+  arma::vec log_aprx_err;
+  /* topologies of the k-d trees of the particles at the previous time point
+   * and of this cloud which were used to compute the weights with the dual
+   * k-d tree method. They are empty unless the trees are kept */
+  KD_tree_topology KD_tree_old, KD_tree_new;
 
   /* number of particles, dimension of particles, and dimension of
    * statistics. The memory is uninitialized and should be initialized by
@@ -34,7 +46,40 @@ public:
   }
 
   arma::vec get_cloud_mean() const;
+  /* weighted covariance matrix of the particles */
+  arma::mat get_cloud_cov() const;
   arma::vec get_stats_mean() const;
+  /* returns an upper bound on the absolute error of the log-likelihood
+   * contribution due to the approximations of the weights. Requires that
+   * log_aprx_err is not empty and that the weights are normalized */
+  double get_ll_aprx_err() const;
+};
+
+/* pool of memory for particle clouds. The memory of clouds and matrices
+ * which are no longer needed is kept and re-used for new clouds to avoid
+ * repeated allocations of large blocks of memory */
+class cloud_pool {
+  /* maximum number of objects of each type to keep */
+  static constexpr std::size_t max_keep = 8L;
+
+  std::mutex mem_mutex;
+  std::vector<arma::mat> mats;
+  std::vector<arma::vec> vecs;
+
+  template<typename T>
+  static void get_mem(std::vector<T>&, T&, const arma::uword);
+  template<typename T>
+  static void release_mem(std::vector<T>&, T&);
+
+public:
+  /* same arguments as particle_cloud's constructor. The memory is
+   * uninitialized */
+  particle_cloud get(const arma::uword, const arma::uword, const arma::uword);
+
+  /* returns the memory of the object to the pool. The object is left
+   * empty */
+  void release(particle_cloud&);
+  void release(arma::mat&);
 };
 
 #endif
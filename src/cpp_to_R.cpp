@@ -4,6 +4,7 @@
 #include "PF.h"
 #include "laplace.h"
 #include "smoother.h"
+#include "session.h"
 
 #ifdef MSSM_PROF
 #include "profile.h"
@@ -14,21 +15,22 @@ using Rcpp::Named;
 // [[Rcpp::export]]
 Rcpp::List test_KD_note(const arma::mat &X, const arma::uword N_min){
   thread_pool pool(1L);
-  KD_note root = get_KD_tree(X, N_min, pool);
+  KD_tree tree = get_KD_tree(X, N_min, pool);
 
   /* find leafs */
-  auto leafs = root.get_leafs();
+  auto leafs = tree.get_leafs();
   arma::uvec n_elems(leafs.size());
   arma::uvec indices(X.n_cols);
 
+  const std::vector<arma::uword> &tree_idx = tree.get_indices();
   auto n_el = n_elems.begin();
   auto idx = indices.begin();
   for(auto l : leafs){
-    auto l_indices = l->get_indices();
-    *(n_el++) = l_indices.size();
+    const KD_tree::node &nd = tree.get_node(l);
+    *(n_el++) = nd.n_elem();
 
-    for(auto l_indices_i : l_indices)
-      *(idx++) = l_indices_i;
+    for(arma::uword i = nd.start; i < nd.end; ++i)
+      *(idx++) = tree_idx[i];
   }
 
   return Rcpp::List::create(
@@ -69,18 +71,21 @@ struct naive_inner_loop {
       if(is_new_it)
         max_ws.fill(-std::numeric_limits<double>::infinity());
 
+      kernel.log_kernel_tile(
+        X.colptr(dat.inner_start), dat.inner_end - dat.inner_start,
+        Y.colptr(dat.outer_start + i_start), dat.outer_end - dat.outer_start,
+        N, ws_log.memptr() + dat.inner_start,
+        weights_inner.memptr() + dat.inner_start, weights_inner.n_rows);
+
       for(unsigned int ii = dat.outer_start, o = 0L; ii < dat.outer_end;
           ++ii, ++o){
         auto i = ii + i_start;
         double &max_weight = max_ws[o];
-        const double *y = Y.colptr(i);
-        double *wi = weights_inner.colptr(o) + dat.inner_start;
+        const double *wi = weights_inner.colptr(o) + dat.inner_start;
 
-        for(unsigned int j = dat.inner_start; j < dat.inner_end; ++j, ++wi){
-          *wi = kernel(X.colptr(j), y, N, ws_log[j]);
+        for(unsigned int j = dat.inner_start; j < dat.inner_end; ++j, ++wi)
           if(*wi > max_weight)
             max_weight = *wi;
-        }
 
         if(is_final_inner_it)
           out[i] = log_sum_log(weights_inner.unsafe_col(o), max_ws[o]);
@@ -161,16 +166,36 @@ arma::mat sample_mv_tdist
   return out;
 }
 
+/* creates the control object from a list as returned by mssm_control. The
+ * list also contains the options which are set in each call: the number of
+ * particles, what to compute, the trace level, and the zero-based indices of
+ * the elements of the gradient which statistics are computed for */
+inline control_obj get_control_obj(const Rcpp::List control){
+  using Rcpp::as;
+  return control_obj(
+    as<arma::uword>(control["n_threads"]), as<double>(control["nu"]),
+    as<double>(control["covar_fac"]), as<double>(control["ftol_rel"]),
+    as<arma::uword>(control["N_part"]), as<std::string>(control["what"]),
+    as<unsigned int>(control["trace"]), as<arma::uword>(control["KD_N_max"]),
+    as<double>(control["aprx_eps"]), as<bool>(control["use_antithetic"]),
+    as<double>(control["ess_target"]), as<arma::uword>(control["N_part_min"]),
+    as<arma::uword>(control["N_part_max"]),
+    as<std::string>(control["which_rng"]) == "philox",
+    as<bool>(control["KD_use_float"]), as<arma::uvec>(control["stat_idx"]),
+    as<arma::uword>(control["KD_hermite_order"]),
+    as<double>(control["KD_ll_err_target"]),
+    as<bool>(control["KD_keep_trees"]), as<bool>(control["KD_deterministic"]),
+    as<std::string>(control["KD_tree_type"]) == "ball",
+    as<bool>(control["KD_aprx_err"]));
+}
+
 inline std::unique_ptr<problem_data> get_problem_data
   (const arma::vec &Y, const arma::vec &cfix, const arma::vec &ws,
    const arma::vec &offsets, const arma::vec &disp, const arma::mat &X,
    const arma::mat &Z, const arma::uvec &time_indices_elems,
    const arma::uvec &time_indices_len, const arma::mat &F, const arma::mat &Q,
    const arma::mat &Q0, const std::string &fam, const arma::vec &mu0,
-   const arma::uword n_threads, const double nu, const double covar_fac,
-   const double ftol_rel, const arma::uword N_part, const std::string &what,
-   const unsigned int trace, const arma::uword KD_N_max, const double aprx_eps,
-   const bool use_antithetic){
+   const Rcpp::List control){
   /* create vector with time indices */
   const std::vector<arma::uvec> time_indices = ([&]{
     std::vector<arma::uvec> indices;
@@ -191,8 +216,7 @@ inline std::unique_ptr<problem_data> get_problem_data
   })();
 
   /* setup problem data object */
-  control_obj ctrl(n_threads, nu, covar_fac, ftol_rel, N_part, what, trace,
-                   KD_N_max, aprx_eps, use_antithetic);
+  control_obj ctrl = get_control_obj(control);
   std::unique_ptr<problem_data> out(new problem_data(
       Y, cfix, ws, offsets, disp, X, Z, std::move(time_indices), F, Q, Q0,
       fam, mu0, std::move(ctrl)));
@@ -200,6 +224,143 @@ inline std::unique_ptr<problem_data> get_problem_data
   return out;
 }
 
+inline std::unique_ptr<sampler> get_sampler(const Rcpp::List control){
+  const std::string which_sampler =
+    Rcpp::as<std::string>(control["which_sampler"]);
+  if(which_sampler == "bootstrap")
+    return get_bootstrap_sampler();
+  if(which_sampler == "mode_aprx")
+    return get_mode_aprx_sampler();
+
+  throw std::invalid_argument("Unkown sampler: '" + which_sampler + "'");
+}
+
+inline std::unique_ptr<stats_comp_helper> get_stats_comp_helper
+  (const Rcpp::List control){
+  const std::string which_ll_cp =
+    Rcpp::as<std::string>(control["which_ll_cp"]);
+  const arma::uword subsample_size =
+    Rcpp::as<arma::uword>(control["subsample_size"]);
+  if(which_ll_cp == "no_aprx")
+    return std::unique_ptr<stats_comp_helper>(
+      new stats_comp_helper_no_aprx());
+  if(which_ll_cp == "no_aprx_gemm")
+    return std::unique_ptr<stats_comp_helper>(
+      new stats_comp_helper_no_aprx(true));
+  if(which_ll_cp == "KD")
+    return std::unique_ptr<stats_comp_helper>(
+      new stats_comp_helper_aprx_KD());
+  if(which_ll_cp == "resample_systematic")
+    return std::unique_ptr<stats_comp_helper>(
+      new stats_comp_helper_resample(stats_comp_helper_resample::systematic));
+  if(which_ll_cp == "resample_stratified")
+    return std::unique_ptr<stats_comp_helper>(
+      new stats_comp_helper_resample(stats_comp_helper_resample::stratified));
+  if(which_ll_cp == "resample_residual")
+    return std::unique_ptr<stats_comp_helper>(
+      new stats_comp_helper_resample(stats_comp_helper_resample::residual));
+  if(which_ll_cp == "subsample_systematic")
+    return std::unique_ptr<stats_comp_helper>(
+      new stats_comp_helper_subsample(
+          subsample_size, stats_comp_helper_resample::systematic));
+  if(which_ll_cp == "subsample_stratified")
+    return std::unique_ptr<stats_comp_helper>(
+      new stats_comp_helper_subsample(
+          subsample_size, stats_comp_helper_resample::stratified));
+
+  throw std::invalid_argument("Unkown ll_cp: '" + which_ll_cp + "'");
+}
+
+/* converts the topology of a k-d tree to a list with a 3 x [number of nodes]
+ * matrix with the nodes and a vector with the indices and back */
+inline Rcpp::List KD_tree_topology_to_list(const KD_tree_topology &topo){
+  Rcpp::IntegerMatrix nodes(3L, topo.nodes.size());
+  auto n = nodes.begin();
+  for(auto &nd : topo.nodes){
+    *(n++) = nd.start;
+    *(n++) = nd.end;
+    *(n++) = nd.left;
+  }
+
+  return Rcpp::List::create(
+    Named("nodes")   = std::move(nodes),
+    Named("indices") = Rcpp::IntegerVector(
+      topo.indices.begin(), topo.indices.end()));
+}
+
+inline KD_tree_topology KD_tree_topology_from_list(const Rcpp::List x){
+  const Rcpp::IntegerMatrix nodes = x["nodes"];
+  const Rcpp::IntegerVector indices = x["indices"];
+  if(nodes.nrow() != 3L)
+    throw std::invalid_argument("invalid 'nodes'");
+
+  KD_tree_topology out;
+  out.nodes.reserve(nodes.ncol());
+  for(auto n = nodes.begin(); n != nodes.end(); n += 3L){
+    if(n[0L] < 0L or n[1L] < 0L or n[2L] < 0L)
+      throw std::invalid_argument("invalid 'nodes'");
+    out.nodes.push_back({ (arma::uword)n[0L], (arma::uword)n[1L],
+                          (arma::uword)n[2L] });
+  }
+
+  out.indices.reserve(indices.size());
+  for(auto i : indices){
+    if(i < 0L)
+      throw std::invalid_argument("invalid 'indices'");
+    out.indices.push_back(i);
+  }
+
+  return out;
+}
+
+/* converts output from the particle filter to a list. The bounds on the
+ * approximation errors and the k-d trees are added as attributes if there
+ * are any */
+inline Rcpp::List get_pf_list
+  (std::vector<particle_cloud> &comp_res, const comp_out what){
+  Rcpp::List out(comp_res.size());
+  Rcpp::NumericVector ll_aprx_err(comp_res.size(), NA_REAL);
+  bool any_aprx_err = false;
+
+  auto add_res = [&](particle_cloud &cl, double &ll_err){
+    /* the Hessian is stored in packed form */
+    if(what == Hessian)
+      cl.stats = unpack_stats(cl.stats, what);
+
+    const bool has_err = cl.log_aprx_err.n_elem > 0L;
+    if(has_err){
+      ll_err = cl.get_ll_aprx_err();
+      any_aprx_err = true;
+    }
+
+    Rcpp::List res = Rcpp::List::create(
+      Named("particles")     = std::move(cl.particles),
+      Named("stats")         = std::move(cl.stats),
+      Named("ws")            = std::move(cl.ws),
+      Named("ws_normalized") = std::move(cl.ws_normalized)
+    );
+    if(has_err)
+      res.attr("log_aprx_err") = Rcpp::NumericVector(
+        cl.log_aprx_err.begin(), cl.log_aprx_err.end());
+    if(!cl.KD_tree_old.empty())
+      res.attr("KD_trees") = Rcpp::List::create(
+        Named("old") = KD_tree_topology_to_list(cl.KD_tree_old),
+        Named("new") = KD_tree_topology_to_list(cl.KD_tree_new));
+
+    return res;
+  };
+
+  auto p_cloud = comp_res.begin();
+  auto p_err = ll_aprx_err.begin();
+  for(auto &ele : out)
+    ele = add_res(*(p_cloud++), *(p_err++));
+
+  if(any_aprx_err)
+    out.attr("ll_aprx_err") = ll_aprx_err;
+
+  return out;
+}
+
 // [[Rcpp::export]]
 Rcpp::List pf_filter
   (const arma::vec &Y, const arma::vec &cfix, const arma::vec &ws,
@@ -207,81 +368,99 @@ Rcpp::List pf_filter
    const arma::mat &Z, const arma::uvec &time_indices_elems,
    const arma::uvec &time_indices_len, const arma::mat &F, const arma::mat &Q,
    const arma::mat &Q0, const std::string &fam, const arma::vec &mu0,
-   const arma::uword n_threads, const double nu, const double covar_fac,
-   const double ftol_rel, const arma::uword N_part, const std::string &what,
-   const std::string &which_sampler, const std::string &which_ll_cp,
-   const unsigned int trace, const arma::uword KD_N_max, const double aprx_eps,
-   const bool use_antithetic)
+   const Rcpp::List control)
 {
   std::unique_ptr<problem_data> dat = get_problem_data(
     Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len,
-    F, Q, Q0, fam, mu0, n_threads, nu, covar_fac, ftol_rel, N_part,
-    what, trace, KD_N_max, aprx_eps, use_antithetic);
-
-  /* setup sampler */
-  const std::unique_ptr<sampler> sampler_ = ([&]{
-    if(which_sampler == "bootstrap")
-      return get_bootstrap_sampler();
-    if(which_sampler == "mode_aprx")
-      return get_mode_aprx_sampler();
-
-    throw std::invalid_argument("Unkown sampler: '" + which_sampler + "'");
-  })();
-
-  /* setup object to compute log likehood and stats */
-  const std::unique_ptr<stats_comp_helper> stats_cp = ([&]{
-    if(which_ll_cp == "no_aprx")
-      return std::unique_ptr<stats_comp_helper>(
-        new stats_comp_helper_no_aprx());
-    if(which_ll_cp == "KD")
-      return std::unique_ptr<stats_comp_helper>(
-        new stats_comp_helper_aprx_KD());
+    F, Q, Q0, fam, mu0, control);
 
-    throw std::invalid_argument("Unkown ll_cp: '" + which_ll_cp + "'");
-  })();
+  /* setup sampler and object to compute log likehood and stats */
+  const std::unique_ptr<sampler> sampler_ = get_sampler(control);
+  const std::unique_ptr<stats_comp_helper> stats_cp =
+    get_stats_comp_helper(control);
 
   /* run particle filter */
   auto comp_res = PF(*dat, *sampler_, *stats_cp);
 
   /* make list and return */
-  Rcpp::List out(comp_res.size());
+  return get_pf_list(comp_res, dat->ctrl.what_stat);
+}
 
-  auto add_res = [](particle_cloud &cl){
-    return Rcpp::List::create(
-      Named("particles")     = std::move(cl.particles),
-      Named("stats")         = std::move(cl.stats),
-      Named("ws")            = std::move(cl.ws),
-      Named("ws_normalized") = std::move(cl.ws_normalized)
-    );
-  };
+/* runs the particle filter and only returns summary statistics. The
+ * particle clouds are freed after each period */
+inline Rcpp::List get_pf_summary
+  (const problem_data &dat, const sampler &samp,
+   const stats_comp_helper &stats_cp){
+  const arma::uword n_periods = dat.n_periods();
+  arma::vec ll_terms(n_periods), ess(n_periods), stats_mean;
+  arma::mat cloud_mean;
+  arma::cube cloud_cov;
+  Rcpp::NumericVector ll_aprx_err(n_periods, NA_REAL);
+  bool any_aprx_err = false;
+  auto callback = [&](const arma::uword ti, const particle_cloud &cl,
+                      const pf_period_summary &summary){
+    if(ti == 0L){
+      cloud_mean.set_size(cl.dim_particle(), n_periods);
+      cloud_cov .set_size(cl.dim_particle(), cl.dim_particle(), n_periods);
+    }
 
-  auto p_cloud = comp_res.begin();
-  for(auto &ele : out)
-    ele = add_res(*(p_cloud++));
+    ll_terms[ti] = summary.ll_term;
+    ess     [ti] = summary.ess;
+    if(!std::isnan(summary.ll_aprx_err)){
+      ll_aprx_err[ti] = summary.ll_aprx_err;
+      any_aprx_err = true;
+    }
+    cloud_mean.col  (ti) = summary.cloud_mean;
+    cloud_cov .slice(ti) = cl.get_cloud_cov();
+    if(ti == n_periods - 1L)
+      stats_mean = unpack_stats(summary.stats_mean, dat.ctrl.what_stat);
+  };
 
+  std::unique_ptr<particle_cloud> cloud;
+  PF_stream(dat, samp, stats_cp, cloud, 0L, callback);
+
+  Rcpp::List out = Rcpp::List::create(
+    Named("ll_terms")   = std::move(ll_terms),
+    Named("ess")        = std::move(ess),
+    Named("cloud_mean") = std::move(cloud_mean),
+    Named("cloud_cov")  = std::move(cloud_cov),
+    Named("stats_mean") = std::move(stats_mean));
+  if(any_aprx_err)
+    out.push_back(ll_aprx_err, "ll_aprx_err");
   return out;
 }
 
 // [[Rcpp::export]]
-Rcpp::List run_Laplace_aprx
+Rcpp::List pf_filter_summary
   (const arma::vec &Y, const arma::vec &cfix, const arma::vec &ws,
    const arma::vec &offsets, const arma::vec &disp, const arma::mat &X,
    const arma::mat &Z, const arma::uvec &time_indices_elems,
    const arma::uvec &time_indices_len, const arma::mat &F, const arma::mat &Q,
    const arma::mat &Q0, const std::string &fam, const arma::vec &mu0,
-   const arma::uword n_threads, const double nu, const double covar_fac,
-   const double ftol_rel, const arma::uword N_part, const std::string &what,
-   const unsigned int trace, const arma::uword KD_N_max, const double aprx_eps,
-   const double ftol_abs, const double la_ftol_rel,
-   const double ftol_abs_inner, const double la_ftol_rel_inner,
-   const unsigned maxeval, const unsigned maxeval_inner){
+   const Rcpp::List control)
+{
+  /* the k-d trees are not kept as the clouds are not returned */
+  Rcpp::List ctrl_summary = Rcpp::clone(control);
+  ctrl_summary["KD_keep_trees"] = false;
   std::unique_ptr<problem_data> dat = get_problem_data(
     Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len,
-    F, Q, Q0, fam, mu0, n_threads, nu, covar_fac, ftol_rel, N_part, what,
-    trace, KD_N_max, aprx_eps, false);
+    F, Q, Q0, fam, mu0, ctrl_summary);
 
-  auto result = Laplace_aprx(*dat, ftol_abs, la_ftol_rel, ftol_abs_inner,
-                             la_ftol_rel_inner, maxeval, maxeval_inner);
+  const std::unique_ptr<sampler> sampler_ = get_sampler(control);
+  const std::unique_ptr<stats_comp_helper> stats_cp =
+    get_stats_comp_helper(control);
+
+  return get_pf_summary(*dat, *sampler_, *stats_cp);
+}
+
+inline Rcpp::List Laplace_aprx_to_list
+  (problem_data &dat, const Rcpp::List control){
+  using Rcpp::as;
+  auto result = Laplace_aprx(
+    dat, as<double>(control["ftol_abs"]), as<double>(control["la_ftol_rel"]),
+    as<double>(control["ftol_abs_inner"]),
+    as<double>(control["la_ftol_rel_inner"]),
+    as<unsigned>(control["maxeval"]), as<unsigned>(control["maxeval_inner"]));
 
   return Rcpp::List::create(
     Named("F.") = std::move(result.F),
@@ -294,33 +473,47 @@ Rcpp::List run_Laplace_aprx
 }
 
 // [[Rcpp::export]]
-Rcpp::List smoother_cpp
+Rcpp::List run_Laplace_aprx
   (const arma::vec &Y, const arma::vec &cfix, const arma::vec &ws,
    const arma::vec &offsets, const arma::vec &disp, const arma::mat &X,
    const arma::mat &Z, const arma::uvec &time_indices_elems,
    const arma::uvec &time_indices_len, const arma::mat &F, const arma::mat &Q,
    const arma::mat &Q0, const std::string &fam, const arma::vec &mu0,
-   const arma::uword n_threads, const double nu, const double covar_fac,
-   const double ftol_rel, const arma::uword N_part, const std::string &what,
-   const unsigned int trace, const arma::uword KD_N_max, const double aprx_eps,
-   const std::string &which_ll_cp, const Rcpp::List pf_output,
-   const bool use_antithetic){
-  /* setup problem data */
+   const Rcpp::List control){
   std::unique_ptr<problem_data> dat = get_problem_data(
     Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len,
-    F, Q, Q0, fam, mu0, n_threads, nu, covar_fac, ftol_rel, N_part, what,
-    trace, KD_N_max, aprx_eps, use_antithetic);
+    F, Q, Q0, fam, mu0, control);
+
+  return Laplace_aprx_to_list(*dat, control);
+}
 
+inline Rcpp::List run_smoother
+  (problem_data &dat, const std::string &which_ll_cp,
+   const Rcpp::List pf_output){
   /* make list of particles and weights */
   const unsigned n_periods = pf_output.size();
   std::vector<arma::mat> particles;
   particles.reserve(n_periods);
   std::vector<arma::vec> particle_weights;
   particle_weights.reserve(n_periods);
+  /* the k-d trees from the particle filter if there are any */
+  const bool use_KD = which_ll_cp == "KD";
+  std::vector<KD_tree_topology> old_trees, new_trees;
+  if(use_KD){
+    old_trees.resize(n_periods);
+    new_trees.resize(n_periods);
+  }
+  unsigned i = 0L;
   for(auto &x : pf_output){
     Rcpp::List z = Rcpp::List(x);
     particles.push_back(Rcpp::as<arma::mat>(z["particles"]));
     particle_weights.push_back(Rcpp::as<arma::vec>(z["ws_normalized"]));
+    if(use_KD and z.hasAttribute("KD_trees")){
+      const Rcpp::List trees = z.attr("KD_trees");
+      old_trees[i] = KD_tree_topology_from_list(trees["old"]);
+      new_trees[i] = KD_tree_topology_from_list(trees["new"]);
+    }
+    ++i;
   }
 
   std::vector<const arma::mat *> particles_ptr;
@@ -341,15 +534,178 @@ Rcpp::List smoother_cpp
     return out;
   };
 
-  if(which_ll_cp == "no_aprx")
-    return prep_res(smoother     (*dat, particles_ptr, particle_weights_ptr));
-  else if(which_ll_cp == "KD")
-    return prep_res(smoother_aprx(*dat, particles_ptr, particle_weights_ptr));
+  /* the smoother does not depend on the ancestors so we use the O(N^2)
+   * smoother with the resampling and subsampling methods */
+  if(which_ll_cp == "no_aprx" or which_ll_cp.compare(0L, 9L, "resample_") == 0
+       or which_ll_cp.compare(0L, 10L, "subsample_") == 0)
+    return prep_res(smoother     (dat, particles_ptr, particle_weights_ptr));
+  else if(which_ll_cp == "no_aprx_gemm")
+    return prep_res(smoother     (dat, particles_ptr, particle_weights_ptr,
+                                  true));
+  else if(use_KD)
+    return prep_res(smoother_aprx(dat, particles_ptr, particle_weights_ptr,
+                                  old_trees, new_trees));
 
   throw std::invalid_argument(
       "'which_ll_cp' '" + which_ll_cp + "' not implemented");
 }
 
+// [[Rcpp::export]]
+Rcpp::List smoother_cpp
+  (const arma::vec &Y, const arma::vec &cfix, const arma::vec &ws,
+   const arma::vec &offsets, const arma::vec &disp, const arma::mat &X,
+   const arma::mat &Z, const arma::uvec &time_indices_elems,
+   const arma::uvec &time_indices_len, const arma::mat &F, const arma::mat &Q,
+   const arma::mat &Q0, const std::string &fam, const arma::vec &mu0,
+   const Rcpp::List control, const Rcpp::List pf_output){
+  /* setup problem data */
+  std::unique_ptr<problem_data> dat = get_problem_data(
+    Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len,
+    F, Q, Q0, fam, mu0, control);
+
+  return run_smoother(
+    *dat, Rcpp::as<std::string>(control["which_ll_cp"]), pf_output);
+}
+
+// [[Rcpp::export]]
+SEXP pf_session_create
+  (const arma::vec &Y, const arma::vec &cfix, const arma::vec &ws,
+   const arma::vec &offsets, const arma::vec &disp, const arma::mat &X,
+   const arma::mat &Z, const arma::uvec &time_indices_elems,
+   const arma::uvec &time_indices_len, const arma::mat &F, const arma::mat &Q,
+   const arma::mat &Q0, const std::string &fam, const arma::vec &mu0,
+   const Rcpp::List control)
+{
+  std::unique_ptr<pf_session> sess(
+      new pf_session(Rcpp::as<std::string>(control["which_ll_cp"])));
+  sess->prob = get_problem_data(
+    Y, cfix, ws, offsets, disp, X, Z, time_indices_elems, time_indices_len,
+    F, Q, Q0, fam, mu0, control);
+  sess->prob->set_use_obs_dist_cache(true);
+
+  sess->samp = get_sampler(control);
+  sess->stats_cp = get_stats_comp_helper(control);
+
+  return Rcpp::XPtr<pf_session>(sess.release(), true);
+}
+
+inline pf_session& get_pf_session(SEXP ptr){
+  Rcpp::XPtr<pf_session> sess(ptr);
+  /* e.g., if the object has been serialized */
+  if(!sess.get())
+    throw std::invalid_argument("invalid session pointer");
+
+  return *sess;
+}
+
+// [[Rcpp::export]]
+void pf_session_set_params
+  (SEXP ptr, const arma::vec &cfix, const arma::vec &disp, const arma::mat &F,
+   const arma::mat &Q, const arma::mat &Q0, const arma::vec &mu0){
+  problem_data &dat = *get_pf_session(ptr).prob;
+  if(arma::size(cfix) != arma::size(dat.get_cfix()))
+    throw std::invalid_argument("invalid 'cfix'");
+  if(arma::size(disp) != arma::size(dat.get_disp()))
+    throw std::invalid_argument("invalid 'disp'");
+  if(arma::size(F) != arma::size(dat.get_F()))
+    throw std::invalid_argument("invalid 'F'");
+  if(arma::size(Q) != arma::size(dat.get_Q()))
+    throw std::invalid_argument("invalid 'Q'");
+  if(arma::size(Q0) != arma::size(dat.get_Q0()))
+    throw std::invalid_argument("invalid 'Q0'");
+  if(arma::size(mu0) != arma::size(dat.get_mu0()))
+    throw std::invalid_argument("invalid 'mu0'");
+
+  dat.set_cfix(cfix);
+  dat.set_disp(disp);
+  dat.set_F(F);
+  dat.set_Q(Q);
+  dat.set_Q0(Q0);
+  dat.set_mu0(mu0);
+}
+
+// [[Rcpp::export]]
+Rcpp::List pf_session_filter(SEXP ptr){
+  pf_session &sess = get_pf_session(ptr);
+  auto comp_res = PF(*sess.prob, *sess.samp, *sess.stats_cp);
+
+  return get_pf_list(comp_res, sess.prob->ctrl.what_stat);
+}
+
+// [[Rcpp::export]]
+Rcpp::List pf_session_filter_summary(SEXP ptr){
+  pf_session &sess = get_pf_session(ptr);
+  return get_pf_summary(*sess.prob, *sess.samp, *sess.stats_cp);
+}
+
+// [[Rcpp::export]]
+Rcpp::List pf_session_smoother(SEXP ptr, const Rcpp::List pf_output){
+  pf_session &sess = get_pf_session(ptr);
+  return run_smoother(*sess.prob, sess.which_ll_cp, pf_output);
+}
+
+// [[Rcpp::export]]
+Rcpp::List pf_session_Laplace(SEXP ptr, const Rcpp::List control){
+  pf_session &sess = get_pf_session(ptr);
+  return Laplace_aprx_to_list(*sess.prob, control);
+}
+
+// [[Rcpp::export]]
+void pf_session_append
+  (SEXP ptr, const arma::vec &Y, const arma::vec &ws,
+   const arma::vec &offsets, const arma::mat &X, const arma::mat &Z,
+   const arma::uvec &time_indices_elems, const arma::uvec &time_indices_len){
+  get_pf_session(ptr).append(
+    Y, ws, offsets, X, Z, time_indices_elems, time_indices_len);
+}
+
+// [[Rcpp::export]]
+Rcpp::List pf_session_stream(SEXP ptr, const bool restart){
+  pf_session &sess = get_pf_session(ptr);
+  if(restart)
+    sess.reset_stream();
+
+  const problem_data &dat = *sess.prob;
+  const arma::uword start = sess.n_streamed,
+    n_new = dat.n_periods() - start;
+
+  arma::vec ll_terms(n_new), ess(n_new);
+  arma::mat cloud_mean, stats_mean;
+  Rcpp::NumericVector ll_aprx_err(n_new, NA_REAL);
+  bool any_aprx_err = false;
+  auto callback = [&](const arma::uword ti, const particle_cloud &cl,
+                      const pf_period_summary &summary){
+    const arma::uword i = ti - start;
+    if(i == 0L){
+      cloud_mean.set_size(cl.dim_particle(), n_new);
+      stats_mean.set_size(cl.dim_stats()   , n_new);
+    }
+
+    ll_terms[i] = summary.ll_term;
+    ess     [i] = summary.ess;
+    if(!std::isnan(summary.ll_aprx_err)){
+      ll_aprx_err[i] = summary.ll_aprx_err;
+      any_aprx_err = true;
+    }
+    cloud_mean.col(i) = summary.cloud_mean;
+    stats_mean.col(i) = summary.stats_mean;
+    sess.n_streamed = ti + 1L;
+  };
+
+  PF_stream(dat, *sess.samp, *sess.stats_cp, sess.last_cloud, start,
+            callback);
+  stats_mean = unpack_stats(stats_mean, dat.ctrl.what_stat);
+
+  Rcpp::List out = Rcpp::List::create(
+    Named("ll_terms")   = std::move(ll_terms),
+    Named("ess")        = std::move(ess),
+    Named("cloud_mean") = std::move(cloud_mean),
+    Named("stats_mean") = std::move(stats_mean));
+  if(any_aprx_err)
+    out.push_back(ll_aprx_err, "ll_aprx_err");
+  return out;
+}
+
 /* exported to test the samples */
 // [[Rcpp::export]]
 arma::mat t_dist_antithe_test
@@ -6,7 +6,6 @@
 #include "misc.h"
 
 static constexpr int I_ONE = 1L;
-static constexpr double D_M_ONE = -1.;
 
 void mv_norm::sample(arma::mat &out) const {
 #ifdef MSSM_DEBUG
@@ -127,35 +126,301 @@ void mv_tdist::sample_anti(arma::mat &out) const {
   }
 }
 
-void mv_norm_reg::comp_stats_state_state
-  (const double *x, const double *y, const double w, double *stat,
-   const comp_out what) const
-{
-  gaurd_new_comp_out(what);
-  if(what == log_densty)
+/* returns a matrix which refers to the columns in [start, end) */
+static arma::mat get_col_block
+  (arma::mat &out, const arma::uword start, const arma::uword end){
+#ifdef MSSM_DEBUG
+  if(start > end or end > out.n_cols)
+    throw invalid_argument("invalid 'start' and 'end'");
+#endif
+  return arma::mat(out.colptr(start), out.n_rows, end - start, false, true);
+}
+
+void mv_norm::sample
+  (arma::mat &out, const philox::key_type &key, const arma::uword start,
+   const arma::uword end) const {
+#ifdef MSSM_DEBUG
+  if(out.n_rows != dim)
+    throw invalid_argument("'out' and 'dim' does not match");
+#endif
+  if(start >= end)
     return;
 
-  /* allocate the memory we need */
-  const int nm = dim, nm_sq = nm * nm, nm_lw = (nm * (nm + 1L)) / 2L;
-  M_THREAD_LOCAL std::vector<double> work_mem;
-  if(what == Hessian){
-    /* We need memory for
-         an intermediary    [state dim]   x [state dim]   matrix
-         an intermediary    [state dim]^2 x [state dim]^2 matrix
-         same as above but only the lower triangular part * [state dim]^2
-     */
-    const unsigned int needed_dim = nm_sq * (1L + nm_sq + nm_lw);
-    if(work_mem.size() < needed_dim)
-      work_mem.resize(needed_dim);
+  /* sample standard normal distributed variables */
+  for(arma::uword j = start; j < end; ++j){
+    philox::stream rng(key, j);
+    double *x = out.colptr(j);
+    for(arma::uword i = 0; i < dim; ++i, ++x)
+      *x = rng.norm();
+  }
 
-  } else {
-    /* We need memory for
-         an intermediary [state dim] x [state dim] matrix */
-    const unsigned int needed_dim = nm_sq;
-    if(work_mem.size() < needed_dim)
-      work_mem.resize(needed_dim);
+  /* account for covariance matrix and add mean */
+  arma::mat block = get_col_block(out, start, end);
+  chol_.mult(block);
+  if(mu)
+    block.each_col() += *mu;
+}
+
+/* samples a multivariate t-distributed variable with an identity scale
+ * matrix and returns the scaled chi^2 variable */
+static double sample_std_tdist
+  (philox::stream &rng, double *x, const arma::uword dim, const double nu){
+  for(arma::uword i = 0; i < dim; ++i)
+    x[i] = rng.norm();
+
+  const double chi = rng.chisq(nu) / nu, chi_sqrt = std::sqrt(chi);
+  for(arma::uword i = 0; i < dim; ++i)
+    x[i] /= chi_sqrt;
+
+  return chi;
+}
+
+/* evaluates the continued fraction of the regularized incomplete beta
+ * function with the modified Lentz's method */
+static double inc_beta_cont_frac
+  (const double x, const double a, const double b){
+  constexpr double eps = 1e-15, tiny = 1e-300;
+  auto not_tiny = [&](const double z){
+    return std::abs(z) < tiny ? tiny : z;
+  };
+
+  double c = 1., d = 1. / not_tiny(1. - (a + b) * x / (a + 1.)), out = d;
+  for(unsigned m = 1L; m < 1000L; ++m){
+    const double m2 = 2. * m,
+      even = m * (b - m) * x / ((a + m2 - 1.) * (a + m2)),
+      odd = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1.));
+
+    d = 1. / not_tiny(1. + even * d);
+    c = not_tiny(1. + even / c);
+    out *= d * c;
+
+    d = 1. / not_tiny(1. + odd * d);
+    c = not_tiny(1. + odd / c);
+    const double delta = d * c;
+    out *= delta;
+    if(std::abs(delta - 1.) < eps)
+      break;
+  }
+
+  return out;
+}
+
+/* computes the regularized incomplete beta function I_x(a, b) given x,
+ * 1 - x, and the log of the beta function B(a, b). R's functions are not
+ * used as they are not thread-safe */
+static double inc_beta
+  (const double x, const double x_c, const double a, const double b,
+   const double log_beta){
+  if(x <= 0.)
+    return 0.;
+  if(x_c <= 0.)
+    return 1.;
+
+  const double log_fac = a * std::log(x) + b * std::log(x_c) - log_beta;
+  if(x < (a + 1.) / (a + b + 2.))
+    return std::exp(log_fac) * inc_beta_cont_frac(x, a, b) / a;
+  return 1. - std::exp(log_fac) * inc_beta_cont_frac(x_c, b, a) / b;
+}
+
+/* returns y such that I_y(a, b) = 1 - I_x(a, b) given x, 1 - x, and the log
+ * of the beta function B(a, b). Newton's method is used with bisection if
+ * the Newton step is outside the current bracket */
+static double inc_beta_upper_quantile
+  (const double x, const double x_c, const double a, const double b,
+   const double log_beta){
+  const double p = inc_beta(x_c, x, b, a, log_beta);
+
+  /* the solution is 1 - x if a = b */
+  double lo = 0., hi = 1., y = x_c;
+  for(unsigned i = 0; i < 200L; ++i){
+    const double f = inc_beta(y, 1. - y, a, b, log_beta) - p;
+    if(f == 0.)
+      break;
+    if(f < 0.)
+      lo = y;
+    else
+      hi = y;
+
+    const double deriv = std::exp(
+      (a - 1.) * std::log(y) + (b - 1.) * std::log1p(-y) - log_beta);
+    double y_new = y - f / deriv;
+    if(!(y_new > lo and y_new < hi))
+      y_new = (lo + hi) * .5;
+
+    const bool done = std::abs(y_new - y) <= 1e-14 * y;
+    y = y_new;
+    if(done or hi - lo <= 1e-14 * lo)
+      break;
+  }
+
+  return y;
+}
+
+void mv_tdist::sample
+  (arma::mat &out, const philox::key_type &key, const arma::uword start,
+   const arma::uword end) const {
+#ifdef MSSM_DEBUG
+  if(out.n_rows != dim)
+    throw invalid_argument("'out' and 'dim' does not match");
+#endif
+  if(start >= end)
+    return;
+
+  for(arma::uword j = start; j < end; ++j){
+    philox::stream rng(key, j);
+    sample_std_tdist(rng, out.colptr(j), dim, nu);
+  }
+
+  /* account for covariance matrix and add mean */
+  arma::mat block = get_col_block(out, start, end);
+  chol_.mult(block);
+  if(mu)
+    block.each_col() += *mu;
+}
+
+void mv_tdist::sample_anti
+  (arma::mat &out, const philox::key_type &key, const arma::uword start,
+   const arma::uword end) const {
+#ifdef MSSM_DEBUG
+  if(out.n_rows != dim)
+    throw invalid_argument("'out' and 'dim' does not match");
+#endif
+  if(start >= end)
+    return;
+
+  /* the first columns are sampled without antithetic variables */
+  const arma::uword resid = out.n_cols % 4L;
+  const double n_vars = dim;
+  for(arma::uword j = start; j < end;){
+    philox::stream rng(key, j);
+    double * const x = out.colptr(j);
+    if(j < resid){
+      sample_std_tdist(rng, x, dim, nu);
+      ++j;
+      continue;
+    }
+
+    if((j - resid) % 4L != 0L or j + 4L > end)
+      throw invalid_argument(
+          "mv_tdist::sample_anti: block is not aligned with the groups");
+
+    sample_std_tdist(rng, x, dim, nu);
+
+    /* compute intermediaries. The squared norm is already divided by the
+     * chi^2 variable */
+    const double u = ([&]{
+      double out = 0;
+      for(arma::uword i = 0; i < dim; ++i)
+        out += x[i] * x[i];
+
+      return out / n_vars;
+    })();
+    /* u is F(dim, nu) distributed and w is beta(dim / 2, nu / 2)
+     * distributed. Find the quantile with the same upper tail probability as
+     * the lower tail probability of u */
+    const double
+      w    = n_vars * u / (n_vars * u + nu),
+      w_c  = nu        / (n_vars * u + nu),
+      w_up = inc_beta_upper_quantile(
+        w, w_c, n_vars * .5, nu * .5, log_beta_anti),
+      up   = nu * w_up / (n_vars * (1. - w_up));
+
+    /* location balanced antithetic variable */
+    out.col(j + 1) = -out.col(j);
+
+    /* scale balanced antithetic variable */
+    const double scale_fac = std::sqrt(up / u);
+    out.col(j + 2) = scale_fac * out.col(j);
+    out.col(j + 3) = scale_fac * out.col(j + 1);
+
+    j += 4L;
+  }
+
+  /* handle scale and location */
+  arma::mat block = get_col_block(out, start, end);
+  chol_.mult(block);
+  if(mu)
+    block.each_col() += *mu;
+}
 
+/* computes the squared norms of the columns of the first argument after
+ * subtracting the mean and multiplying by the inverse of the upper
+ * triangular matrix in the Cholesky decomposition */
+static void mahalanobis_cols
+  (const arma::mat &X, const arma::vec *mu, const chol_decomp &chol_,
+   arma::vec &out){
+  arma::mat Z = X;
+  if(mu)
+    Z.each_col() -= *mu;
+  chol_.solve_half(Z);
+
+  out.set_size(Z.n_cols);
+  const arma::uword n_rows = Z.n_rows;
+  const double *z = Z.begin();
+  for(auto &o : out){
+    double dist = 0.;
+    for(arma::uword i = 0; i < n_rows; ++i, ++z)
+      dist += *z * *z;
+    o = dist;
   }
+}
+
+void mv_norm::log_prop_dens(const arma::mat &X, arma::vec &out) const {
+#ifdef MSSM_DEBUG
+  if(X.n_rows != dim)
+    throw invalid_argument("'X' and 'dim' does not match");
+#endif
+  mahalanobis_cols(X, mu.get(), chol_, out);
+  for(auto &o : out)
+    o = log_dens_(o);
+}
+
+void mv_tdist::log_prop_dens(const arma::mat &X, arma::vec &out) const {
+#ifdef MSSM_DEBUG
+  if(X.n_rows != dim)
+    throw invalid_argument("'X' and 'dim' does not match");
+#endif
+  mahalanobis_cols(X, mu.get(), chol_, out);
+  for(auto &o : out)
+    o = log_dens_(o);
+}
+
+void mv_norm_reg::pair_vecs
+  (const double *x, const double *y, arma::vec &xv, arma::vec &yv) const
+{
+  xv = arma::vec(x, dim);
+  yv = arma::vec(y, dim);
+  yv -= xv;                    /* R^{-\top}(y - Fx) */
+  chol_.solve_half(yv, true);  /* R^{-1}R^{-\top}(y - Fx) */
+
+  chol_.mult_half(xv);
+  F.solve(xv);                 /* get original x */
+}
+
+void mv_norm_reg::add_moments
+  (const arma::vec &xv, const arma::vec &yv, const double w,
+   double *moments) const
+{
+  const int nm = dim, nm_sq = nm * nm;
+  double * const M_xx = moments + 1L, * const M_yx = M_xx + nm_sq,
+         * const M_yy = M_yx + nm_sq;
+
+  *moments += w;
+  dger(&nm, &nm, &w, xv.memptr(), &I_ONE, xv.memptr(), &I_ONE, M_xx, &nm);
+  dger(&nm, &nm, &w, yv.memptr(), &I_ONE, xv.memptr(), &I_ONE, M_yx, &nm);
+  dger(&nm, &nm, &w, yv.memptr(), &I_ONE, yv.memptr(), &I_ONE, M_yy, &nm);
+}
+
+void mv_norm_reg::add_grad_terms
+  (const arma::vec &xv, const arma::vec &yv, const double w,
+   double *stat) const
+{
+  /* allocate the memory we need */
+  const int nm = dim, nm_sq = nm * nm, nm_lw = (nm * (nm + 1L)) / 2L;
+  M_THREAD_LOCAL std::vector<double> work_mem;
+  /* We need memory for an intermediary [state dim] x [state dim] matrix */
+  if(work_mem.size() < (unsigned int)nm_sq)
+    work_mem.resize(nm_sq);
   double * const pwork_mem = work_mem.data();
 
   /* Need to compute
@@ -172,13 +437,9 @@ void mv_norm_reg::comp_stats_state_state
 
    where D is the duplication matrix
    */
-
-  /* start with Q */
-  arma::vec xv(x, dim), yv(y, dim);
   double w_half = w * .5, w_half_neg = -w_half;
-  yv -= xv;                    /* R^{-\top}(y - Fx) */
-  chol_.solve_half(yv, true);  /* R^{-1}R^{-\top}(y - Fx) */
 
+  /* start with Q */
   {
     /* compute result */
     std::fill(pwork_mem, pwork_mem + nm_sq, 0.);
@@ -193,88 +454,130 @@ void mv_norm_reg::comp_stats_state_state
   }
 
   /* then F */
-  chol_.mult_half(xv);
-  F.solve(xv);         /* get original x */
   double * const D_f_begin = stat;
 
   dger(
       &nm, &nm, &w, yv.memptr(), &I_ONE, xv.memptr(), &I_ONE,
       D_f_begin, &nm);
+}
+
+void mv_norm_reg::comp_stats_state_state
+  (const double *x, const double *y, const double w, double *stat,
+   const comp_out what) const
+{
+  gaurd_new_comp_out(what);
+  if(what == log_densty)
+    return;
+
+  arma::vec xv, yv;
+  pair_vecs(x, y, xv, yv);
+  add_grad_terms(xv, yv, w, stat);
 
   if(what != Hessian)
     return;
 
+  /* the Hessian terms are linear in the moments so we use the moments of
+   * this pair */
+  const int nm = dim, nm_sq = nm * nm, nm_lw = (nm * (nm + 1L)) / 2L,
+    gdim = nm_sq + nm_lw;
+  M_THREAD_LOCAL std::vector<double> moments;
+  if(moments.size() < stats_moments_dim())
+    moments.resize(stats_moments_dim());
+  std::fill(moments.begin(), moments.begin() + stats_moments_dim(), 0.);
+  add_moments(xv, yv, w, moments.data());
+  comp_stats_hess_from_moments(moments.data(), stat + gdim);
+}
+
+void mv_norm_reg::comp_stats_state_state_moments
+  (const double *x, const double *y, const double w, double *stat,
+   const double w_moments, double *moments) const
+{
+  /* the pair is only transformed once */
+  arma::vec xv, yv;
+  pair_vecs(x, y, xv, yv);
+  add_grad_terms(xv, yv, w, stat);
+  add_moments(xv, yv, w_moments, moments);
+}
+
+void mv_norm_reg::comp_stats_hess_from_moments
+  (const double *moments, double *hess_ptr) const
+{
+  /* allocate the memory we need */
+  const int nm = dim, nm_sq = nm * nm, nm_lw = (nm * (nm + 1L)) / 2L;
+  M_THREAD_LOCAL std::vector<double> work_mem;
+  {
+    /* We need memory for
+         an intermediary    [state dim]   x [state dim]   matrix
+         an intermediary    [state dim]^2 x [state dim]^2 matrix
+         same as above but only the lower triangular part * [state dim]^2
+     */
+    const unsigned int needed_dim = nm_sq * (1L + nm_sq + nm_lw);
+    if(work_mem.size() < needed_dim)
+      work_mem.resize(needed_dim);
+  }
+  double * const pwork_mem = work_mem.data();
+
   /* Need to compute.
    \begin{pmatrix}
-   -\vec x_i \vec x_i^\top \otimes Q^{-1} & \cdot \\
-   -D^\top ((Q^{-1}(\vec y_i - F^\top \vec x_i)\vec x_i^\top)\otimes Q^{-1}) &
-   -D^\top (Q^{-1} \otimes \left(Q^{-1}(Z - \frac 12 Q\right)Q^{-1}))D
+   -\sum_i w_i\vec x_i \vec x_i^\top \otimes Q^{-1} & \cdot \\
+   -D^\top ((Q^{-1}\sum_i w_i(\vec y_i - F^\top \vec x_i)\vec x_i^\top)\otimes Q^{-1}) &
+   -D^\top (Q^{-1} \otimes \left(Q^{-1}(\sum_i w_i Z_i - \frac 12 \sum_i w_i Q\right)Q^{-1}))D
    \end{pmatrix}
 
-   where D is the duplication matrix. We first compute the lower triangular and
-   then we copy the output to the upper triangular. We define a few intermediary
-   matrices
+   where D is the duplication matrix. All terms are linear in the moments.
+   We first compute the lower triangular and then we copy the output to the
+   upper triangular. We define a few intermediary matrices
    */
 
   const int gdim = nm_sq + nm_lw;
+  const double w_sum = *moments, * const M_xx = moments + 1L,
+    * const M_yx = M_xx + nm_sq, * const M_yy = M_yx + nm_sq;
   arma::mat kron_arg(pwork_mem        , nm   , nm   , false),
             kron_res(pwork_mem + nm_sq, nm_sq, nm_sq, false);
-  double * const hess_ptr = stat + gdim,
-    /* pointer to extra memory */
-    *xtra_mem = pwork_mem + nm_sq * (nm_sq + 1L);
-
-  /* lambda to add result */
-  auto add_res = [&](const unsigned int inc, const arma::mat &X,
-                     const bool is_upper, const bool is_left){
-    double *res = hess_ptr + inc;
-    const unsigned int inc_col = is_upper ? nm_lw : nm_sq,
-                     n_row_ele = is_upper ? nm_sq : nm_lw,
-                        n_cols = is_left  ? nm_sq : nm_lw;
-    const double * new_term = X.memptr();
-    for(unsigned int i = 0L; i < n_cols; ++i, res += inc_col)
-      for(unsigned int j = 0L; j < n_row_ele; ++j, ++res, ++new_term)
-        *res += w * *new_term;
+  /* pointer to extra memory */
+  double * const xtra_mem = pwork_mem + nm_sq * (nm_sq + 1L);
+
+  /* lambda to set the argument to minus a moment */
+  auto set_kron_arg = [&](const double *m){
+    double *a = kron_arg.memptr();
+    for(int i = 0; i < nm_sq; ++i, ++a, ++m)
+      *a = -*m;
   };
 
   /* compute upper left block */
   {
-    kron_arg.zeros();
-    dger(
-      &nm, &nm, &D_M_ONE, xv.memptr(), &I_ONE, xv.memptr(), &I_ONE,
-      kron_arg.memptr(), &nm);
+    set_kron_arg(M_xx);
     kron_res = arma::kron(kron_arg, chol_.get_inv());
 
-    add_res(0L, kron_res, true, true);
+    double *res = hess_ptr;
+    const double * new_term = kron_res.memptr();
+    for(int i = 0L; i < nm_sq; ++i, res += nm_lw)
+      for(int j = 0L; j < nm_sq; ++j, ++res, ++new_term)
+        *res += *new_term;
   }
 
   /* compute lower left block */
   {
-    kron_arg.zeros();
-    dger(
-        &nm, &nm, &D_M_ONE, yv.memptr(), &I_ONE, xv.memptr(), &I_ONE,
-        kron_arg.memptr(), &nm);
+    set_kron_arg(M_yx);
     kron_res = arma::kron(kron_arg, chol_.get_inv());
 
     /* add result */
     D_mult_left(
-      nm, kron_res.n_cols, w, hess_ptr + nm_sq, gdim, kron_res.memptr());
+      nm, kron_res.n_cols, 1., hess_ptr + nm_sq, gdim, kron_res.memptr());
 
   }
 
   /* compute lower right block */
   {
-    kron_arg.zeros();
-    dger(
-        &nm, &nm, &D_M_ONE, yv.memptr(), &I_ONE, yv.memptr(), &I_ONE,
-        kron_arg.memptr(), &nm);
-    kron_arg += .5 * chol_.get_inv();
+    set_kron_arg(M_yy);
+    kron_arg += (.5 * w_sum) * chol_.get_inv();
     kron_res = arma::kron(chol_.get_inv(), kron_arg);
 
     std::fill(xtra_mem, xtra_mem + nm_lw * nm_sq, 0.);
     D_mult_left(nm, kron_res.n_cols, 1., xtra_mem, nm_lw, kron_res.memptr());
 
     /* add result */
-    D_mult_right(nm, nm_lw, w, hess_ptr + (gdim + 1L) * nm_sq,
+    D_mult_right(nm, nm_lw, 1., hess_ptr + (gdim + 1L) * nm_sq,
                  gdim, xtra_mem);
   }
 
@@ -3,6 +3,7 @@
 #include "arma.h"
 #include "utils.h"
 #include "kd-tree.h"
+#include "philox.h"
 #include <array>
 
 using std::logic_error;
@@ -57,6 +58,44 @@ inline arma::uword get_hess_dim(const arma::uword stat_dim, const comp_out what)
   return 0L;
 }
 
+/* the Hessian part of the statistics of the particles is stored in packed
+ * form with the upper triangular part in column-major order. The function
+ * returns the dimension of the statistics given the dimension of the
+ * gradient */
+inline arma::uword get_stat_dim_packed
+  (const arma::uword grad_dim, const comp_out what)
+{
+  gaurd_new_comp_out(what);
+
+  if(what == gradient)
+    return grad_dim;
+  else if(what == Hessian)
+    return grad_dim + (grad_dim * (grad_dim + 1L)) / 2L;
+
+  return 0L;
+}
+
+/* inverse of the above */
+inline arma::uword get_grad_dim_packed
+  (const arma::uword stat_dim, const comp_out what)
+{
+  gaurd_new_comp_out(what);
+
+  if(what == gradient)
+    return stat_dim;
+  else if(what == Hessian){
+    /* positive solution to d + d(d + 1) / 2 = k */
+    double x = .5 * (std::sqrt((double)stat_dim * 8. + 9.) - 3.);
+#ifdef MSSM_DEBUG
+    if(std::abs(x - round(x)) >= 1e-8)
+      throw std::runtime_error("invalid dimension in 'get_grad_dim_packed'");
+#endif
+    return std::lround(x);
+  }
+
+  return 0L;
+}
+
 /* class to compute conditional densities */
 class cdist {
 public:
@@ -116,8 +155,24 @@ public:
   /* samples states and places them in input with three additional antithetic
    * variables (one location balanced and two scale balanced) */
   virtual void sample_anti(arma::mat&) const = 0;
+  /* same as the above but only samples the columns in [start, end) using a
+   * counter-based random number generator with the passed key. The column
+   * index is used in the counter so the result does not depend on how the
+   * columns are split into blocks. Thus, the blocks can be sampled in
+   * parallel. For the antithetic variables, the blocks must be aligned with
+   * the groups of four columns after the first (number of columns modulo
+   * four) columns */
+  virtual void sample
+    (arma::mat&, const philox::key_type&, const arma::uword,
+     const arma::uword) const = 0;
+  virtual void sample_anti
+    (arma::mat&, const philox::key_type&, const arma::uword,
+     const arma::uword) const = 0;
   /* returns the log density of the proposal distribution */
   virtual double log_prop_dens(const arma::vec&) const = 0;
+  /* computes the log density for each column of the first argument and
+   * places them in the second argument */
+  virtual void log_prop_dens(const arma::mat&, arma::vec&) const = 0;
 };
 
 /* class to be used for kernel methods */
@@ -137,21 +192,107 @@ public:
    * log weight */
   virtual double operator()
     (const double*, const double*, const arma::uword, const double) const = 0;
+  /* same as above with single precision points */
+  virtual double operator()
+    (const float*, const float*, const arma::uword, const double) const = 0;
+  /* computes the log kernel between a point and a number of points which
+   * are stored contiguously. The arguments are the points, the number of
+   * points, the single point, the dimension, the log weights of the points,
+   * and the output */
+  virtual void log_kernel_block
+    (const double*, const arma::uword, const double*, const arma::uword,
+     const double*, double*) const = 0;
+  virtual void log_kernel_block
+    (const float*, const arma::uword, const float*, const arma::uword,
+     const double*, double*) const = 0;
+  /* transforms squared distances to log kernel values in place. The
+   * first argument is the distances and the second is the number of
+   * distances */
+  virtual void log_kernel_dist(double*, const arma::uword) const = 0;
+  /* same as above but with a number of single points which are stored
+   * contiguously. The result for the j'th single point is stored in the j'th
+   * column of the output with the leading dimension given by the last
+   * argument */
+  template<typename T>
+  void log_kernel_tile
+    (const T *X, const arma::uword n_x, const T *Y, const arma::uword n_y,
+     const arma::uword N, const double *x_log_w, double *out,
+     const arma::uword ld_out) const {
+    for(arma::uword j = 0; j < n_y; ++j, Y += N, out += ld_out)
+      log_kernel_block(X, n_x, Y, N, x_log_w, out);
+  }
+  /* compute the smallest and largest log kernel given the smallest and
+   * largest squared distance */
+  virtual std::array<double, 2> log_dens_bounds
+    (const std::array<double, 2>&) const = 0;
   /* compute the smallest and largest log kernel distance between two
    * hyper rectangles */
-  virtual std::array<double, 2> operator()
-    (const hyper_rectangle&, const hyper_rectangle&) const = 0;
+  std::array<double, 2> operator()
+    (const hyper_rectangle &r1, const hyper_rectangle &r2) const {
+    return log_dens_bounds(r1.min_max_dist(r2));
+  }
   /* takes the old, new state, and weight of the pair (ignoring
    * a normalization term) and add the requested stat to the third argument.
    * This only includes the part that depends on the pair. */
   virtual void comp_stats_state_state
     (const double*, const double*, const double, double*, const comp_out)
     const = 0;
+  /* the Hessian terms of comp_stats_state_state may be linear in a number
+   * of weighted moments of the pairs. If so, the following returns the
+   * number of elements of the moments and zero otherwise */
+  virtual arma::uword stats_moments_dim() const {
+    return 0L;
+  }
+  /* same as comp_stats_state_state with the gradient but the moments of the
+   * pair with the weight in the fifth argument are also added to the last
+   * argument */
+  virtual void comp_stats_state_state_moments
+    (const double*, const double*, const double, double*, const double,
+     double*) const {
+    throw logic_error("comp_stats_state_state_moments: not implemented");
+  }
+  /* adds the Hessian terms given the moments to the second argument. The
+   * latter has the same layout as the Hessian from comp_stats_state_state */
+  virtual void comp_stats_hess_from_moments(const double*, double*) const {
+    throw logic_error("comp_stats_hess_from_moments: not implemented");
+  }
 
   /* returns the normalization constant */
   virtual double get_log_norm_const() const = 0;
+
+  /* returns true if the log kernel is the log normalization constant minus
+   * half the squared distance between the transformed points */
+  virtual bool is_gaussian_kernel() const {
+    return false;
+  }
 };
 
+/* defines the log_kernel_block and log_kernel_dist member functions using
+ * a log_dens_ member function of the squared distance. The latter is not
+ * virtual so the calls can be inlined */
+#define TRANS_OBJ_BLOCK_FUNCS                                             \
+  void log_kernel_dist(double *d, const arma::uword n)                    \
+    const override final {                                                \
+    for(arma::uword i = 0; i < n; ++i, ++d)                               \
+      *d = log_dens_(*d);                                                 \
+  }                                                                       \
+  void log_kernel_block                                                   \
+    (const double *X, const arma::uword n_x, const double *y,             \
+     const arma::uword N, const double *x_log_w, double *out)             \
+    const override final {                                                \
+    norm_square_block(X, n_x, y, N, out);                                 \
+    for(arma::uword i = 0; i < n_x; ++i)                                  \
+      out[i] = log_dens_(out[i]) + x_log_w[i];                            \
+  }                                                                       \
+  void log_kernel_block                                                   \
+    (const float *X, const arma::uword n_x, const float *y,               \
+     const arma::uword N, const double *x_log_w, double *out)             \
+    const override final {                                                \
+    norm_square_block(X, n_x, y, N, out);                                 \
+    for(arma::uword i = 0; i < n_x; ++i)                                  \
+      out[i] = log_dens_(out[i]) + x_log_w[i];                            \
+  }
+
 inline void check_input_mv_log_density_state
   (const arma::uword dim, const arma::vec *mu, const arma::vec &x,
    const arma::vec *gr, const arma::mat *H, const comp_out what)
@@ -197,10 +338,18 @@ public:
     const double dist = norm_square(x, y, N);
     return log_dens_(dist) + x_log_w;
   }
+  double operator()(
+      const float *x, const float *y, const arma::uword N,
+      const double x_log_w) const override
+  {
+    const double dist = norm_square(x, y, N);
+    return log_dens_(dist) + x_log_w;
+  }
 
-  std::array<double, 2> operator()
-    (const hyper_rectangle &r1, const hyper_rectangle &r2) const override {
-    auto dists = r1.min_max_dist(r2);
+  TRANS_OBJ_BLOCK_FUNCS
+
+  std::array<double, 2> log_dens_bounds
+    (const std::array<double, 2> &dists) const override {
     return { log_dens_(dists[1L]), log_dens_(dists[0L]) };
   }
 
@@ -226,6 +375,9 @@ public:
   double get_log_norm_const() const override final {
     return norm_const_log;
   }
+  bool is_gaussian_kernel() const override final {
+    return true;
+  }
 
   /* cdist overrides */
   arma::uword state_dim() const override {
@@ -283,10 +435,18 @@ public:
     const double dist = norm_square(x, y, N);
     return log_dens_(dist) + x_log_w;
   }
+  double operator()(
+      const float *x, const float *y, const arma::uword N,
+      const double x_log_w) const override
+  {
+    const double dist = norm_square(x, y, N);
+    return log_dens_(dist) + x_log_w;
+  }
 
-  std::array<double, 2> operator()
-  (const hyper_rectangle &r1, const hyper_rectangle &r2) const override {
-    auto dists = r1.min_max_dist(r2);
+  TRANS_OBJ_BLOCK_FUNCS
+
+  std::array<double, 2> log_dens_bounds
+  (const std::array<double, 2> &dists) const override {
     return { log_dens_(dists[1L]), log_dens_(dists[0L]) };
   }
 
@@ -313,6 +473,9 @@ public:
   double get_log_norm_const() const override final {
     return norm_const_log;
   }
+  bool is_gaussian_kernel() const override final {
+    return true;
+  }
 
   /* proposal_dist overrides */
   void sample(arma::mat&) const override;
@@ -321,10 +484,22 @@ public:
     throw std::runtime_error("mv_norm::sample_anti() not implemented");
   }
 
+  void sample
+    (arma::mat&, const philox::key_type&, const arma::uword,
+     const arma::uword) const override;
+
+  void sample_anti
+    (arma::mat&, const philox::key_type&, const arma::uword,
+     const arma::uword) const override {
+    throw std::runtime_error("mv_norm::sample_anti() not implemented");
+  }
+
   double log_prop_dens(const arma::vec &x) const override {
     return log_density_state(x, nullptr, nullptr, log_densty);
   }
 
+  void log_prop_dens(const arma::mat&, arma::vec&) const override;
+
   /* cdist overrides */
   arma::uword state_dim() const override {
     return dim;
@@ -395,6 +570,19 @@ class mv_norm_reg final : public cdist, public trans_obj {
     return out;
   }
 
+  /* sets the residual scaled by the inverse covariance matrix and the
+   * original old state given the transformed states */
+  void pair_vecs
+    (const double*, const double*, arma::vec&, arma::vec&) const;
+  /* adds the weighted moments given the output from pair_vecs. The layout is
+   * the sum of weights followed by the sum of the outer products of the old
+   * state, of the residual and the old state, and of the residual */
+  void add_moments
+    (const arma::vec&, const arma::vec&, const double, double*) const;
+  /* adds the weighted gradient terms given the output from pair_vecs */
+  void add_grad_terms
+    (const arma::vec&, const arma::vec&, const double, double*) const;
+
 public:
   mv_norm_reg(const arma::mat &F, const arma::mat &Q):
   F(F), chol_(Q), dim(Q.n_cols), mu(nullptr) { }
@@ -408,10 +596,17 @@ public:
     const double dist = norm_square(x, y, N);
     return log_dens_(dist) + x_log_w;
   }
+  double operator()(
+      const float *x, const float *y, const arma::uword N,
+      const double x_log_w) const override {
+    const double dist = norm_square(x, y, N);
+    return log_dens_(dist) + x_log_w;
+  }
 
-  std::array<double, 2> operator()
-  (const hyper_rectangle &r1, const hyper_rectangle &r2) const override {
-    auto dists = r1.min_max_dist(r2);
+  TRANS_OBJ_BLOCK_FUNCS
+
+  std::array<double, 2> log_dens_bounds
+  (const std::array<double, 2> &dists) const override {
     return { log_dens_(dists[1L]), log_dens_(dists[0L]) };
   }
 
@@ -434,9 +629,21 @@ public:
   (const double *x, const double *y, const double log_w, double *stat,
    const comp_out what) const override final;
 
+  arma::uword stats_moments_dim() const override final {
+    return 1L + 3L * dim * dim;
+  }
+  void comp_stats_state_state_moments
+  (const double*, const double*, const double, double*, const double,
+   double*) const override final;
+  void comp_stats_hess_from_moments
+  (const double*, double*) const override final;
+
   double get_log_norm_const() const override final {
     return norm_const_log;
   }
+  bool is_gaussian_kernel() const override final {
+    return true;
+  }
 
   /* cdist overrides */
   arma::uword state_dim() const override {
@@ -503,6 +710,12 @@ class mv_tdist : public cdist, public trans_obj, public proposal_dist {
     return std::lgamma((dim + nu) * .5) - lgamma(nu * .5) -
       std::log(nu * M_PI) * dim * .5 - .5 * chol_.log_det();
   })();
+  /* log of the beta function B(dim / 2, nu / 2) which is used for the
+   * antithetic variables */
+  const double log_beta_anti = ([&]{
+    return std::lgamma(dim * .5) + std::lgamma(nu * .5) -
+      std::lgamma((dim + nu) * .5);
+  })();
 
   static double check_nu(const double nu){
 #ifdef MSSM_DEBUG
@@ -531,10 +744,17 @@ public:
     const double dist = norm_square(x1.begin(), y1.begin(), N);
     return log_dens_(dist) + x_log_w;
   }
+  double operator()
+  (const float *x, const float *y, const arma::uword N,
+   const double x_log_w) const override {
+    const double dist = norm_square(x, y, N);
+    return log_dens_(dist) + x_log_w;
+  }
 
-  std::array<double, 2> operator()
-  (const hyper_rectangle &r1, const hyper_rectangle &r2) const override {
-    auto dists = r1.min_max_dist(r2);
+  TRANS_OBJ_BLOCK_FUNCS
+
+  std::array<double, 2> log_dens_bounds
+  (const std::array<double, 2> &dists) const override {
     return { log_dens_(dists[1L]), log_dens_(dists[0L]) };
   }
 
@@ -568,10 +788,20 @@ public:
 
   void sample_anti(arma::mat&) const override;
 
+  void sample
+    (arma::mat&, const philox::key_type&, const arma::uword,
+     const arma::uword) const override;
+
+  void sample_anti
+    (arma::mat&, const philox::key_type&, const arma::uword,
+     const arma::uword) const override;
+
   double log_prop_dens(const arma::vec &x) const override {
     return log_density_state(x, nullptr, nullptr, log_densty);
   }
 
+  void log_prop_dens(const arma::mat&, arma::vec&) const override;
+
   /* cdist overrides */
   arma::uword state_dim() const override {
     return dim;
@@ -625,8 +855,20 @@ constexpr bool exp_family_do_check () { return false; }
 #endif
 
 
+/* returns non-owning views of the passed objects */
+inline arma::vec get_view(const arma::vec &x){
+  return arma::vec(const_cast<double*>(x.memptr()), x.n_elem, false, true);
+}
+inline arma::mat get_view(const arma::mat &x){
+  return arma::mat(
+    const_cast<double*>(x.memptr()), x.n_rows, x.n_cols, false, true);
+}
+
 /* Likely overkill with macro and multiple inheritance would be simpler */
 #define EXP_BASE_PROTECTED(fname)                                         \
+  /* the outcome, the design matrices, the case weights and the offsets  \
+   * are non-owning views. Thus, the passed objects must outlive this     \
+   * object */                                                            \
   /* outcome */                                                           \
   const arma::vec Y;                                                      \
   /* design matrix for fixed effects */                                   \
@@ -636,7 +878,9 @@ constexpr bool exp_family_do_check () { return false; }
   mutable arma::vec cfix_cache = cfix;                                    \
   /* design matrix for random effects */                                  \
   const arma::mat Z;                                                      \
-  /* case weights */                                                      \
+  /* case weights. The first object holds the default weights if no      \
+   * weights are passed */                                                \
+  const arma::vec ws_default;                                             \
   const arma::vec ws;                                                     \
                                                                           \
   /* offset from fixed effects and offsets */                             \
@@ -734,9 +978,9 @@ public:
   exp_family_wo_disp
   (const arma::vec &Y, const arma::mat &X, const arma::vec &cfix,
    const arma::mat &Z, const arma::vec *ws, const arma::vec &offset):
-  Y(Y), X(X), cfix(cfix), Z(Z),
-  ws(ws ? arma::vec(*ws) : arma::vec(X.n_cols, arma::fill::ones)),
-  offs(offset)
+  Y(get_view(Y)), X(get_view(X)), cfix(cfix), Z(get_view(Z)),
+  ws_default(ws ? arma::vec() : arma::vec(X.n_cols, arma::fill::ones)),
+  ws(get_view(ws ? *ws : ws_default)), offs(get_view(offset))
   {
     if(exp_family_do_check()){
       if(X.n_cols != Y.n_elem)
@@ -745,7 +989,7 @@ public:
         throw invalid_argument("invalid 'cfix'");
       if(X.n_cols != Z.n_cols)
         throw invalid_argument("invalid 'Z'");
-      if(X.n_cols != ws->n_elem)
+      if(X.n_cols != this->ws.n_elem)
         throw invalid_argument("invalid 'ws'");
     }
   }
@@ -849,9 +1093,9 @@ public:
   (const arma::vec &Y, const arma::mat &X, const arma::vec &cfix,
    const arma::mat &Z, const arma::vec *ws, const arma::vec &di,
    const arma::vec &offset):
-  Y(Y), X(X), cfix(cfix), Z(Z),
-  ws(ws ? arma::vec(*ws) : arma::vec(X.n_cols, arma::fill::ones)),
-  offs(offset), disp_in(di)
+  Y(get_view(Y)), X(get_view(X)), cfix(cfix), Z(get_view(Z)),
+  ws_default(ws ? arma::vec() : arma::vec(X.n_cols, arma::fill::ones)),
+  ws(get_view(ws ? *ws : ws_default)), offs(get_view(offset)), disp_in(di)
   {
     if(exp_family_do_check()){
       if(X.n_cols != Y.n_elem)
@@ -860,7 +1104,7 @@ public:
         throw invalid_argument("invalid 'cfix'");
       if(X.n_cols != Z.n_cols)
         throw invalid_argument("invalid 'Z'");
-      if(X.n_cols != ws->n_elem)
+      if(X.n_cols != this->ws.n_elem)
         throw invalid_argument("invalid 'ws'");
     }
   }
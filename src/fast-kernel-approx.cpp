@@ -4,42 +4,60 @@
 #include <utility>
 #include "utils.h"
 #include <functional>
+#include <algorithm>
+#include <deque>
 #include "misc.h"
 
 #ifdef MSSM_PROF
 #include "profile.h"
 #endif
 
-static constexpr unsigned int max_futures       = 30000L;
-static constexpr unsigned int max_futures_clear = max_futures / 3L;
+/* maximum number of tasks which are not done in the traversal */
+static constexpr std::size_t max_tasks       = 30000L;
+static constexpr std::size_t max_tasks_clear = max_tasks - max_tasks / 3L;
 
 template<bool has_extra>
 using get_X_root_output =
-  std::tuple<std::unique_ptr<KD_note>, std::unique_ptr<source_node<has_extra > >,
-             arma::uvec>;
+  std::tuple<std::unique_ptr<KD_tree>,
+             std::unique_ptr<source_nodes<has_extra > >, arma::uvec>;
+
+/* returns the indices of the points in the order of the tree and sets the
+ * permutation vector to undo the permutation */
+static arma::uvec get_tree_perm(const KD_tree &tree, arma::uvec &old_idx){
+  arma::uvec new_idx(tree.get_indices());
+  old_idx.set_size(new_idx.n_elem);
+  arma::uword i = 0L;
+  for(auto n : new_idx)
+    old_idx[n] = i++;
+
+  return new_idx;
+}
+
+/* returns a new k-d tree or a tree with the given topology if it is not a
+ * null pointer */
+static KD_tree *get_tree
+  (const arma::mat &X, const arma::uword N_min, thread_pool &pool,
+   const KD_tree_topology *topo, const bool use_balls){
+  if(topo)
+    return new KD_tree(*topo, X, use_balls);
+  return new KD_tree(get_KD_tree(X, N_min, pool, use_balls));
+}
 
 /* the function computes the k-d tree and permutate the input matrix
  * and weights. It returns a permutation vector to undo the permutation */
 template<bool has_extra>
 get_X_root_output<has_extra> get_X_root
   (arma::mat &X, arma::vec &ws, const arma::uword N_min, arma::mat *xtra,
-   thread_pool &pool)
+   thread_pool &pool, const hermite_terms *herm,
+   const KD_tree_topology *topo, const bool use_balls)
 {
   get_X_root_output<has_extra> out;
-  auto &node = std::get<0>(out);
-  auto &snode = std::get<1>(out);
+  auto &tree = std::get<0>(out);
+  auto &snodes = std::get<1>(out);
   auto &old_idx = std::get<2>(out);
 
-  node.reset(new KD_note(get_KD_tree(X, N_min, pool)));
-
-  /* make permutation to get original order */
-  arma::uvec new_idx = node->get_indices_parent();
-  old_idx.resize(X.n_cols);
-  std::iota(old_idx.begin(), old_idx.end(), 0L);
-  node->set_indices(old_idx);
-  arma::uword i = 0L;
-  for(auto n : new_idx)
-    old_idx[n] = i++;
+  tree.reset(get_tree(X, N_min, pool, topo, use_balls));
+  const arma::uvec new_idx = get_tree_perm(*tree, old_idx);
 
   /* permutate */
   X = X.cols(new_idx);
@@ -47,13 +65,13 @@ get_X_root_output<has_extra> get_X_root
   if(has_extra)
     *xtra = xtra->cols(new_idx);
 
-  snode.reset(new source_node<has_extra>(X, ws, *node, xtra));
+  snodes.reset(new source_nodes<has_extra>(*tree, X, ws, xtra, herm));
 
   return out;
 }
 
 using get_Y_root_output =
-  std::tuple<std::unique_ptr<KD_note>, std::unique_ptr<query_node>,
+  std::tuple<std::unique_ptr<KD_tree>, std::unique_ptr<query_nodes>,
              arma::uvec>;
 
 /* the function computes the k-d tree and permutate the input matrix.
@@ -61,30 +79,22 @@ using get_Y_root_output =
 template<bool has_extra>
 get_Y_root_output get_Y_root
   (arma::mat &Y, const arma::uword N_min, arma::mat *xtra,
-   thread_pool &pool)
+   thread_pool &pool, const KD_tree_topology *topo, const bool use_balls)
 {
   get_Y_root_output out;
-  auto &node  = std::get<0L>(out);
-  auto &snode = std::get<1L>(out);
+  auto &tree  = std::get<0L>(out);
+  auto &qnodes = std::get<1L>(out);
   auto &old_idx = std::get<2>(out);
 
-  node.reset(new KD_note(get_KD_tree(Y, N_min, pool)));
-
-  /* make permutation to get original order */
-  arma::uvec new_idx = node->get_indices_parent();
-  old_idx.resize(Y.n_cols);
-  std::iota(old_idx.begin(), old_idx.end(), 0L);
-  node->set_indices(old_idx);
-  arma::uword i = 0L;
-  for(auto n : new_idx)
-    old_idx[n] = i++;
+  tree.reset(get_tree(Y, N_min, pool, topo, use_balls));
+  const arma::uvec new_idx = get_tree_perm(*tree, old_idx);
 
   /* permutate */
   Y = Y.cols(new_idx);
   if(has_extra)
     *xtra = xtra->cols(new_idx);
 
-  snode.reset(new query_node(Y, *node));
+  qnodes.reset(new query_nodes(*tree));
 
   return out;
 }
@@ -101,26 +111,80 @@ void set_func
   (*extra_func)(source, query, source_extra, query_extra, log_weight);
 }
 
+/* output of the pairs of nodes which are computed in one task when the
+ * deterministic reduction is used. It covers the query points start to
+ * end - 1. The bounds on the errors are stored with the index of the query
+ * node. Only the bounds are used if the deterministic reduction is not
+ * used */
+struct reduction_slot {
+  arma::uword start, end;
+  arma::vec log_weights;
+  arma::mat extra;
+  std::vector<std::pair<arma::uword, double> > log_err;
+
+  /* allocates the output the first time it is called */
+  reduction_slot& init(const arma::uword n_extra){
+    if(log_weights.n_elem < 1L){
+      log_weights.set_size(end - start);
+      log_weights.fill(-std::numeric_limits<double>::infinity());
+      if(n_extra > 0L)
+        extra.zeros(n_extra, end - start);
+    }
+    return *this;
+  }
+};
+
 template<bool has_extra>
 struct comp_w_centroid {
   arma::vec &log_weights;
-  const source_node<has_extra> &X_node;
-  const query_node &Y_node;
+  const source_nodes<has_extra> &X_nodes;
+  const arma::uword X_idx;
+  query_nodes &Y_nodes;
+  const arma::uword Y_idx;
   const arma::mat &Y;
+  /* single precision copy of Y. Not used if it is a null pointer */
+  const arma::fmat *Y_f;
   const trans_obj &kernel;
   const bool is_single_threaded;
   arma::mat *Y_extra;
   FSKA_cpp_xtra_func &extra_func;
+  /* object to evaluate the Hermite expansion of the source node. The kernel
+   * is evaluated at the centroid if it is a null pointer */
+  const hermite_terms *herm;
+  /* slot to write the output to. The output is added to the log weights
+   * with locks if it is a null pointer */
+  reduction_slot *slot;
 
  void operator()(){
-    const arma::uword start = Y_node.node.get_start(),
-      end   = Y_node.node.get_end();
+    const KD_tree &Y_tree = Y_nodes.tree;
+    const KD_tree::node &Y_node = Y_tree.get_node(Y_idx);
+    const arma::uword start = Y_node.start, end = Y_node.end;
+
+    /* the output is added directly if there is one thread or if there is a
+     * slot as only this task writes to the slot */
+    const bool add_directly = is_single_threaded or slot;
+    arma::vec &lw_out = slot ?
+      slot->init(has_extra ? Y_extra->n_rows : 0L).log_weights : log_weights;
+    arma::mat *extra_out = slot ? &slot->extra : Y_extra;
+    const arma::uword off = slot ? slot->start : 0L;
+
+    double x_weight_log = std::log(X_nodes.weights[X_idx]);
+    const double *xp = X_nodes.centroids.colptr(X_idx),
+      *xp_extra = has_extra ?  X_nodes.extra.colptr(X_idx) : nullptr;
+    const arma::uword N = X_nodes.centroids.n_rows;
+
+    M_THREAD_LOCAL std::vector<float> centroid_f;
+    const float *xp_f = nullptr;
+    if(Y_f){
+      centroid_f.resize(N);
+      std::copy(xp, xp + N, centroid_f.begin());
+      xp_f = centroid_f.data();
+    }
 
-    const arma::vec &X_centroid = X_node.centroid;
-    double x_weight_log = std::log(X_node.weight);
-    const double *xp = X_centroid.begin(),
-      *xp_extra = has_extra ?  X_node.extra->memptr() : nullptr;
-    const arma::uword N = X_centroid.n_elem;
+    const double log_norm_const = herm ? kernel.get_log_norm_const() : 0.;
+    M_THREAD_LOCAL std::vector<double> y_diff;
+    if(herm)
+      y_diff.resize(N);
 
     arma::vec out;
     arma::mat xtra;
@@ -128,7 +192,7 @@ struct comp_w_centroid {
     M_THREAD_LOCAL std::vector<double> mem;
 
     /* setup needed objects */
-    if(!is_single_threaded){
+    if(!add_directly){
       const unsigned int n_p = end - start,
         required_mem = has_extra ? n_p * (1L + Y_extra->n_rows) : n_p;
       if(mem.size() < required_mem)
@@ -145,8 +209,21 @@ struct comp_w_centroid {
 
     for(arma::uword i = start; i < end; ++i){
       const double *yp = Y.colptr(i);
-      double new_term = kernel(xp, yp, N, x_weight_log) ;
-      if(!is_single_threaded){
+      double new_term;
+      if(herm){
+        double dist = 0.;
+        for(arma::uword k = 0; k < N; ++k){
+          y_diff[k] = yp[k] - xp[k];
+          dist += y_diff[k] * y_diff[k];
+        }
+        new_term = log_norm_const - dist / 2. +
+          std::log(herm->eval(X_nodes.hermite.colptr(X_idx), y_diff.data()));
+
+      } else
+        new_term = Y_f ?
+          kernel(xp_f, Y_f->colptr(i), N, x_weight_log) :
+          kernel(xp  , yp            , N, x_weight_log);
+      if(!add_directly){
         *(o++) = new_term;
 
         if(has_extra)
@@ -156,41 +233,41 @@ struct comp_w_centroid {
         continue;
       }
 
-      double *Y_extra_ptr = has_extra ? Y_extra->colptr(i) : nullptr;
+      double *Y_extra_ptr = has_extra ? extra_out->colptr(i - off) : nullptr;
 
       set_func<has_extra>(
-        log_weights[i], new_term, xp, yp, xp_extra,
+        lw_out[i - off], new_term, xp, yp, xp_extra,
         Y_extra_ptr, &extra_func);
 
     }
 
-    if(is_single_threaded)
+    if(add_directly)
       return;
 
     /* travers down the tree from left to right. We use that data is sorted and
     * we only lock one lock at a time */
     o = out.begin();
-    M_THREAD_LOCAL std::vector<const query_node*> tasks;
-    const std::size_t required_size = Y_node.node.get_depth() + 1L;
+    M_THREAD_LOCAL std::vector<arma::uword> tasks;
+    const std::size_t required_size = Y_tree.get_depth() + 1L;
     if(tasks.size() < required_size)
       tasks.resize(required_size);
 
     int yi = 0L;
-    tasks.front() = &Y_node;
-    const query_node** yip = tasks.data();
+    tasks.front() = Y_idx;
+    arma::uword* yip = tasks.data();
     while(yi > -1){
-      const query_node* this_node = *yip;
+      const KD_tree::node &this_node = Y_tree.get_node(*yip);
 
-      if(this_node->is_leaf){
+      if(this_node.is_leaf()){
         const arma::uword
-        this_start = this_node->node.get_start(),
-          this_end   = this_node->node.get_end();
+        this_start = this_node.start,
+          this_end   = this_node.end;
 
           {
-            std::lock_guard<std::mutex> gr(*this_node->idx_mutex);
-            double * w_out = log_weights.begin() + this_start;
-            for(arma::uword i = this_start; i < this_end; ++i, ++o, ++w_out)
-              *w_out = log_sum_log(*w_out, *o);
+            std::lock_guard<std::mutex> gr(Y_nodes.mutexes[*yip]);
+            lse::log_sum_log_block(
+              log_weights.begin() + this_start, o, this_end - this_start);
+            o += this_end - this_start;
 
             if(has_extra)
               Y_extra->cols(this_start, this_end - 1L) +=
@@ -203,8 +280,8 @@ struct comp_w_centroid {
 
       }
 
-      *   yip  = this_node->right.get();
-      *(++yip) = this_node->left.get();
+      *   yip  = this_node.right();
+      *(++yip) = this_node.left;
       ++yi;
     }
   }
@@ -213,27 +290,43 @@ struct comp_w_centroid {
 template<bool has_extra>
 struct  comp_all {
   arma::vec &log_weights;
-  const source_node<has_extra> &X_node;
-  const query_node &Y_node;
+  const source_nodes<has_extra> &X_nodes;
+  const arma::uword X_idx;
+  query_nodes &Y_nodes;
+  const arma::uword Y_idx;
   const arma::mat &X;
   const arma::vec &ws_log;
   const arma::mat &Y;
+  /* single precision copies of X and Y. Not used if they are null
+   * pointers */
+  const arma::fmat *X_f, *Y_f;
   const trans_obj &kernel;
   const bool is_single_threaded;
   arma::mat *X_extra;
   arma::mat *Y_extra;
   FSKA_cpp_xtra_func &extra_func;
+  /* slot to write the output to. The output is added to the log weights
+   * with locks if it is a null pointer */
+  reduction_slot *slot;
 
   void operator()(){
+    const KD_tree::node &X_node = X_nodes.tree.get_node(X_idx),
+                        &Y_node = Y_nodes.tree.get_node(Y_idx);
 #ifdef MSSM_DEBUG
-    if(!X_node.is_leaf or !Y_node.is_leaf)
+    if(!X_node.is_leaf() or !Y_node.is_leaf())
       throw std::domain_error(
           "comp_all called with non-leafs");
 #endif
 
     const arma::uword
-      start_X = X_node.node.get_start(), end_X = X_node.node.get_end(),
-        start_Y = Y_node.node.get_start(), end_Y = Y_node.node.get_end();
+      start_X = X_node.start, end_X = X_node.end,
+        start_Y = Y_node.start, end_Y = Y_node.end;
+
+    const bool add_directly = is_single_threaded or slot;
+    arma::vec &lw_out = slot ?
+      slot->init(has_extra ? Y_extra->n_rows : 0L).log_weights : log_weights;
+    arma::mat *extra_out = slot ? &slot->extra : Y_extra;
+    const arma::uword off = slot ? slot->start : 0L;
 
     arma::vec out, stats_inner, x_y_ws;
     arma::mat xtra;
@@ -241,7 +334,7 @@ struct  comp_all {
     M_THREAD_LOCAL std::vector<double> mem;
 
     /* setup required memory */
-    if(!is_single_threaded){
+    if(!add_directly){
       const unsigned int n_p = end_Y - start_Y, n_p_x = end_X - start_X,
         required_mem = has_extra ?
       n_p * (1L + Y_extra->n_rows) + n_p_x + Y_extra->n_rows : n_p + n_p_x;
@@ -283,27 +376,29 @@ struct  comp_all {
 
     for(arma::uword i_y = start_Y; i_y < end_Y; ++i_y){
       const arma::uword N = Y.n_rows;
-      double max_log_w = std::numeric_limits<double>::lowest();
-      double *x_y_ws_i = x_y_ws.begin();
-      if(has_extra)
-        stats_inner.zeros();
       const double * yp = Y.colptr(i_y);
-      for(arma::uword i_x = start_X; i_x < end_X; ++i_x){
-        const double * xp = X.colptr(i_x),
-          *xp_extra = has_extra ? X_extra->colptr(i_x) : nullptr;
-        *x_y_ws_i = kernel(xp, yp, N, ws_log[i_x]);
-        if(*x_y_ws_i > max_log_w)
-          max_log_w = *x_y_ws_i;
-
-        if(has_extra)
-          /* compute stats */
-          extra_func(xp, yp, xp_extra, stats_inner.memptr(), *x_y_ws_i);
+      if(X_f)
+        kernel.log_kernel_block(
+          X_f->colptr(start_X), end_X - start_X, Y_f->colptr(i_y), N,
+          ws_log.memptr() + start_X, x_y_ws.memptr());
+      else
+        kernel.log_kernel_block(
+          X.colptr(start_X), end_X - start_X, yp, N,
+          ws_log.memptr() + start_X, x_y_ws.memptr());
 
-        x_y_ws_i++;
+      if(has_extra){
+        /* compute stats */
+        stats_inner.zeros();
+        const double *x_y_ws_i = x_y_ws.begin();
+        for(arma::uword i_x = start_X; i_x < end_X; ++i_x, ++x_y_ws_i)
+          extra_func(X.colptr(i_x), yp, X_extra->colptr(i_x),
+                     stats_inner.memptr(), *x_y_ws_i);
       }
 
-      double new_term = log_sum_log(x_y_ws, max_log_w);
-      if(!is_single_threaded){
+      lse::accumulator acc;
+      acc.add(x_y_ws.memptr(), x_y_ws.n_elem);
+      const double new_term = acc.get();
+      if(!add_directly){
         /* save log weight */
         *(o++) = new_term;
         /* add stats terms */
@@ -315,21 +410,19 @@ struct  comp_all {
       }
 
       /* update weights */
-      log_weights[i_y] = log_sum_log(log_weights[i_y], new_term);
+      lw_out[i_y - off] = log_sum_log(lw_out[i_y - off], new_term);
 
       /* add stats */
       if(has_extra)
-        Y_extra->col(i_y) += stats_inner;
+        extra_out->col(i_y - off) += stats_inner;
     }
 
-    if(is_single_threaded)
+    if(add_directly)
       return;
 
-    o = out.begin();
-    double * w_out = log_weights.begin() + start_Y;
-    std::lock_guard<std::mutex> guard(*Y_node.idx_mutex);
-    for(arma::uword i_y = start_Y; i_y < end_Y; ++i_y, ++o, ++w_out)
-      *w_out = log_sum_log(*w_out, *o);
+    std::lock_guard<std::mutex> guard(Y_nodes.mutexes[Y_idx]);
+    lse::log_sum_log_block(
+      log_weights.begin() + start_Y, out.begin(), end_Y - start_Y);
 
     if(has_extra)
       Y_extra->cols(start_Y, end_Y - 1L) += xtra;
@@ -342,111 +435,225 @@ struct comp_weights {
   const arma::mat &X;
   const arma::vec &ws_log;
   const arma::mat &Y;
+  const arma::fmat *X_f, *Y_f;
   const double eps;
   const trans_obj &kernel;
   thread_pool &pool;
-  std::list<std::future<void> > &futures;
+  task_group &tasks;
   arma::mat *X_extra;
   arma::mat *Y_extra;
   FSKA_cpp_xtra_func &extra_func;
-
-  template<bool is_main_thread>
-  void do_work
-  (const source_node<has_extra> &X_node, const query_node &Y_node) const
+  const hermite_terms *herm;
+  /* whether to compute bounds on the absolute errors */
+  const bool comp_err;
+  const source_nodes<has_extra> &X_nodes;
+  query_nodes &Y_nodes;
+  /* slots for the output of the tasks in the order they are spawned. It is
+   * a null pointer if neither the deterministic reduction is used nor the
+   * bounds are computed. The first slot holds the bounds from the traversal
+   * if the deterministic reduction is not used */
+  std::deque<reduction_slot> *slots;
+  const bool deterministic;
+
+  /* returns a new slot for a task with the given query node or a null
+   * pointer if there are no slots */
+  reduction_slot* new_slot(const arma::uword Y_idx) const
   {
-    /* check if we need to clear futures. TODO: avoid the use of list here? */
-    if(is_main_thread and futures.size() > max_futures){
-      std::size_t n_earsed = 0L;
-      std::future_status status;
-      constexpr std::chrono::milliseconds t_weight(1);
-      std::list<std::future<void> >::iterator it;
-      while(n_earsed < max_futures_clear){
-        for(it = futures.begin(); it != futures.end(); ){
-          status = it->wait_for(t_weight);
-          if(status == std::future_status::ready){
-            it->get();
-            it = futures.erase(it);
-            n_earsed++;
-            if(n_earsed >= max_futures_clear)
-              break;
-
-          } else {
-            ++it;
-            std::this_thread::yield();
+    if(!slots)
+      return nullptr;
+
+    const KD_tree::node &Y_node = Y_nodes.tree.get_node(Y_idx);
+    slots->emplace_back();
+    reduction_slot &out = slots->back();
+    out.start = Y_node.start;
+    out.end   = Y_node.end;
+    return &out;
+  }
 
-          }
-        }
-      }
-    }
+  /* the output is written to the slot if it is not a null pointer. New
+   * slots are made for the spawned tasks */
+  template<bool spawn_tasks>
+  void do_work(const arma::uword X_idx, const arma::uword Y_idx,
+               reduction_slot *slot) const
+  {
+    /* help with the queued tasks if there are too many */
+    if(spawn_tasks and tasks.n_not_done() > max_tasks)
+      tasks.throttle(max_tasks_clear);
 
     /* check if we should finish the rest in another thread */
+    const KD_tree &X_tree = X_nodes.tree, &Y_tree = Y_nodes.tree;
+    const KD_tree::node &X_node = X_tree.get_node(X_idx),
+                        &Y_node = Y_tree.get_node(Y_idx);
     static constexpr arma::uword stop_n_elem = 50L;
-    if(is_main_thread and
-         X_node.node.n_elem < stop_n_elem and
-         Y_node.node.n_elem < stop_n_elem){
-      futures.push_back(
-        pool.submit(std::bind(
-            &comp_weights<has_extra>::do_work<false>, std::ref(*this),
-            std::cref(X_node), std::cref(Y_node))));
+    if(spawn_tasks and
+         X_node.n_elem() < stop_n_elem and
+         Y_node.n_elem() < stop_n_elem){
+      tasks.run(std::bind(
+          &comp_weights<has_extra>::do_work<false>, std::ref(*this),
+          X_idx, Y_idx, new_slot(Y_idx)));
       return;
     }
 
-    auto log_dens = kernel(Y_node.borders, X_node.borders);
-    double k_min = std::exp(log_dens[0L]), k_max = std::exp(log_dens[1L]);
-    if(X_node.weight *
-       (k_max - k_min) / ((k_max + k_min) / 2. + 1e-16) < 2. * eps){
+    auto log_dens = kernel.log_dens_bounds(
+      Y_tree.min_max_dist(Y_idx, X_tree, X_idx));
+    const double X_weight = X_nodes.weights[X_idx];
+    double k_min = std::exp(log_dens[0L]), k_max = std::exp(log_dens[1L]),
+      k_mid = (k_max + k_min) / 2. + 1e-16;
+    const bool use_centroid =
+      X_weight * (k_max - k_min) / k_mid < 2. * eps;
+    bool use_hermite = false;
+    double err_hermite = 0.;
+    if(!use_centroid and herm){
+      /* the truncation error of the Hermite expansion for each source
+       * particle is bounded by the error factor times the normalization
+       * constant times exp(-D^2 / 4) where D is the smallest distance between
+       * the two nodes. The second condition ensures that the approximation
+       * is positive */
+      err_hermite = herm->error_factor(X_nodes.radius[X_idx]) *
+        std::exp((log_dens[1L] + kernel.get_log_norm_const()) / 2.);
+      use_hermite = X_weight * err_hermite / k_mid < 2. * eps and
+        err_hermite < k_min;
+    }
+    if(use_centroid or use_hermite){
+      reduction_slot *task_slot =
+        spawn_tasks and deterministic ? new_slot(Y_idx) : slot;
+      if(comp_err){
+        /* both the exact sum and the approximation are in
+         * [weight * k_min, weight * k_max] when the centroid is used. The
+         * bounds are added to the query nodes once all tasks are done */
+        const double log_pair_err = std::log(X_weight) +
+          std::log(use_hermite ? err_hermite : k_max - k_min);
+        reduction_slot &err_slot = task_slot ? *task_slot : slots->front();
+        err_slot.log_err.emplace_back(Y_idx, log_pair_err);
+      }
+      if(!deterministic)
+        task_slot = nullptr;
+
       comp_w_centroid<has_extra> task =
         {
-          log_weights, X_node, Y_node,
-          Y, kernel, pool.thread_count < 2L, Y_extra, extra_func
+          log_weights, X_nodes, X_idx, Y_nodes, Y_idx,
+          Y, Y_f, kernel, pool.thread_count < 2L, Y_extra, extra_func,
+          use_hermite ? herm : nullptr, task_slot
         };
-      if(is_main_thread)
-        futures.push_back(pool.submit(std::move(task)));
+      if(spawn_tasks)
+        tasks.run(std::move(task));
       else
         task();
 
       return;
     }
 
-    if(X_node.is_leaf and Y_node.is_leaf){
+    if(X_node.is_leaf() and Y_node.is_leaf()){
       comp_all<has_extra> task = {
-        log_weights, X_node, Y_node,
-        X, ws_log, Y, kernel,
-        pool.thread_count < 2L, X_extra, Y_extra, extra_func
+        log_weights, X_nodes, X_idx, Y_nodes, Y_idx,
+        X, ws_log, Y, X_f, Y_f, kernel,
+        pool.thread_count < 2L, X_extra, Y_extra, extra_func,
+        deterministic ? (spawn_tasks ? new_slot(Y_idx) : slot) : nullptr
       };
-      if(is_main_thread)
-        futures.push_back(pool.submit(std::move(task)));
+      if(spawn_tasks)
+        tasks.run(std::move(task));
       else
         task();
       return;
     }
 
-    if(!X_node.is_leaf and  Y_node.is_leaf){
-      do_work<is_main_thread>(*X_node.left ,  Y_node      );
-      do_work<is_main_thread>(*X_node.right,  Y_node      );
+    if(!X_node.is_leaf() and  Y_node.is_leaf()){
+      do_work<spawn_tasks>(X_node.left   , Y_idx         , slot);
+      do_work<spawn_tasks>(X_node.right(), Y_idx         , slot);
 
       return;
     }
-    if( X_node.is_leaf and !Y_node.is_leaf){
-      do_work<is_main_thread>( X_node      , *Y_node.left );
-      do_work<is_main_thread>( X_node      , *Y_node.right);
+    if( X_node.is_leaf() and !Y_node.is_leaf()){
+      do_work<spawn_tasks>(X_idx         , Y_node.left   , slot);
+      do_work<spawn_tasks>(X_idx         , Y_node.right(), slot);
 
       return;
     }
 
-    do_work<is_main_thread>(  *X_node.left , *Y_node.left );
-    do_work<is_main_thread>(  *X_node.left , *Y_node.right);
-    do_work<is_main_thread>(  *X_node.right, *Y_node.left );
-    do_work<is_main_thread>(  *X_node.right, *Y_node.right);
+    do_work<spawn_tasks>(  X_node.left   , Y_node.left   , slot);
+    do_work<spawn_tasks>(  X_node.left   , Y_node.right(), slot);
+    do_work<spawn_tasks>(  X_node.right(), Y_node.left   , slot);
+    do_work<spawn_tasks>(  X_node.right(), Y_node.right(), slot);
   }
 };
 
+/* sets the bounds on the absolute errors of the points in the query node
+ * given the bound from the pairs with the ancestors of the node */
+static void set_log_err
+  (const query_nodes &Y_nodes, const arma::uword Y_idx, arma::vec &log_err,
+   double log_err_parents)
+{
+  log_err_parents = log_sum_log(log_err_parents, Y_nodes.log_err[Y_idx]);
+  const KD_tree::node &Y_node = Y_nodes.tree.get_node(Y_idx);
+  if(Y_node.is_leaf()){
+    for(arma::uword i = Y_node.start; i < Y_node.end; ++i)
+      log_err[i] = log_err_parents;
+    return;
+  }
+
+  set_log_err(Y_nodes, Y_node.left   , log_err, log_err_parents);
+  set_log_err(Y_nodes, Y_node.right(), log_err, log_err_parents);
+}
+
+/* adds the bounds on the errors in the slots to the query nodes in the order
+ * of the slots */
+static void reduce_slots_log_err
+  (const std::deque<reduction_slot> &slots, query_nodes &Y_nodes)
+{
+  for(auto &s : slots)
+    for(auto &e : s.log_err){
+      double &log_err = Y_nodes.log_err[e.first];
+      log_err = log_sum_log(log_err, e.second);
+    }
+}
+
+/* adds the output in the slots to the log weights and the extra output in
+ * the order of the slots. The query points are split into blocks which are
+ * done in parallel. The result does not depend on the number of threads as
+ * the terms of each point are added in the same order */
+static void reduce_slots
+  (const std::deque<reduction_slot> &slots, arma::vec &log_weights,
+   arma::mat *Y_extra, thread_pool &pool)
+{
+  auto reduce_block = [&](const arma::uword start, const arma::uword end){
+    for(auto &s : slots){
+      const arma::uword lb = std::max(start, s.start),
+                        ub = std::min(end  , s.end);
+      if(lb >= ub or s.log_weights.n_elem < 1L)
+        continue;
+
+      lse::log_sum_log_block(
+        log_weights.begin() + lb, s.log_weights.begin() + (lb - s.start),
+        ub - lb);
+      if(Y_extra)
+        Y_extra->cols(lb, ub - 1L) +=
+          s.extra.cols(lb - s.start, ub - 1L - s.start);
+    }
+  };
+
+  const arma::uword n = log_weights.n_elem;
+  if(pool.thread_count < 2L){
+    reduce_block(0L, n);
+    return;
+  }
+
+  const arma::uword inc = n / (4L * pool.thread_count) + 1L;
+  task_group tasks(pool);
+  for(arma::uword start = 0; start < n; start += inc)
+    tasks.run(std::bind(reduce_block, start, std::min(start + inc, n)));
+  tasks.wait();
+}
+
 template<bool has_extra>
 FSKA_cpp_permutation FSKA_cpp(
     arma::vec &log_weights, arma::mat &X, arma::mat &Y, arma::vec &ws_log,
     const arma::uword N_min, const double eps, const trans_obj &kernel,
     thread_pool &pool, const bool has_transformed, arma::mat *X_extra,
-    arma::mat *Y_extra, FSKA_cpp_xtra_func extra_func)
+    arma::mat *Y_extra, FSKA_cpp_xtra_func extra_func, const bool use_float,
+    const arma::uword hermite_order, arma::vec *log_err,
+    const bool keep_trees, const KD_tree_topology *X_tree,
+    const KD_tree_topology *Y_tree, const bool deterministic,
+    const bool use_balls)
 {
 #ifdef MSSM_DEBUG
   if(log_weights.n_elem != Y.n_cols)
@@ -472,183 +679,225 @@ FSKA_cpp_permutation FSKA_cpp(
 
   /* transform X and Y before doing any computation */
   if(!has_transformed){
-    auto t1 = pool.submit(std::bind(
-      &trans_obj::trans_X, &kernel, std::ref(X)));
-    auto t2 = pool.submit(std::bind(
-      &trans_obj::trans_Y, &kernel, std::ref(Y)));
-    t1.get();
-    t2.get();
+    task_group tasks(pool);
+    tasks.run(std::bind(&trans_obj::trans_X, &kernel, std::ref(X)));
+    kernel.trans_Y(Y);
+    tasks.wait();
   }
 
+  /* object to compute the moments of the Hermite expansion */
+  std::unique_ptr<const hermite_terms> herm;
+  if(!has_extra and hermite_order > 0L and kernel.is_gaussian_kernel())
+    herm.reset(new hermite_terms(X.n_rows, hermite_order));
+
   /* form trees */
-  auto X_root = get_X_root<has_extra>(X, ws_log, N_min, X_extra, pool);
-  auto Y_root = get_Y_root<has_extra>(Y,         N_min, Y_extra, pool);
+  auto X_root = get_X_root<has_extra>(
+    X, ws_log, N_min, X_extra, pool, herm.get(), X_tree, use_balls);
+  auto Y_root = get_Y_root<has_extra>(
+    Y,         N_min, Y_extra, pool, Y_tree, use_balls);
+
+  /* single precision copies of the permuted particles to use in the kernel
+   * evaluations */
+  std::unique_ptr<const arma::fmat> X_f, Y_f;
+  if(use_float){
+    task_group tasks(pool);
+    tasks.run([&]{
+      X_f.reset(new arma::fmat(arma::conv_to<arma::fmat>::from(X)));
+    });
+    Y_f.reset(new arma::fmat(arma::conv_to<arma::fmat>::from(Y)));
+    tasks.wait();
+  }
 
-  std::list<std::future<void> > futures;
-  source_node<has_extra> &X_root_source = *std::get<1L>(X_root);
-  query_node &Y_root_query   = *std::get<1L>(Y_root);
+  task_group tasks(pool);
+  const source_nodes<has_extra> &X_root_source = *std::get<1L>(X_root);
+  query_nodes &Y_root_query = *std::get<1L>(Y_root);
 
   /* compute weights etc. This is a bad design. The class we define
    * must not get destructed due to a 'this' pointer used in the function... */
+  std::deque<reduction_slot> slots;
+  if(log_err and !deterministic)
+    slots.emplace_back();
   comp_weights<has_extra> worker {
-    log_weights, X, ws_log, Y, eps,
-    kernel, pool, futures, X_extra, Y_extra, extra_func };
-  worker.template do_work<true>(X_root_source, Y_root_query);
-
-  while(!futures.empty()){
-    futures.back().get();
-    futures.pop_back();
+    log_weights, X, ws_log, Y, X_f.get(), Y_f.get(), eps,
+    kernel, pool, tasks, X_extra, Y_extra, extra_func, herm.get(),
+    (bool)log_err, X_root_source, Y_root_query,
+    deterministic or log_err ? &slots : nullptr, deterministic };
+  /* the traversal is itself a task so the tasks it spawns are pushed to the
+   * deque of a worker without locking and are stolen by the other workers */
+  tasks.run([&]{ worker.template do_work<true>(0L, 0L, nullptr); });
+  tasks.wait();
+
+  if(deterministic)
+    reduce_slots(slots, log_weights, Y_extra, pool);
+
+  if(log_err){
+    reduce_slots_log_err(slots, Y_root_query);
+    log_err->set_size(Y.n_cols);
+    set_log_err(Y_root_query, 0L, *log_err,
+                -std::numeric_limits<double>::infinity());
   }
 
   /* transform back */
   if(!has_transformed){
-    auto ta = pool.submit(std::bind(
-      &trans_obj::trans_inv_X, &kernel, std::ref(X)));
+    tasks.run(std::bind(&trans_obj::trans_inv_X, &kernel, std::ref(X)));
     kernel.trans_inv_Y(Y);
-    ta.get();
+    tasks.wait();
+  }
+
+  FSKA_cpp_permutation out =
+    { std::move(std::get<2L>(X_root)) , std::move(std::get<2L>(Y_root)) };
+  if(keep_trees){
+    out.X_tree = std::get<0L>(X_root)->get_topology();
+    out.Y_tree = std::get<0L>(Y_root)->get_topology();
   }
 
-  return
-  { std::move(std::get<2L>(X_root)) , std::move(std::get<2L>(Y_root)) };
+  return out;
 }
 
 template FSKA_cpp_permutation FSKA_cpp<true>(
     arma::vec&, arma::mat&, arma::mat&, arma::vec&, const arma::uword,
     const double, const trans_obj&, thread_pool&, const bool,
-    arma::mat*, arma::mat*, FSKA_cpp_xtra_func);
+    arma::mat*, arma::mat*, FSKA_cpp_xtra_func, const bool,
+    const arma::uword, arma::vec*, const bool, const KD_tree_topology*,
+    const KD_tree_topology*, const bool, const bool);
 template FSKA_cpp_permutation FSKA_cpp<false>(
     arma::vec&, arma::mat&, arma::mat&, arma::vec&, const arma::uword,
     const double, const trans_obj&, thread_pool&, const bool,
-    arma::mat*, arma::mat*, FSKA_cpp_xtra_func);
-
-template<bool has_extra>
-std::unique_ptr<const source_node<has_extra> > set_child
-  (const arma::mat &X, const arma::vec &ws, const KD_note &node,
-   const arma::mat *extra, const bool is_left)
-{
-  typedef std::unique_ptr<const source_node<has_extra> > ptr_out;
-  if(node.is_leaf())
-    return ptr_out();
-  if(is_left)
-    return ptr_out(
-      new source_node<has_extra>(X, ws, node.get_left (), extra));
-  return ptr_out(
-      new source_node<has_extra>(X, ws, node.get_right(), extra));
-}
+    arma::mat*, arma::mat*, FSKA_cpp_xtra_func, const bool,
+    const arma::uword, arma::vec*, const bool, const KD_tree_topology*,
+    const KD_tree_topology*, const bool, const bool);
 
-template<bool has_extra>
-arma::vec set_centroid
-  (const source_node<has_extra> &snode, const arma::mat &X, const arma::vec &ws)
+/* the functions below set the members of the source nodes. The nodes are
+ * visited in reverse order so the children are set before their parent */
+static arma::vec set_weights(const KD_tree &tree, const arma::vec &ws)
 {
-  if(snode.is_leaf){
-    arma::vec centroid(X.n_rows, arma::fill::zeros);
-    const auto &indices = snode.node.get_indices();
-    double sum_w = 0.;
-    for(auto idx : indices){
-      const double w = std::exp(ws[idx]);
-      centroid += w * X.unsafe_col(idx);
-      sum_w += w;
+  arma::vec out(tree.n_nodes());
+  for(arma::uword i = tree.n_nodes(); i-- > 0;){
+    const KD_tree::node &nd = tree.get_node(i);
+    if(nd.is_leaf()){
+      double weight = 0.;
+      for(arma::uword j = nd.start; j < nd.end; ++j)
+        weight += std::exp(ws[j]);
+      out[i] = weight;
+      continue;
     }
-    centroid /= sum_w;
 
-    return centroid;
+    out[i] = out[nd.left] + out[nd.right()];
   }
 
-  double w1 = snode.left->weight, w2 = snode.right->weight;
-  return
-    (w1 / (w1 + w2)) * snode.left->centroid +
-    (w2 / (w1 + w2)) * snode.right->centroid;
+  return out;
 }
 
-template<bool has_extra>
-double set_weight(const source_node<has_extra> &snode, const arma::vec &ws)
+/* weighted means of the columns of X in each node */
+static arma::mat set_weighted_means
+  (const KD_tree &tree, const arma::mat &X, const arma::vec &ws,
+   const arma::vec &weights)
 {
-  if(snode.is_leaf){
-    const auto &indices = snode.node.get_indices();
-    double weight = 0.;
-    for(auto idx : indices)
-      weight += std::exp(ws[idx]);
+  arma::mat out(X.n_rows, tree.n_nodes());
+  for(arma::uword i = tree.n_nodes(); i-- > 0;){
+    const KD_tree::node &nd = tree.get_node(i);
+    arma::vec o(out.colptr(i), out.n_rows, false, true);
+    if(nd.is_leaf()){
+      o.zeros();
+      for(arma::uword j = nd.start; j < nd.end; ++j)
+        o += std::exp(ws[j]) * X.unsafe_col(j);
+      o /= weights[i];
+      continue;
+    }
 
-    return weight;
+    const double w1 = weights[nd.left], w2 = weights[nd.right()];
+    o = (w1 / (w1 + w2)) * out.unsafe_col(nd.left) +
+      (w2 / (w1 + w2)) * out.unsafe_col(nd.right());
   }
 
-  return snode.left->weight + snode.right->weight;
+  return out;
 }
 
-template<class T>
-hyper_rectangle set_borders(const T &snode, const arma::mat &X){
-  if(snode.is_leaf)
-    return hyper_rectangle(X, snode.node.get_indices());
+static arma::mat set_hermite
+  (const KD_tree &tree, const arma::mat &X, const arma::vec &ws,
+   const arma::mat &centroids, const hermite_terms *herm)
+{
+  if(!herm)
+    return arma::mat();
+
+  arma::mat out(herm->n_terms(), tree.n_nodes(), arma::fill::zeros);
+  arma::vec d(X.n_rows);
+  for(arma::uword i = tree.n_nodes(); i-- > 0;){
+    const KD_tree::node &nd = tree.get_node(i);
+    double * const o = out.colptr(i);
+    if(nd.is_leaf()){
+      for(arma::uword j = nd.start; j < nd.end; ++j){
+        d = X.unsafe_col(j) - centroids.unsafe_col(i);
+        herm->add_moments(d.memptr(), std::exp(ws[j]), o);
+      }
+      continue;
+    }
+
+    /* shift the moments of the children to the centroid of this node */
+    for(auto child : { nd.left, nd.right() }){
+      d = centroids.unsafe_col(child) - centroids.unsafe_col(i);
+      herm->add_shifted(out.colptr(child), d.memptr(), o);
+    }
+  }
 
-  return hyper_rectangle(snode.left->borders, snode.right->borders);
+  return out;
 }
 
-template<bool has_extra>
-std::unique_ptr<arma::vec> set_extra
-  (const source_node<has_extra> &snode, const arma::mat *extra,
-   const arma::vec &ws)
+static arma::vec set_radius
+  (const KD_tree &tree, const arma::mat &centroids,
+   const hermite_terms *herm)
 {
-#ifdef MSSM_DEBUG
-  if((bool)extra != has_extra)
-    throw std::invalid_argument("invalid 'has_extra' and 'extra'");
-#endif
-
-  typedef std::unique_ptr<arma::vec> ptr_out;
-
-  if(!has_extra)
-    return ptr_out();
-
-  ptr_out out(new arma::vec(extra->n_rows, arma::fill::none));
-  arma::vec &xtr = *out;
-
-  if(snode.is_leaf){
-    xtr.zeros();
-    const auto &indices = snode.node.get_indices();
-    double sum_w = 0.;
-    for(auto idx : indices){
-      const double w = std::exp(ws[idx]);
-      xtr += w * extra->unsafe_col(idx);
-      sum_w += w;
+  if(!herm)
+    return arma::vec();
+
+  /* use the largest distance to a corner of the borders or the bound from
+   * the bounding ball if it is smaller */
+  arma::vec out(tree.n_nodes());
+  for(arma::uword i = 0; i < tree.n_nodes(); ++i){
+    const hyper_rectangle borders = tree.get_borders(i);
+    const double *lower = borders.get_lower(), *upper = borders.get_upper(),
+      *centroid = centroids.colptr(i);
+    double r = 0.;
+    for(arma::uword k = 0; k < tree.dim; ++k){
+      const double d = std::max(centroid[k] - lower[k], upper[k] - centroid[k]);
+      r += d * d;
+    }
+    out[i] = std::sqrt(r);
+
+    if(tree.use_balls){
+      const double *center = tree.get_ball_center(i);
+      double d = 0.;
+      for(arma::uword k = 0; k < tree.dim; ++k)
+        d += (centroid[k] - center[k]) * (centroid[k] - center[k]);
+      out[i] = std::min(out[i], std::sqrt(d) + tree.get_ball_radius(i));
     }
-    xtr /= sum_w;
-
-    return out;
   }
 
-  double w1 = snode.left->weight, w2 = snode.right->weight;
-  xtr =
-    (w1 / (w1 + w2)) * *snode.left->extra +
-      (w2 / (w1 + w2)) * *snode.right->extra;
   return out;
 }
 
 template<bool has_extra>
-source_node<has_extra>::source_node
-  (const arma::mat &X, const arma::vec &ws, const KD_note &node,
-   const arma::mat *extra):
-  node(node), left(set_child<has_extra>(X, ws, node, extra, true)),
-  right(set_child<has_extra>(X, ws, node, extra, false)),
-  centroid(set_centroid<has_extra>(*this, X, ws)),
-  weight(set_weight(*this, ws)), borders(set_borders(*this, X)),
-  extra(set_extra<has_extra>(*this, extra, ws))
-  { }
-
-template class source_node<true >;
-template class source_node<false>;
-
-inline std::unique_ptr<const query_node> set_child_query
-  (const arma::mat &X, const KD_note &node, const bool is_left)
-{
-  if(node.is_leaf())
-    return std::unique_ptr<query_node>();
-  if(is_left)
-    return std::unique_ptr<query_node>(
-      new query_node(X, node.get_left ()));
-  return std::unique_ptr<query_node>(
-    new query_node(X, node.get_right()));
-}
+source_nodes<has_extra>::source_nodes
+  (const KD_tree &tree, const arma::mat &X, const arma::vec &ws,
+   const arma::mat *extra, const hermite_terms *herm):
+  tree(tree), weights(set_weights(tree, ws)),
+  centroids(set_weighted_means(tree, X, ws, weights)),
+  extra(has_extra ?
+          set_weighted_means(tree, *extra, ws, weights) : arma::mat()),
+  hermite(set_hermite(tree, X, ws, centroids, herm)),
+  radius(set_radius(tree, centroids, herm))
+  {
+#ifdef MSSM_DEBUG
+    if((bool)extra != has_extra)
+      throw std::invalid_argument("invalid 'has_extra' and 'extra'");
+    if(X.n_cols != tree.get_indices().size())
+      throw std::invalid_argument("invalid 'X' and 'tree'");
+#endif
+  }
+
+template class source_nodes<true >;
+template class source_nodes<false>;
 
-query_node::query_node(const arma::mat &Y, const KD_note &node):
-  node(node), left(set_child_query(Y, node, true)),
-  right(set_child_query(Y, node, false)), borders(set_borders(*this, Y)),
-  idx_mutex(new std::mutex()) { }
+query_nodes::query_nodes(const KD_tree &tree):
+  tree(tree), mutexes(tree.n_nodes()),
+  log_err(tree.n_nodes(), -std::numeric_limits<double>::infinity()) { }
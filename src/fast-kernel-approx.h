@@ -1,42 +1,57 @@
 #include "kd-tree.h"
 #include "dists.h"
 #include "thread_pool.h"
+#include "hermite-expansion.h"
 #include <array>
 #include <mutex>
+#include <vector>
 
+/* weights, weighted centroids, and other quantities for the nodes of a k-d
+ * tree of source particles. Element or column i is for node i. The
+ * particles and log weights must be permuted with the indices of the
+ * tree */
 template<bool has_extra = false>
-class source_node {
+class source_nodes {
 public:
-  const KD_note &node;
-  const bool is_leaf = node.is_leaf();
-  const std::unique_ptr<const source_node<has_extra> > left;
-  const std::unique_ptr<const source_node<has_extra> > right;
-  const arma::vec centroid;
-  const double weight;
-  const hyper_rectangle borders;
-  const std::unique_ptr<arma::vec> extra;
-
-  /* takes in the matrix with source particles, log weights, and the root
-   * in the k-d tree */
-  source_node(const arma::mat&, const arma::vec&, const KD_note&,
-              const arma::mat*);
+  const KD_tree &tree;
+  const arma::vec weights;
+  /* [dim] x [number of nodes] matrix */
+  const arma::mat centroids;
+  /* weighted means of the extra information. Empty if has_extra is false */
+  const arma::mat extra;
+  /* moments of the truncated Hermite expansion about the centroids and the
+   * largest distances from the centroids to a point in the nodes. Both are
+   * empty unless a hermite_terms object is passed */
+  const arma::mat hermite;
+  const arma::vec radius;
+
+  /* takes in the tree, the matrix with source particles, log weights, the
+   * optional extra information, and an optional object to compute the
+   * moments of the Hermite expansion */
+  source_nodes(const KD_tree&, const arma::mat&, const arma::vec&,
+               const arma::mat*, const hermite_terms* = nullptr);
 };
 
-class query_node {
+/* data for the nodes of a k-d tree of query particles which is written to
+ * while the trees are traversed */
+class query_nodes {
 public:
-  const KD_note &node;
-  const bool is_leaf = node.is_leaf();
-  const std::unique_ptr<const query_node> left;
-  const std::unique_ptr<const query_node> right;
-  const hyper_rectangle borders;
-  const std::unique_ptr<std::mutex> idx_mutex;
-
-  query_node(const arma::mat&, const KD_note&);
+  const KD_tree &tree;
+  /* mutexes to lock when the output of the points in a node is updated */
+  std::vector<std::mutex> mutexes;
+  /* log of the sum of the bounds on the absolute errors of the approximated
+   * pairs of nodes with each node */
+  std::vector<double> log_err;
+
+  query_nodes(const KD_tree&);
 };
 
 struct FSKA_cpp_permutation {
   arma::uvec X_perm;
   arma::uvec Y_perm;
+  /* topologies of the trees of X and Y. They are empty unless they are
+   * requested */
+  KD_tree_topology X_tree, Y_tree;
 };
 
 /* Make extra computation and stores it in the fourth argument. First two
@@ -50,12 +65,42 @@ typedef std::function<void (const double *, const double *, const double *, doub
 /* Function to approximate otherwise O(N^2) computation. May permutate the the
  * referenced vectors and matrices. The returned object can be used to undo
  * the permutation. Use -infinity for uninitialized weights.
- * The function also takes two matrix pointers and a function to use on the
- * two matrices' columns given the two particles and log weight of the pair */
+ * The function also takes two matrix pointers, X_extra and Y_extra, and a
+ * function, extra_func, to use on the two matrices' columns given the two
+ * particles and log weight of the pair.
+ * The kernel is evaluated with single precision copies of the particles if
+ * use_float is true. The log weights are still summed in double precision.
+ * If hermite_order is positive and the kernel is Gaussian, then node pairs
+ * may also be approximated with a truncated Hermite expansion of the given
+ * order about the centroid of the source node. This is not done when the
+ * extra computations are used.
+ * If log_err is not a null pointer, then it is set to the log of an upper
+ * bound on the absolute error of each sum. The bounds are computed from the
+ * bounds on the kernel of each pair of nodes which is approximated. The
+ * order is the same as the log weights so the same permutation should be
+ * used.
+ * The topologies of the two trees are returned if keep_trees is true.
+ * X_tree and Y_tree can be topologies of trees of X and Y from a previous
+ * call. They are then used instead of building new trees and only the
+ * borders are computed. This is useful if the same particles are used again
+ * with another transformation. New trees are build if they are null
+ * pointers.
+ * If deterministic is true, then the output of each task is written to a
+ * separate slot and the slots are added in a fixed order after all tasks
+ * are done. The result is then the same for any number of threads at the
+ * cost of more memory.
+ * Ball trees are used instead of k-d trees if use_balls is true. This
+ * yields tighter bounds in higher dimensions */
 template<bool has_extra = false>
 FSKA_cpp_permutation FSKA_cpp(
     arma::vec&, arma::mat&, arma::mat&, arma::vec&, const arma::uword,
     const double, const trans_obj&, thread_pool&,
     bool has_transformed = false, arma::mat *X_extra = nullptr,
     arma::mat *Y_extra = nullptr,
-    FSKA_cpp_xtra_func extra_func = FSKA_cpp_xtra_func());
+    FSKA_cpp_xtra_func extra_func = FSKA_cpp_xtra_func(),
+    const bool use_float = false, const arma::uword hermite_order = 0L,
+    arma::vec *log_err = nullptr, const bool keep_trees = false,
+    const KD_tree_topology *X_tree = nullptr,
+    const KD_tree_topology *Y_tree = nullptr,
+    const bool deterministic = false, const bool use_balls = false);
+
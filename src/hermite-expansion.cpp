@@ -0,0 +1,158 @@
+#include "hermite-expansion.h"
+#include "misc.h"
+#include <map>
+#include <cmath>
+#include <algorithm>
+
+/* adds all multi-indices with dim elements which sum to n to the output */
+static void add_multi_indices
+  (const arma::uword dim, const arma::uword n, std::vector<arma::uword> &cur,
+   const arma::uword k, std::vector<std::vector<arma::uword> > &out)
+{
+  if(k == dim - 1L){
+    cur[k] = n;
+    out.push_back(cur);
+    return;
+  }
+
+  for(arma::uword i = n + 1L; i-- > 0;){
+    cur[k] = i;
+    add_multi_indices(dim, n - i, cur, k + 1L, out);
+  }
+}
+
+hermite_terms::hermite_terms(const arma::uword dim, const arma::uword order):
+  dim(dim), order(order) {
+  if(dim < 1L)
+    throw std::invalid_argument("hermite_terms: invalid 'dim'");
+
+  /* find the multi-indices in graded order */
+  std::vector<std::vector<arma::uword> > indices;
+  {
+    std::vector<arma::uword> cur(dim);
+    for(arma::uword n = 0; n <= order; ++n)
+      add_multi_indices(dim, n, cur, 0L, indices);
+  }
+  std::map<std::vector<arma::uword>, arma::uword> index_map;
+  for(arma::uword i = 0; i < indices.size(); ++i)
+    index_map[indices[i]] = i;
+
+  const arma::uword n_t = indices.size();
+  parent    .resize(n_t, 0L);
+  parent_dim.resize(n_t, 0L);
+  parent_pow.resize(n_t, 0L);
+  pairs     .resize(n_t);
+
+  for(arma::uword i = 1; i < n_t; ++i){
+    std::vector<arma::uword> par = indices[i];
+    arma::uword k = 0L;
+    while(par[k] == 0L)
+      ++k;
+    parent_dim[i] = k;
+    parent_pow[i] = par[k];
+    par[k] = 0L;
+    parent[i] = index_map[par];
+  }
+
+  std::vector<arma::uword> diff(dim);
+  for(arma::uword i = 0; i < n_t; ++i){
+    const std::vector<arma::uword> &a = indices[i];
+    for(arma::uword j = 0; j < n_t; ++j){
+      const std::vector<arma::uword> &b = indices[j];
+      bool is_le = true;
+      for(arma::uword k = 0; k < dim and is_le; ++k){
+        is_le = b[k] <= a[k];
+        diff[k] = a[k] - b[k];
+      }
+
+      if(is_le)
+        pairs[i].push_back({ j, index_map[diff] });
+    }
+  }
+
+  /* the remainder is a sum over the multi-indices a with |a| = n = p + 1.
+   * Each term is bounded by
+   *
+   *   K^m(a) |d^a| / sqrt(a!) exp(-D^2 / 4)
+   *
+   * where m(a) <= min(dim, n) is the number of non-zero elements of a and K
+   * is the constant in Cramer's inequality
+   *
+   *   |He_n(x)| exp(-x^2 / 4) <= K sqrt(n!)
+   *
+   * which is one for n = 0. By the Cauchy-Schwarz inequality and the
+   * multinomial theorem, the sum of |d^a| / sqrt(a!) is less than
+   * sqrt(C) ||d||^n / sqrt(n!) where C = (n + dim - 1) choose (dim - 1) is
+   * the number of terms */
+  static constexpr double K = 1.086435;
+  const double n = order + 1., log_n_terms =
+    std::lgamma(n + dim) - std::lgamma(n + 1.) - std::lgamma((double)dim);
+  log_err_const = std::min<double>(dim, n) * std::log(K) +
+    .5 * log_n_terms - .5 * std::lgamma(n + 1.);
+}
+
+void hermite_terms::set_pow_table(const double *x, double *out) const {
+  for(arma::uword k = 0; k < dim; ++k, ++x){
+    *out++ = 1.;
+    for(arma::uword n = 1; n <= order; ++n, ++out)
+      *out = *(out - 1L) * *x / n;
+  }
+}
+
+void hermite_terms::set_herm_table(const double *x, double *out) const {
+  for(arma::uword k = 0; k < dim; ++k, ++x, out += order + 1L){
+    out[0L] = 1.;
+    if(order > 0L)
+      out[1L] = *x;
+    for(arma::uword n = 1; n < order; ++n)
+      out[n + 1L] = *x * out[n] - n * out[n - 1L];
+  }
+}
+
+/* computes the product of the terms in the table for each multi-index */
+#define SET_TERM_VALUES(TABLE_FUNC, X)                                    \
+  const arma::uword n_t = n_terms(), n_table = dim * (order + 1L);        \
+  M_THREAD_LOCAL std::vector<double> mem;                                 \
+  if(mem.size() < n_t + n_table)                                          \
+    mem.resize(n_t + n_table);                                            \
+  double * const table = mem.data(), * const vals = table + n_table;      \
+  TABLE_FUNC(X, table);                                                   \
+  vals[0L] = 1.;                                                          \
+  for(arma::uword i = 1; i < n_t; ++i)                                    \
+    vals[i] = vals[parent[i]] *                                           \
+      table[parent_pow[i] + parent_dim[i] * (order + 1L)];
+
+void hermite_terms::add_moments
+  (const double *d, const double w, double *out) const {
+  SET_TERM_VALUES(set_pow_table, d)
+
+  for(arma::uword i = 0; i < n_t; ++i)
+    out[i] += w * vals[i];
+}
+
+void hermite_terms::add_shifted
+  (const double *moments, const double *shift, double *out) const {
+  SET_TERM_VALUES(set_pow_table, shift)
+
+  for(arma::uword i = 0; i < n_t; ++i)
+    for(auto &p : pairs[i])
+      out[i] += moments[p[0L]] * vals[p[1L]];
+}
+
+double hermite_terms::eval(const double *moments, const double *t) const {
+  SET_TERM_VALUES(set_herm_table, t)
+
+  double out = 0.;
+  for(arma::uword i = 0; i < n_t; ++i)
+    out += moments[i] * vals[i];
+  return out;
+}
+
+#undef SET_TERM_VALUES
+
+double hermite_terms::error_factor(const double dist) const {
+  if(dist <= 0.)
+    return 0.;
+
+  return std::exp((order + 1.) * std::log(dist) + log_err_const);
+}
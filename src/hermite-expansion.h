@@ -0,0 +1,71 @@
+#ifndef HERMITE_EXPANSION_H
+#define HERMITE_EXPANSION_H
+#include "arma.h"
+#include <vector>
+#include <array>
+
+/* class to work with truncated Taylor expansions of the Gaussian kernel
+ * exp(-||y - x||^2 / 2) in x about a center c. With t = y - c and
+ * d = x - c, the expansion is
+ *
+ *   sum_{|a| <= p} d^a / a! He_a(t) exp(-||t||^2 / 2)
+ *
+ * where a is a multi-index, p is the order, and He_a(t) is the product of the
+ * probabilists' Hermite polynomials He_{a_k}(t_k). Thus, a weighted sum
+ * over a set of source points only requires the moments
+ *
+ *   M_a = sum_i w_i d_i^a / a!
+ *
+ * See
+ *
+ *   Greengard, L., & Strain, J. (1991). The fast Gauss transform. SIAM
+ *   Journal on Scientific and Statistical Computing, 12(1), 79-94.
+ */
+class hermite_terms {
+  /* the terms are in graded order. For each term with a positive degree,
+   * we store the index of the term where the power of the first dimension
+   * with a non-zero power is set to zero, that dimension, and the power */
+  std::vector<arma::uword> parent, parent_dim, parent_pow;
+  /* for each term, the pairs of terms whose multi-indices sum to the
+   * multi-index of the term */
+  std::vector<std::vector<std::array<arma::uword, 2> > > pairs;
+  /* log of the factor in the error bound which does not depend on the
+   * distance */
+  double log_err_const;
+
+  /* sets the k'th column to x_k^n / n! or He_n(x_k) for n = 0, ..., p */
+  void set_pow_table (const double*, double*) const;
+  void set_herm_table(const double*, double*) const;
+
+public:
+  const arma::uword dim, order;
+
+  hermite_terms(const arma::uword, const arma::uword);
+
+  arma::uword n_terms() const {
+    return parent.size();
+  }
+
+  /* adds the moments of a point given the point minus the center and its
+   * weight to the last argument */
+  void add_moments(const double*, const double, double*) const;
+
+  /* adds the moments about a new center to the last argument given the
+   * moments about an old center and the old center minus the new center */
+  void add_shifted(const double*, const double*, double*) const;
+
+  /* returns the sum of the moments times He_a(t) given the moments and t */
+  double eval(const double*, const double*) const;
+
+  /* returns a factor f such that the absolute truncation error of
+   * the expansion of the kernel for a single point with unit weight is less
+   * than
+   *
+   *   f exp(-D^2 / 4)
+   *
+   * where D is the smallest distance between y and the line segment from
+   * the center to x, given the distance between the center and x */
+  double error_factor(const double) const;
+};
+
+#endif
@@ -1,333 +1,399 @@
 #include "kd-tree.h"
 #include <numeric>
-
-using std::domain_error;
-using std::invalid_argument;
-using std::ref;
-using std::cref;
-
-class row_order {
-  using idx_ptr = std::unique_ptr<std::vector<arma::uword> >;
-
-  const arma::mat &X;
-public:
-  row_order(const arma::mat&);
-
-  struct index_partition {
-    idx_ptr left;
-    idx_ptr right;
-    arma::uword dim;
-  };
-
-  index_partition get_split
-    (std::vector<arma::uword>&, const hyper_rectangle&);
+#include <algorithm>
+#include <limits>
+#include <functional>
+#include <stdexcept>
+#include <cmath>
+#include <utility>
+
+namespace {
+/* result from splitting a node */
+struct split_res {
+  /* the split dimension and the range of the two children in the split
+   * dimension */
+  arma::uword dim;
+  double lower_left, upper_left, lower_right, upper_right;
 };
 
-KD_note get_KD_tree
-  (const arma::mat &X, const arma::uword N_min, thread_pool &pool){
-  std::unique_ptr<std::vector<arma::uword> > idx_in;
-
-  std::vector<std::future<void> > futures;
-  std::mutex lc;
+/* sets the smallest and largest value of the points in a given dimension */
+inline void set_range
+  (const arma::mat &X, const arma::uword *idx, const arma::uword n,
+   const arma::uword dim, double &lower, double &upper){
+  lower = std::numeric_limits<double>::max();
+  upper = std::numeric_limits<double>::lowest();
+  for(arma::uword i = 0; i < n; ++i, ++idx){
+    const double x = X(dim, *idx);
+    if(x < lower)
+      lower = x;
+    if(x > upper)
+      upper = x;
+  }
+}
 
-  auto out = KD_note(X, N_min, std::move(idx_in), nullptr, 0L, nullptr, pool,
-                     futures, lc);
+/* partitions the indices of a node at the median in the dimension with the
+ * widest range given the borders which are used to select the dimension */
+split_res split_node
+  (const arma::mat &X, arma::uword *idx, const arma::uword n,
+   const double *lower, const double *upper){
+  /* find index to split at */
+  arma::uword row = 0L;
+  double d_max = upper[0L] - lower[0L];
+  for(arma::uword j = 1L; j < X.n_rows; ++j){
+    const double diff = upper[j] - lower[j];
+    if(diff > d_max){
+      d_max = diff;
+      row = j;
+    }
+  }
 
-  out.set_depth();
+  /* partition indices */
+  const arma::uword inc = X.n_rows, split_at = n / 2L;
+  const double * const x = X.begin();
+  std::nth_element(
+    idx, idx + split_at, idx + n,
+    [&](const arma::uword i1, const arma::uword i2){
+      return *(x + row + i1 * inc) < *(x + row + i2 * inc);
+    });
+
+  split_res out;
+  out.dim = row;
+  set_range(X, idx           , split_at    , row, out.lower_left ,
+            out.upper_left);
+  set_range(X, idx + split_at, n - split_at, row, out.lower_right,
+            out.upper_right);
+  return out;
+}
 
+/* returns the squared distance between two points */
+inline double square_dist
+  (const double *x, const double *y, const arma::uword dim){
+  double out = 0.;
+  for(arma::uword k = 0; k < dim; ++k){
+    const double d = x[k] - y[k];
+    out += d * d;
+  }
   return out;
 }
 
-KD_note::KD_note(
-  const arma::mat &X, const arma::uword N_min, idx_ptr &&idx_in_r,
-  row_order *order, const arma::uword depth, const hyper_rectangle *rect,
-  thread_pool &pool, std::vector<std::future<void> > &futures,
-  std::mutex &lc):
-  n_elem(idx_in_r ? idx_in_r->size() : X.n_cols)
-  {
-    /* fraction at which to start multi-threading */
-    static constexpr double frac_mult = .01;        /* ~ 2^7 split */
-    static constexpr unsigned int max_nodes = 300L; /* ~ 2^1 + 2^2 + ... + 2^x */
-
-    idx_ptr idx_in(std::move(idx_in_r));
-    std::unique_ptr<row_order> ord_ptr;
-    std::unique_ptr<hyper_rectangle> rect_ptr;
-
-    const bool is_first_call = !order;
-    if(is_first_call){
-      idx_in.reset(new std::vector<arma::uword>(X.n_cols));
-      std::iota(idx_in->begin(), idx_in->end(), 0L);
-      ord_ptr.reset(new row_order(X));
-      order = ord_ptr.get();
-      rect_ptr.reset(new hyper_rectangle(X, *idx_in));
-      rect = rect_ptr.get();
-
-      futures.reserve(max_nodes);
+/* partitions the indices of a node at the median of the projections onto
+ * the line between two points which are far apart. One is the point
+ * furthest from the first point in the node and the other is the point
+ * furthest from that point */
+void split_node_ball
+  (const arma::mat &X, arma::uword *idx, const arma::uword n){
+  const arma::uword dim = X.n_rows;
+  auto furthest = [&](const double *from){
+    arma::uword out = *idx;
+    double d_max = -1.;
+    for(arma::uword i = 0; i < n; ++i){
+      const double d = square_dist(X.colptr(idx[i]), from, dim);
+      if(d > d_max){
+        d_max = d;
+        out = idx[i];
+      }
     }
+    return out;
+  };
+  const double *a = X.colptr(furthest(X.colptr(*idx))),
+               *b = X.colptr(furthest(a));
+
+  /* the indices are also compared so the result does not depend on the
+   * order of the indices when there are ties */
+  std::vector<std::pair<double, arma::uword> > proj(n);
+  for(arma::uword i = 0; i < n; ++i){
+    const double *x = X.colptr(idx[i]);
+    double p = 0.;
+    for(arma::uword k = 0; k < dim; ++k)
+      p += (x[k] - a[k]) * (b[k] - a[k]);
+    proj[i] = { p, idx[i] };
+  }
 
-    bool do_split = idx_in->size() > N_min;
-    if(do_split){
-      /* split indices*/
-      idx_ptr idx_left;
-      idx_ptr idx_right;
+  const arma::uword split_at = n / 2L;
+  std::nth_element(proj.begin(), proj.begin() + split_at, proj.end());
+  for(arma::uword i = 0; i < n; ++i)
+    idx[i] = proj[i].second;
+}
+} // namespace
 
-      hyper_rectangle rect_left = *rect, rect_right = *rect;
-      {
-        auto split_dim = order->get_split(*idx_in, *rect);
-        idx_left  = std::move(split_dim.left);
-        idx_right = std::move(split_dim.right);
+KD_tree get_KD_tree
+  (const arma::mat &X, const arma::uword N_min, thread_pool &pool,
+   const bool use_balls){
+  return KD_tree(X, N_min, pool, use_balls);
+}
 
-        rect_left .shrink(X, *idx_left , split_dim.dim);
-        rect_right.shrink(X, *idx_right, split_dim.dim);
+KD_tree::KD_tree
+  (const arma::mat &X, const arma::uword N_min, thread_pool &pool,
+   const bool use_balls):
+  dim(X.n_rows), use_balls(use_balls), indices(X.n_cols) {
+  const arma::uword n = X.n_cols;
+  std::iota(indices.begin(), indices.end(), 0L);
+  nodes.reserve(4L * (n / std::max(N_min, (arma::uword)1L)) + 1L);
+  nodes.push_back({ 0L, n, 0L });
+
+  /* borders which are used to select the split dimensions. They are only
+   * updated in the split dimension when a node is split. They are not used
+   * in a ball tree */
+  std::vector<double> split_lower, split_upper;
+  if(!use_balls){
+    split_lower.resize(dim);
+    split_upper.resize(dim);
+    for(arma::uword k = 0; k < dim; ++k)
+      set_range(X, indices.data(), n, k, split_lower[k], split_upper[k]);
+  }
+
+  /* build the tree one level at a time */
+  for(arma::uword lvl_start = 0L, lvl_end = 1L; ; ){
+    std::vector<arma::uword> to_split;
+    for(arma::uword i = lvl_start; i < lvl_end; ++i)
+      if(nodes[i].n_elem() > N_min)
+        to_split.push_back(i);
+    if(to_split.empty())
+      break;
+
+    /* the nodes at a level are disjoint so they can be split in parallel */
+    std::vector<split_res> splits(to_split.size());
+    auto do_split = [&](const arma::uword k_start, const arma::uword k_end){
+      for(arma::uword k = k_start; k < k_end; ++k){
+        const arma::uword i = to_split[k];
+        const node &nd = nodes[i];
+        if(use_balls){
+          split_node_ball(X, indices.data() + nd.start, nd.n_elem());
+          continue;
+        }
+        splits[k] = split_node(
+          X, indices.data() + nd.start, nd.n_elem(),
+          split_lower.data() + i * dim, split_upper.data() + i * dim);
+      }
+    };
+
+    if(pool.thread_count < 2L)
+      do_split(0L, to_split.size());
+    else {
+      /* make tasks with roughly the same number of points */
+      const arma::uword min_work = std::max(
+        (arma::uword)(n / (4L * pool.thread_count)), (arma::uword)1000L);
+      task_group tasks(pool);
+      arma::uword k_start = 0L, work = 0L;
+      for(arma::uword k = 0; k < to_split.size(); ++k){
+        work += nodes[to_split[k]].n_elem();
+        if(work >= min_work or k + 1L == to_split.size()){
+          tasks.run(std::bind(do_split, k_start, k + 1L));
+          k_start = k + 1L;
+          work = 0L;
+        }
       }
 
-      const bool
-        finish =
-          pool.thread_count < 2L or
-          idx_in->size() <= 50L or
-          (double)idx_in->size() <= (double)X.n_cols * frac_mult;
-
-      /* set left and right child */
-      auto get_worker =
-        [&](std::unique_ptr<KD_note> &ptr, idx_ptr &&indices,
-            hyper_rectangle new_rect) {
-          return set_child {
-            ptr, std::move(indices), new_rect, X, N_min, order, depth, pool,
-            futures, lc };
-      };
-
-      auto task_left  = get_worker(
-             left , std::move(idx_left ), std::move(rect_left)),
-           task_right = get_worker(
-             right, std::move(idx_right), std::move(rect_right));
-
-      if(finish){
-        task_left();
-        task_right();
-
-      } else {
-        std::lock_guard<std::mutex> ga(lc);
-        futures.push_back(pool.submit(std::move(task_left )));
-        futures.push_back(pool.submit(std::move(task_right)));
+      tasks.wait();
+    }
 
+    /* add the children */
+    for(arma::uword k = 0; k < to_split.size(); ++k){
+      const arma::uword i = to_split[k], start = nodes[i].start,
+        end = nodes[i].end, mid = start + (end - start) / 2L;
+      nodes[i].left = nodes.size();
+      nodes.push_back({ start, mid, 0L });
+      nodes.push_back({ mid  , end, 0L });
+      if(use_balls)
+        continue;
+
+      const arma::uword off = split_lower.size();
+      split_lower.resize(off + 2L * dim);
+      split_upper.resize(off + 2L * dim);
+      for(arma::uword j = 0; j < 2L; ++j){
+        std::copy(split_lower.begin() + i * dim,
+                  split_lower.begin() + (i + 1L) * dim,
+                  split_lower.begin() + off + j * dim);
+        std::copy(split_upper.begin() + i * dim,
+                  split_upper.begin() + (i + 1L) * dim,
+                  split_upper.begin() + off + j * dim);
       }
 
-      if(is_first_call)
-        /* We cannot return before all futures are done */
-        while(!futures.empty()){
-          std::future_status status;
-          auto &current_back = futures.back();
-          status = current_back.wait_for(std::chrono::nanoseconds(1L));
-          if(status == std::future_status::ready){
-            std::lock_guard<std::mutex> ga(lc);
-            if(&current_back == &futures.back()){
-              current_back.get();
-              futures.pop_back();
-            }
-
-          } else
-            std::this_thread::yield();
-        }
-
-      return;
+      const split_res &s = splits[k];
+      split_lower[off +       s.dim] = s.lower_left;
+      split_upper[off +       s.dim] = s.upper_left;
+      split_lower[off + dim + s.dim] = s.lower_right;
+      split_upper[off + dim + s.dim] = s.upper_right;
     }
 
-    /* it is a leaf */
-    idx = std::move(idx_in);
+    lvl_start = lvl_end;
+    lvl_end = nodes.size();
+    ++depth;
   }
 
+  set_borders(X);
+}
 
+KD_tree::KD_tree
+  (const KD_tree_topology &topo, const arma::mat &X, const bool use_balls):
+  dim(X.n_rows), use_balls(use_balls), nodes(topo.nodes),
+  indices(topo.indices) {
+  /* check the input as the nodes and indices may come from elsewhere */
+  const arma::uword n = X.n_cols, n_nodes = nodes.size();
+  if(indices.size() != n)
+    throw std::invalid_argument("KD_tree: invalid 'indices'");
+  if(n_nodes < 1L or nodes[0L].start != 0L or nodes[0L].end != n)
+    throw std::invalid_argument("KD_tree: invalid root node");
 
-row_order::row_order(const arma::mat &X): X(X) { }
-
-row_order::index_partition row_order::get_split(
-    std::vector<arma::uword> &indices, const hyper_rectangle &rect)
   {
-    /* find index to split at */
-    const arma::mat &borders = rect.get_borders();
-    arma::uword row = 0L;
-    double d_max = borders(1L, 0L) - borders(0L, 0L);
-    for(unsigned int j = 1L; j < borders.n_cols; ++j){
-      const double diff = borders(1L, j) - borders(0L, j);
-      if(diff > d_max){
-        d_max = diff;
-        row = j;
-      }
+    std::vector<bool> is_used(n, false);
+    for(auto i : indices){
+      if(i >= n or is_used[i])
+        throw std::invalid_argument("KD_tree: invalid 'indices'");
+      is_used[i] = true;
     }
+  }
 
-    /* sort indices */
-    const arma::uword inc = X.n_rows;
-    const double * const x = X.begin();
-    std::size_t split_at = indices.size() / 2L;
-    std::nth_element(
-      indices.begin(), indices.begin() + split_at, indices.end(),
-      [&](const arma::uword i1, const arma::uword i2){
-        return *(x + row + i1 * inc) < *(x + row + i2 * inc);
-      });
-
-    /* copy first and second half */
-    index_partition out;
-    out.dim = row;
-
-    out.left .reset(new std::vector<arma::uword>(split_at));
-    out.right.reset(new std::vector<arma::uword>(indices.size() - split_at));
-
-    std::vector<arma::uword> &left  = *out.left;
-    std::vector<arma::uword> &right = *out.right;
-
-    /* TODO: do something smarter? */
-    auto idx = indices.begin();
-    for(std::size_t i = 0; i < split_at; ++i, ++idx)
-      left[i] = *idx;
-    for(std::size_t i = 0; idx != indices.end(); ++i, ++idx)
-      right[i] = *idx;
+  /* the level of each node is used to find the depth */
+  std::vector<arma::uword> level(n_nodes, 1L);
+  for(arma::uword i = 0; i < n_nodes; ++i){
+    const node &nd = nodes[i];
+    if(nd.end < nd.start)
+      throw std::invalid_argument("KD_tree: invalid node");
+    if(nd.is_leaf()){
+      if(level[i] > depth)
+        depth = level[i];
+      continue;
+    }
 
-    return out;
+    if(nd.left <= i or nd.right() >= n_nodes)
+      throw std::invalid_argument("KD_tree: invalid children");
+    const node &left = nodes[nd.left], &right = nodes[nd.right()];
+    if(left.start != nd.start or left.end != right.start or
+         right.end != nd.end)
+      throw std::invalid_argument("KD_tree: invalid children");
+    level[nd.left] = level[nd.right()] = level[i] + 1L;
   }
 
-const std::vector<arma::uword>& KD_note::get_indices() const {
-#ifdef MSSM_DEBUG
-  if(!is_leaf())
-    throw domain_error("'get_indices' called on non-leaf");
-#endif
-  return *idx;
+  set_borders(X);
 }
 
-std::vector<arma::uword> KD_note::get_indices_parent(){
-  if(is_leaf())
-    return get_indices();
-
-  std::vector<arma::uword> out(left->n_elem + right->n_elem);
-  get_indices_parent(out.data());
-
-  return out;
-}
+void KD_tree::set_borders(const arma::mat &X){
+  /* the children are after their parent */
+  const arma::uword n_nodes = nodes.size();
+  lower.resize(dim * n_nodes);
+  upper.resize(dim * n_nodes);
+  for(arma::uword i = n_nodes; i-- > 0;){
+    double * const lo = lower.data() + i * dim,
+           * const up = upper.data() + i * dim;
+    const node &nd = nodes[i];
+
+    if(nd.is_leaf()){
+      std::fill(lo, lo + dim, std::numeric_limits<double>::max());
+      std::fill(up, up + dim, std::numeric_limits<double>::lowest());
+      for(arma::uword j = nd.start; j < nd.end; ++j){
+        const double *x = X.colptr(indices[j]);
+        for(arma::uword k = 0; k < dim; ++k){
+          if(x[k] < lo[k])
+            lo[k] = x[k];
+          if(x[k] > up[k])
+            up[k] = x[k];
+        }
+      }
+      continue;
+    }
 
-void KD_note::get_indices_parent(arma::uword *out){
-  if(is_leaf()){
-    memcpy(out, idx->data(), sizeof(arma::uword) * idx->size());
-    return;
+    const double *lo_l = lower.data() + nd.left * dim, *lo_r = lo_l + dim,
+                 *up_l = upper.data() + nd.left * dim, *up_r = up_l + dim;
+    for(arma::uword k = 0; k < dim; ++k){
+      lo[k] = std::min(lo_l[k], lo_r[k]);
+      up[k] = std::max(up_l[k], up_r[k]);
+    }
   }
 
-  left ->get_indices_parent(out);
-  right->get_indices_parent(out + left->n_elem);
-}
-
-std::vector<const KD_note*> KD_note::get_leafs() const {
-  if(is_leaf())
-    return { this };
+  if(!use_balls)
+    return;
 
-  auto out  = left->get_leafs();
-  auto leafs_right = right->get_leafs();
-  out.reserve(out.size() + leafs_right.size());
-  for(auto lr : leafs_right)
-    out.push_back(lr);
+  /* the centers are the means of the points and the radii are the largest
+   * distances from the centers to a point */
+  centers.resize(dim * n_nodes);
+  radii.resize(n_nodes);
+  for(arma::uword i = 0; i < n_nodes; ++i){
+    const node &nd = nodes[i];
+    double * const ce = centers.data() + i * dim;
+    std::fill(ce, ce + dim, 0.);
+    radii[i] = 0.;
+    if(nd.n_elem() < 1L)
+      continue;
+
+    for(arma::uword j = nd.start; j < nd.end; ++j){
+      const double *x = X.colptr(indices[j]);
+      for(arma::uword k = 0; k < dim; ++k)
+        ce[k] += x[k];
+    }
+    for(arma::uword k = 0; k < dim; ++k)
+      ce[k] /= nd.n_elem();
 
-  return out;
+    double r = 0.;
+    for(arma::uword j = nd.start; j < nd.end; ++j)
+      r = std::max(r, square_dist(X.colptr(indices[j]), ce, dim));
+    radii[i] = std::sqrt(r);
+  }
 }
 
-const KD_note& KD_note::get_left() const {
+std::array<double, 2> KD_tree::min_max_dist
+  (const arma::uword i, const KD_tree &other, const arma::uword j) const {
 #ifdef MSSM_DEBUG
-  if(!left)
-    throw domain_error("get_*_node called on leaf note");
+  if(dim != other.dim)
+    throw std::invalid_argument("dimension do not match");
 #endif
+  std::array<double, 2> out = get_borders(i).min_max_dist(
+    other.get_borders(j));
+  if(!use_balls or !other.use_balls)
+    return out;
 
-  return *left;
-}
-
-const KD_note& KD_note::get_right() const {
-#ifdef MSSM_DEBUG
-  if(!right)
-    throw domain_error("get_*_node called on leaf note");
-#endif
+  /* use the bounds from the balls if they are tighter */
+  const double d = std::sqrt(square_dist(
+    get_ball_center(i), other.get_ball_center(j), dim)),
+    r = radii[i] + other.radii[j], d_min = std::max(d - r, 0.),
+    d_max = d + r;
+  out[0L] = std::max(out[0L], d_min * d_min);
+  out[1L] = std::min(out[1L], d_max * d_max);
 
-  return *right;
+  return out;
 }
 
-void KD_note::set_indices(arma::uvec &new_idx) {
-#ifdef MSSM_DEBUG
-  if(new_idx.n_elem != n_elem)
-    throw invalid_argument("indices length do not match with node size");
-#endif
-
-  if(is_leaf()){
-    const arma::uword *i = new_idx.begin();
-    for(auto &k : *idx)
-      k = *(i++);
-
-    return;
-  }
-
-  const arma::uword n_left = left->n_elem;
-  arma::uvec left_idx (new_idx.begin()         , n_left       , false);
-  arma::uvec right_idx(new_idx.begin() + n_left, right->n_elem, false);
-
-  left ->set_indices(left_idx);
-  right->set_indices(right_idx);
+KD_tree_topology KD_tree::get_topology() const {
+  return { nodes, indices };
 }
 
-hyper_rectangle::hyper_rectangle(const arma::mat &X, const arma::uvec &idx)
-{
-  const arma::uword N = X.n_rows;
-  borders.set_size(2L, N);
-  borders.row(0L).fill(std::numeric_limits<double>::max());
-  borders.row(1L).fill(std::numeric_limits<double>::lowest());
-
-  for(auto i : idx){
-    const double *x = X.colptr(i);
-    for(unsigned int j = 0; j < N; ++j, ++x){
-      if(*x < borders(0L, j))
-        borders(0L, j) = *x;
-      if(*x >= borders(1L, j))
-        borders(1L, j) = *x;
+std::vector<arma::uword> KD_tree::get_leafs() const {
+  std::vector<arma::uword> out, tasks = { 0L };
+  while(!tasks.empty()){
+    const arma::uword i = tasks.back();
+    tasks.pop_back();
+    const node &nd = nodes[i];
+    if(nd.is_leaf()){
+      out.push_back(i);
+      continue;
     }
-  }
-}
-
 
+    tasks.push_back(nd.right());
+    tasks.push_back(nd.left);
+  }
 
-hyper_rectangle::hyper_rectangle
-  (const hyper_rectangle &r1, const hyper_rectangle &r2)
-{
-#ifdef MSSM_DEBUG
-  if(r1.borders.n_rows != r2.borders.n_rows or
-       r1.borders.n_cols != r2.borders.n_cols)
-    throw invalid_argument("dimension do not match");
-#endif
-  const arma::uword N = r1.borders.n_cols;
-  borders.set_size(2L, N);
-
-  double *b = borders.begin();
-  const double *x1 = r1.borders.begin(), *x2 = r2.borders.begin();
-  for(unsigned int i = 0; i < 2L * N; ++i, ++b, ++x1, ++x2)
-    if(i % 2L == 0L)
-      *b = std::min(*x1, *x2);
-    else
-      *b = std::max(*x1, *x2);
+  return out;
 }
 
 std::array<double, 2> hyper_rectangle::min_max_dist
   (const hyper_rectangle &other) const
 {
 #ifdef MSSM_DEBUG
-  if(this->borders.n_rows != other.borders.n_rows or
-       this->borders.n_cols != other.borders.n_cols)
-    throw invalid_argument("dimension do not match");
+  if(dim != other.dim)
+    throw std::invalid_argument("dimension do not match");
 #endif
   std::array<double, 2> out = { 0L, 0L};
   double &dmin = out[0L], &dmax = out[1L];
 
-  const arma::mat &oborders = other.borders;
-  const arma::uword N = this->borders.n_cols;
-  for(unsigned int i = 0; i < N; ++i){
+  for(arma::uword i = 0; i < dim; ++i){
     /* min - max */
-    dmin += std::pow(std::max(std::max(
-      borders(0L, i) - oborders(1L, i),
-      oborders(0L, i) -  borders(1L, i)), 0.), 2L);
+    const double d_lb = std::max(std::max(
+      lower[i] - other.upper[i], other.lower[i] - upper[i]), 0.);
+    dmin += d_lb * d_lb;
     /* max - min */
-    dmax += std::pow(std::max(
-      borders(1L, i) - oborders(0L, i),
-      oborders(1L, i) -  borders(0L, i)), 2L);
+    const double d_ub = std::max(
+      upper[i] - other.lower[i], other.upper[i] - lower[i]);
+    dmax += d_ub * d_ub;
   }
 
   return out;
@@ -345,13 +411,11 @@ inline double round_to_digits(const double value, const unsigned int digits)
 
 std::ostream& operator<<(std::ostream &os, const hyper_rectangle &rect){
   constexpr unsigned int n_d = 3L;
-  const double *d = rect.borders.begin();
-  for(unsigned int i = 0; i < rect.borders.n_cols; ++i){
+  for(unsigned int i = 0; i < rect.dim; ++i){
     if(i > 0L)
       os << " x ";
-    double x1 = *(d++), x2 = *(d++);
-    os << '[' << round_to_digits(x1, n_d) << ", " <<
-      round_to_digits(x2, n_d) << ']';
+    os << '[' << round_to_digits(rect.lower[i], n_d) << ", " <<
+      round_to_digits(rect.upper[i], n_d) << ']';
 
   }
   os << '\n';
@@ -359,27 +423,3 @@ std::ostream& operator<<(std::ostream &os, const hyper_rectangle &rect){
   return os;
 }
 #endif
-
-void hyper_rectangle::shrink
-  (const arma::mat &X, const std::vector<arma::uword> &idx,
-   const arma::uword dim)
-  {
-#ifdef MSSM_DEBUG
-    if(idx.size() < 1L)
-      throw std::logic_error("'shrink' called with no elements");
-#endif
-    double &lower = borders(0L, dim) , &upper = borders(1L, dim);
-    auto i = idx.begin();
-    {
-      /* set to first point */
-      lower = upper = X(dim, *(i++));
-    }
-    auto end = idx.end();
-    for(; i != end; ++i){
-      double x = X(dim, *i);
-      if(x > upper)
-        upper = x;
-      else if(x < lower)
-        lower = x;
-    }
-  }
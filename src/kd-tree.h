@@ -3,118 +3,147 @@
 #include "arma.h"
 #include "thread_pool.h"
 #include <array>
+#include <vector>
 
 #ifdef MSSM_DEBUG
 #include <iostream>
 #endif
 
+/* view of a hyper rectangle given pointers to the lower and upper borders in
+ * each dimension. The memory is not owned by the object */
 class hyper_rectangle {
-  /* with borders for the hyper rectangle. Dims are 2 x [dim] */
-  arma::mat borders;
+  const double *lower, *upper;
+  arma::uword dim;
 public:
-  hyper_rectangle(const arma::mat&, const arma::uvec&);
-  hyper_rectangle(const hyper_rectangle&, const hyper_rectangle&);
+  hyper_rectangle(const double *lower, const double *upper,
+                  const arma::uword dim):
+    lower(lower), upper(upper), dim(dim) { }
 
   /* first element is min and second element is max */
   std::array<double, 2> min_max_dist(const hyper_rectangle&) const;
 
-  const arma::mat& get_borders() const {
-    return borders;
-  };
-
-  void shrink(
-      const arma::mat&, const std::vector<arma::uword>&, const arma::uword);
+  const double* get_lower() const {
+    return lower;
+  }
+  const double* get_upper() const {
+    return upper;
+  }
+  arma::uword get_dim() const {
+    return dim;
+  }
 
 #ifdef MSSM_DEBUG
   friend std::ostream& operator<<(std::ostream&, const hyper_rectangle&);
 #endif
 };
 
-class row_order;
-
-class KD_note {
-  using idx_ptr = std::unique_ptr<std::vector<arma::uword> >;
-  std::unique_ptr<std::vector<arma::uword> > idx;
-  std::unique_ptr<KD_note> left;
-  std::unique_ptr<KD_note> right;
-  arma::uword depth;
+struct KD_tree_topology;
+
+/* k-d tree which is stored as a flat array of nodes in breadth-first order.
+ * The two children of a node are next to each other and are stored after
+ * their parent. Each node refers to a range [start, end) in a single vector
+ * of indices which is partitioned in place while the tree is build. Thus,
+ * the points in each node are contiguous if the data is permuted with the
+ * indices.
+ * The tree is a ball tree if use_balls is true. The nodes are then split at
+ * the median of the projections onto the line between two points which are
+ * far apart rather than in one dimension, and each node also has a bounding
+ * ball. The bounds on the distances between two nodes are then the tightest
+ * of the bounds from the balls and the rectangles. This yields tighter
+ * bounds in higher dimensions where the rectangles are large */
+class KD_tree {
 public:
-  const arma::uword n_elem;
-  bool is_leaf() const {
-    return !(left or right);
+  struct node {
+    arma::uword start, end;
+    /* index of the left child. The right child is the next node. It is
+     * zero for leafs */
+    arma::uword left;
+
+    bool is_leaf() const {
+      return left == 0L;
+    }
+    arma::uword right() const {
+      return left + 1L;
+    }
+    arma::uword n_elem() const {
+      return end - start;
+    }
   };
-  const std::vector<arma::uword> &get_indices() const;
-  std::vector<arma::uword> get_indices_parent();
-  void set_indices(arma::uvec&);
-  std::vector<const KD_note*> get_leafs() const;
-  const KD_note& get_left () const;
-  const KD_note& get_right() const;
-  /* assumes 'set_depth' has been called */
-  arma::uword get_depth() const {
-    return depth;
-  }
 
-  /* return the start index and end index. Only valid if data is sorted by
-   * using the 'get_indices_parent' and 'set_indices' member functions */
-  arma::uword get_start() const {
-    if(is_leaf())
-      return idx->front();
+  const arma::uword dim;
+  const bool use_balls;
 
-    return left->get_start();
-  }
-  arma::uword get_end() const {
-    if(is_leaf())
-      return idx->back() + 1L;
+  KD_tree(const arma::mat&, const arma::uword, thread_pool&,
+          const bool use_balls = false);
+  /* creates a tree with the given nodes and indices. Only the borders are
+   * computed from the points. This is useful if the points are transformed
+   * as the tree does not need to be build again */
+  KD_tree(const KD_tree_topology&, const arma::mat&,
+          const bool use_balls = false);
 
-    return right->get_end();
+  arma::uword n_nodes() const {
+    return nodes.size();
   }
-
-  KD_note(KD_note&&) = default;
-
-  friend KD_note get_KD_tree(
-      const arma::mat&, const arma::uword, thread_pool&);
+  const node& get_node(const arma::uword i) const {
+    return nodes[i];
+  }
+  /* the indices of the points in the i'th node are elements start to
+   * end - 1 of the returned vector */
+  const std::vector<arma::uword>& get_indices() const {
+    return indices;
+  }
+  /* returns the smallest hyper rectangle which contains the points in the
+   * i'th node */
+  hyper_rectangle get_borders(const arma::uword i) const {
+    return { lower.data() + i * dim, upper.data() + i * dim, dim };
+  }
+  /* returns the center and radius of the bounding ball of the i'th node.
+   * Only valid if use_balls is true */
+  const double* get_ball_center(const arma::uword i) const {
+    return centers.data() + i * dim;
+  }
+  double get_ball_radius(const arma::uword i) const {
+    return radii[i];
+  }
+  /* returns the smallest and largest squared distance between the points in
+   * the i'th node and the points in the j'th node of another tree */
+  std::array<double, 2> min_max_dist
+    (const arma::uword i, const KD_tree &other, const arma::uword j) const;
+  /* returns the number of levels of the tree */
+  arma::uword get_depth() const {
+    return depth;
+  }
+  /* returns the indices of the leafs from left to right */
+  std::vector<arma::uword> get_leafs() const;
+  /* returns a copy of the nodes and the indices */
+  KD_tree_topology get_topology() const;
 
 private:
-  KD_note(const arma::mat&, const arma::uword, idx_ptr&&, row_order*,
-          const arma::uword, const hyper_rectangle*,
-          thread_pool&, std::vector<std::future<void> >&, std::mutex&);
-
-  void get_indices_parent(arma::uword*);
-
-  /* util class used in constructor */
-  struct set_child {
-    std::unique_ptr<KD_note> &ptr;
-    idx_ptr indices;
-    hyper_rectangle child_rect;
-    const arma::mat &X;
-    const arma::uword N_min;
-    row_order *order;
-    const arma::uword depth;
-    thread_pool &pool;
-    std::vector<std::future<void> > &futures;
-    std::mutex &lc;
-
-    void operator()()
-    {
-      ptr.reset(new KD_note(
-          X, N_min, std::move(indices), order, depth + 1L, &child_rect,
-          pool, futures, lc));
-    }
-  };
-
-  void set_depth() {
-    if(is_leaf()){
-      depth = 1L;
-      return;
-    }
+  std::vector<node> nodes;
+  std::vector<arma::uword> indices;
+  /* [dim] x [number of nodes] borders of the nodes */
+  std::vector<double> lower, upper;
+  /* [dim] x [number of nodes] centers and the radii of the bounding balls.
+   * Empty unless use_balls is true */
+  std::vector<double> centers, radii;
+  arma::uword depth = 1L;
+
+  /* sets the borders and the bounding balls of the nodes given the
+   * points */
+  void set_borders(const arma::mat&);
+};
 
-    left ->set_depth();
-    right->set_depth();
+/* nodes and indices of a k-d tree */
+struct KD_tree_topology {
+  std::vector<KD_tree::node> nodes;
+  std::vector<arma::uword> indices;
 
-    depth = std::max(left->depth, right->depth) + 1L;
+  bool empty() const {
+    return nodes.empty();
   }
 };
 
-KD_note get_KD_tree(const arma::mat&, const arma::uword, thread_pool&);
+KD_tree get_KD_tree(const arma::mat&, const arma::uword, thread_pool&,
+                    const bool use_balls = false);
 
 #endif
@@ -0,0 +1,89 @@
+#include "kernel-gemm.h"
+#include "utils.h"
+#include <vector>
+
+namespace {
+/* number of columns in each tile. A 256 x 128 tile of doubles takes 256 KB */
+constexpr std::size_t tile_y = 128L, tile_x = 256L;
+
+struct gemm_task {
+  const arma::mat &X;
+  const arma::vec &ws_log;
+  const arma::mat &Y;
+  const trans_obj &kernel;
+  arma::vec &out;
+  const arma::uword start, end;
+
+  void operator()() const {
+    const arma::uword n_y = end - start, n_x = X.n_cols;
+    loop_nest_util<tile_y, tile_x> loop_util(n_y, n_x);
+
+    /* running log-sum-exp for each of the y_j's */
+    std::vector<lse::accumulator> acc(n_y);
+
+    arma::mat D, X_tile, Y_tile;
+    arma::vec center, X_norm, Y_norm;
+    for(unsigned int k = 0; k < loop_util.N_it; ++k){
+      auto dat = loop_util();
+      const arma::uword
+        y_start = start + dat.outer_start, y_end = start + dat.outer_end,
+        x_start = dat.inner_start        , x_end = dat.inner_end,
+        n_x_tile = x_end - x_start;
+
+      /* subtract the mean of the source particles in the tile to reduce the
+       * rounding errors when the particles are far from the origin */
+      X_tile = X.cols(x_start, x_end - 1L);
+      Y_tile = Y.cols(y_start, y_end - 1L);
+      center = arma::mean(X_tile, 1L);
+      X_tile.each_col() -= center;
+      Y_tile.each_col() -= center;
+      X_norm = arma::sum(arma::square(X_tile), 0L).t();
+      Y_norm = arma::sum(arma::square(Y_tile), 0L).t();
+
+      D = X_tile.t() * Y_tile;
+
+      for(arma::uword j = 0; j < D.n_cols; ++j){
+        double *d = D.colptr(j);
+        const double y_n = Y_norm[j], *x_n = X_norm.begin();
+        for(arma::uword i = 0; i < n_x_tile; ++i){
+          const double dist = x_n[i] + y_n - 2. * d[i];
+          /* may be negative due to rounding errors */
+          d[i] = dist > 0. ? dist : 0.;
+        }
+
+        kernel.log_kernel_dist(d, n_x_tile);
+
+        const double *w = ws_log.begin() + x_start;
+        for(arma::uword i = 0; i < n_x_tile; ++i)
+          d[i] += w[i];
+
+        acc[y_start - start + j].add(d, n_x_tile);
+      }
+    }
+
+    for(arma::uword j = 0; j < n_y; ++j)
+      out[start + j] = acc[j].get();
+  }
+};
+} // namespace
+
+void log_kernel_sum_gemm
+  (const arma::mat &X, const arma::vec &ws_log, const arma::mat &Y,
+   arma::vec &out, const trans_obj &kernel, thread_pool &pool){
+  if(X.n_rows != Y.n_rows or ws_log.n_elem != X.n_cols or
+       out.n_elem != Y.n_cols)
+    throw std::invalid_argument("log_kernel_sum_gemm: invalid arguments");
+
+  const arma::uword n_y = Y.n_cols;
+  auto loop_figs = get_inc_n_block(n_y, pool);
+  task_group tasks(pool);
+
+  for(arma::uword start = 0L; start < n_y;){
+    arma::uword end = std::min(start + loop_figs.inc, n_y);
+    gemm_task task { X, ws_log, Y, kernel, out, start, end };
+    tasks.run(std::move(task));
+    start = end;
+  }
+
+  tasks.wait();
+}
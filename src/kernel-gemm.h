@@ -0,0 +1,22 @@
+#ifndef KERNEL_GEMM_H
+#define KERNEL_GEMM_H
+#include "arma.h"
+#include "dists.h"
+#include "thread_pool.h"
+
+/* computes
+ *   log(sum_i exp(k(x_i, y_j) + w_i))
+ * for each column y_j in the third argument where x_i is the i'th column of
+ * the first argument, w_i is the i'th element of the second argument, and k
+ * is the log kernel. The result is written to the fourth argument which
+ * must have the same number of elements as the third argument has columns.
+ *
+ * The squared distances are computed in tiles as ||x||^2 + ||y||^2 - 2x^Ty
+ * with matrix products after subtracting the mean of the x_i's in the tile.
+ * The particles must have been transformed such that the kernel only depends
+ * on the squared distance */
+void log_kernel_sum_gemm
+  (const arma::mat&, const arma::vec&, const arma::mat&, arma::vec&,
+   const trans_obj&, thread_pool&);
+
+#endif
@@ -67,7 +67,7 @@ namespace {
       F_size = arma::size(data.get_F());
     const bool has_disp = data.get_disp().n_elem > 0;
     const unsigned state_dim = data.get_sta_dist<cdist>(0L)->state_dim(),
-      n_periods = data.n_periods,
+      n_periods = data.n_periods(),
       cfix_dim = data.get_cfix().n_elem,
       Q_dim = (Q_size.n_cols * (Q_size.n_cols + 1L)) / 2L,
       outer_dim = Q_dim + F_size.n_cols * F_size.n_rows + has_disp,
@@ -83,8 +83,8 @@ namespace {
     /* contains objects to evaluate conditional densities */
     const std::vector<std::unique_ptr<cdist> > obs_dists = ([&]{
       std::vector<std::unique_ptr<cdist> > out;
-      out.reserve(data.n_periods);
-      for(unsigned i = 0; i < data.n_periods; ++i)
+      out.reserve(data.n_periods());
+      for(unsigned i = 0; i < data.n_periods(); ++i)
         out.push_back(data.get_obs_dist(i));
 
       return out;
@@ -92,7 +92,7 @@ namespace {
 
     /* matrix that contains random effect modes */
     arma::mat random_effects =
-      arma::mat(state_dim, data.n_periods, arma::fill::zeros);
+      arma::mat(state_dim, data.n_periods(), arma::fill::zeros);
 
     /* pointer to concentraiton matrix */
     std::unique_ptr<sym_band_mat> concentration_mat;
@@ -530,7 +530,7 @@ namespace {
 
       /* set concentration matrix */
       concentration_mat.reset(new sym_band_mat(get_concentration(
-        data.get_F(), data.get_Q(), data.get_Q0(), data.n_periods)));
+        data.get_F(), data.get_Q(), data.get_Q0(), data.n_periods())));
 
       /* make log-likelihood approximation. First, find the mode */
       const unsigned n_inner = random_effects.n_elem + cfix_dim;
@@ -0,0 +1,160 @@
+#ifndef LOG_SUM_EXP_H
+#define LOG_SUM_EXP_H
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+/* exp and log functions which are written such that loops with them can be
+ * vectorized by the compiler and log-sum-exp functions using them */
+namespace lse {
+constexpr double ln2_hi = 6.93147180369123816490e-01,
+                 ln2_lo = 1.90821492927058770002e-10,
+                 log2e  = 1.44269504088896338700e+00,
+                 /* 1.5 * 2^52. Adding it rounds to the nearest integer */
+                 round_magic = 6755399441055744.;
+
+/* exp function with a relative error below 1e-15. Values below exp(-708)
+ * are flushed to zero and values above the largest double yield
+ * infinity */
+inline double exp_fast(const double x){
+  constexpr double lb = -708., ub = 709.78;
+  const double xc = x < lb ? lb : (x > ub ? ub : x);
+
+  /* range reduction such that x = k log(2) + r with |r| <= log(2) / 2 */
+  const double t = xc * log2e + round_magic, k = t - round_magic,
+    r = xc - k * ln2_hi - k * ln2_lo;
+
+  /* Taylor series for exp(r) */
+  double p = 1. / 479001600.;
+  p = p * r + 1. / 39916800.;
+  p = p * r + 1. / 3628800.;
+  p = p * r + 1. / 362880.;
+  p = p * r + 1. / 40320.;
+  p = p * r + 1. / 5040.;
+  p = p * r + 1. / 720.;
+  p = p * r + 1. / 120.;
+  p = p * r + 1. / 24.;
+  p = p * r + 1. / 6.;
+  p = p * r + .5;
+  p = p * r + 1.;
+  p = p * r + 1.;
+
+  /* the lower bits of t contain k. Form 2^(k - 1) as k may be 1024 */
+  std::uint64_t bits;
+  std::memcpy(&bits, &t, sizeof(bits));
+  bits = (bits + 1022L) << 52;
+  double two_k;
+  std::memcpy(&two_k, &bits, sizeof(two_k));
+
+  const double out = (p * two_k) * 2.;
+  return x < lb ? 0. :
+    (x > ub ? std::numeric_limits<double>::infinity() : out);
+}
+
+/* log function with an absolute error below 1e-15 for positive normal
+ * numbers. Zero yields minus infinity */
+inline double log_fast(const double x){
+  /* write x = m 2^e with m in [sqrt(1/2), sqrt(2)) */
+  std::uint64_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  double e = (double)((std::int64_t)((bits >> 52) & 0x7ffL) - 1023L);
+  bits = (bits & 0x000fffffffffffffL) | 0x3ff0000000000000L;
+  double m;
+  std::memcpy(&m, &bits, sizeof(m));
+  const bool is_large = m > 1.4142135623730951;
+  m = is_large ? m * .5 : m;
+  e = is_large ? e + 1. : e;
+
+  /* log(m) = 2 atanh(s) with s = (m - 1) / (m + 1) */
+  const double s = (m - 1.) / (m + 1.), s2 = s * s;
+  double p = 1. / 21.;
+  p = p * s2 + 1. / 19.;
+  p = p * s2 + 1. / 17.;
+  p = p * s2 + 1. / 15.;
+  p = p * s2 + 1. / 13.;
+  p = p * s2 + 1. / 11.;
+  p = p * s2 + 1. / 9.;
+  p = p * s2 + 1. / 7.;
+  p = p * s2 + 1. / 5.;
+  p = p * s2 + 1. / 3.;
+  p = p * s2 + 1.;
+
+  const double out = e * ln2_hi + (2. * s * p + e * ln2_lo);
+  if(!(x > 0.))
+    return x == 0. ? -std::numeric_limits<double>::infinity() :
+      std::numeric_limits<double>::quiet_NaN();
+  return x < std::numeric_limits<double>::infinity() ? out : x;
+}
+
+/* computes log(exp(a[i]) + exp(b[i])) and stores the result in a[i] */
+inline void log_sum_log_block
+  (double *a, const double *b, const std::size_t n){
+  constexpr double neg_inf = -std::numeric_limits<double>::infinity();
+  for(std::size_t i = 0; i < n; ++i){
+    const double ma = std::max(a[i], b[i]), mi = std::min(a[i], b[i]);
+    const double res = ma + log_fast(1. + exp_fast(mi - ma));
+    a[i] = mi == neg_inf ? ma : res;
+  }
+}
+
+/* returns log(sum(exp(x[i] - max_x))) + max_x */
+inline double log_sum_exp
+  (const double *x, const std::size_t n, const double max_x){
+  double norm_constant = 0.;
+  for(std::size_t i = 0; i < n; ++i)
+    norm_constant += exp_fast(x[i] - max_x);
+
+  return std::log(norm_constant) + max_x;
+}
+
+/* single pass log-sum-exp accumulator which keeps a running maximum */
+class accumulator {
+  double max_x = -std::numeric_limits<double>::infinity(), sum = 0.;
+
+public:
+  void add(const double x){
+    if(x > max_x){
+      sum = sum * exp_fast(max_x - x) + 1.;
+      max_x = x;
+    } else if(x > -std::numeric_limits<double>::infinity())
+      sum += exp_fast(x - max_x);
+  }
+
+  /* adds a block of values. The block maximum is found first so the
+   * second loop can be vectorized */
+  void add(const double *x, const std::size_t n){
+    double block_max = -std::numeric_limits<double>::infinity();
+    for(std::size_t i = 0; i < n; ++i)
+      block_max = std::max(block_max, x[i]);
+    if(!(block_max > -std::numeric_limits<double>::infinity()))
+      return;
+
+    if(block_max > max_x){
+      sum *= exp_fast(max_x - block_max);
+      max_x = block_max;
+    }
+
+    double block_sum = 0.;
+    for(std::size_t i = 0; i < n; ++i)
+      block_sum += exp_fast(x[i] - max_x);
+    sum += block_sum;
+  }
+
+  void merge(const accumulator &other){
+    if(other.max_x > max_x){
+      sum = sum * exp_fast(max_x - other.max_x) + other.sum;
+      max_x = other.max_x;
+    } else if(other.max_x > -std::numeric_limits<double>::infinity())
+      sum += other.sum * exp_fast(other.max_x - max_x);
+  }
+
+  /* returns log(sum(exp(x))) of the added values */
+  double get() const {
+    return std::log(sum) + max_x;
+  }
+};
+} // namespace lse
+
+#endif
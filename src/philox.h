@@ -0,0 +1,126 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+#include <array>
+#include <cstdint>
+#include <cmath>
+
+/* Philox4x32-10 counter-based random number generator from
+
+  Salmon, J. K., Moraes, M. A., Dror, R. O., & Shaw, D. E. (2011). Parallel
+  random numbers: as easy as 1, 2, 3. In Proceedings of 2011 International
+  Conference for High Performance Computing, Networking, Storage and
+  Analysis (p. 16). ACM.
+
+ The output only depends on the key and the counter so independent streams
+ can be used in parallel in any order */
+namespace philox {
+using ctr_type = std::array<std::uint32_t, 4>;
+using key_type = std::array<std::uint32_t, 2>;
+
+constexpr std::uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57,
+                        W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+
+inline void mulhilo
+  (const std::uint32_t a, const std::uint32_t b, std::uint32_t &hi,
+   std::uint32_t &lo){
+  const std::uint64_t prod = (std::uint64_t)a * (std::uint64_t)b;
+  hi = (std::uint32_t)(prod >> 32);
+  lo = (std::uint32_t)prod;
+}
+
+inline ctr_type get(ctr_type ctr, key_type key){
+  for(unsigned r = 0; r < 10L; ++r){
+    if(r > 0L){
+      key[0L] += W0;
+      key[1L] += W1;
+    }
+
+    std::uint32_t hi0, lo0, hi1, lo1;
+    mulhilo(M0, ctr[0L], hi0, lo0);
+    mulhilo(M1, ctr[2L], hi1, lo1);
+    ctr = { hi1 ^ ctr[1L] ^ key[0L], lo1, hi0 ^ ctr[3L] ^ key[1L], lo0 };
+  }
+
+  return ctr;
+}
+
+/* stream of random numbers given a key and the first two words of the
+ * counter. The last two words of the counter are incremented */
+class stream {
+  const key_type key;
+  ctr_type ctr, buf;
+  unsigned idx = 4L;
+  bool has_norm = false;
+  double norm_cache;
+
+  std::uint32_t next_u32(){
+    if(idx > 3L){
+      buf = get(ctr, key);
+      if(++ctr[2L] == 0L)
+        ++ctr[3L];
+      idx = 0L;
+    }
+    return buf[idx++];
+  }
+
+public:
+  stream(const key_type &key, const std::uint32_t c0,
+         const std::uint32_t c1 = 0L):
+  key(key), ctr({ c0, c1, 0L, 0L }) { }
+
+  /* uniform variable on the open unit interval */
+  double unif(){
+    /* use 53 bits */
+    const double hi = next_u32() >> 5, lo = next_u32() >> 6;
+    return (hi * 67108864. + lo + .5) / 9007199254740992.;
+  }
+
+  /* standard normal variable using the Box-Muller method */
+  double norm(){
+    if(has_norm){
+      has_norm = false;
+      return norm_cache;
+    }
+
+    const double r = std::sqrt(-2. * std::log(unif())),
+      theta = 6.283185307179586 * unif();
+    norm_cache = r * std::sin(theta);
+    has_norm = true;
+    return r * std::cos(theta);
+  }
+
+  /* gamma variable with unit scale using the method from
+
+    Marsaglia, G., & Tsang, W. W. (2000). A simple method for generating
+    gamma variables. ACM Transactions on Mathematical Software, 26(3),
+    363-372.
+   */
+  double gamma(const double shape){
+    if(shape < 1.)
+      return gamma(shape + 1.) * std::pow(unif(), 1. / shape);
+
+    const double d = shape - 1. / 3., c = 1. / std::sqrt(9. * d);
+    for(;;){
+      double x, v;
+      do {
+        x = norm();
+        v = 1. + c * x;
+      } while(v <= 0.);
+      v = v * v * v;
+
+      const double u = unif(), x_sq = x * x;
+      if(u < 1. - .0331 * x_sq * x_sq)
+        return d * v;
+      if(std::log(u) < .5 * x_sq + d * (1. - v + std::log(v)))
+        return d * v;
+    }
+  }
+
+  /* chi-squared variable */
+  double chisq(const double df){
+    return 2. * gamma(df * .5);
+  }
+};
+} // namespace philox
+
+#endif
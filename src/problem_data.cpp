@@ -15,26 +15,95 @@ control_obj::control_obj
   (const arma::uword n_threads, const double nu, const double covar_fac,
    const double ftol_rel, const arma::uword N_part, const std::string &what,
    const unsigned int trace, const arma::uword KD_N_min,
-   const double aprx_eps, const bool use_antithetic):
-  pool(new thread_pool(std::max(n_threads, (unsigned int)1L))), nu(nu),
+   const double aprx_eps, const bool use_antithetic, const double ess_target,
+   const arma::uword N_part_min, const arma::uword N_part_max,
+   const bool use_philox, const bool use_float, const arma::uvec &stat_idx,
+   const arma::uword KD_hermite_order, const double KD_ll_err_target,
+   const bool KD_keep_trees, const bool KD_deterministic,
+   const bool KD_use_balls, const bool KD_aprx_err):
+  pool(new thread_pool(std::max(n_threads, (unsigned int)1L))),
+  clouds(new cloud_pool()), nu(nu),
   covar_fac(covar_fac), ftol_rel(ftol_rel), N_part(N_part),
+  ess_target(ess_target), N_part_min(N_part_min), N_part_max(N_part_max),
   what_stat(set_what_compute(what)), trace(trace), KD_N_min(KD_N_min),
-  aprx_eps(aprx_eps), use_antithetic(use_antithetic) { }
+  aprx_eps(aprx_eps), use_antithetic(use_antithetic), use_philox(use_philox),
+  use_float(use_float), stat_idx(stat_idx),
+  KD_hermite_order(KD_hermite_order), KD_ll_err_target(KD_ll_err_target),
+  KD_keep_trees(KD_keep_trees), KD_deterministic(KD_deterministic),
+  KD_use_balls(KD_use_balls), KD_aprx_err(KD_aprx_err), KD_eps(aprx_eps) {
+  if(is_adaptive() and (N_part_min < 1L or N_part_max < N_part_min))
+    throw std::invalid_argument("invalid 'N_part_min' and 'N_part_max'");
+  for(arma::uword i = 1; i < stat_idx.n_elem; ++i)
+    if(stat_idx[i] <= stat_idx[i - 1L])
+      throw std::invalid_argument("'stat_idx' is not sorted or not unique");
+}
 
 thread_pool& control_obj::get_pool() const {
   return *pool;
 }
 
+cloud_pool& control_obj::get_cloud_pool() const {
+  return *clouds;
+}
+
+arma::uword control_obj::get_n_grad(const arma::uword n_full) const {
+  if(stat_idx.n_elem < 1L or what_stat == log_densty)
+    return n_full;
+  if(stat_idx.max() >= n_full)
+    throw std::invalid_argument("invalid 'stat_idx'");
+
+  return stat_idx.n_elem;
+}
+
+arma::uword control_obj::get_N_part_start() const {
+  if(!is_adaptive())
+    return N_part;
+
+  return std::min(std::max(N_part, N_part_min), N_part_max);
+}
+
+arma::uword control_obj::get_N_part_next
+  (const arma::uword N_cur, const double ess) const {
+  if(!is_adaptive())
+    return N_part;
+  if(!(ess > 0.))
+    return N_part_max;
+
+  /* assume that the ratio of the effective sample size to the number of
+   * particles does not change */
+  const double N_needed = std::ceil(ess_target * N_cur / ess);
+  if(N_needed >= N_part_max)
+    return N_part_max;
+
+  return std::max((arma::uword)N_needed, N_part_min);
+}
+
+double control_obj::get_KD_eps_next
+  (const double eps_cur, const double ll_err) const {
+  if(!is_KD_eps_adaptive())
+    return aprx_eps;
+
+  /* the eps is kept in [eps_min, eps_max] */
+  static constexpr double eps_min = 1e-10, eps_max = .5;
+  if(!(ll_err <= KD_ll_err_target))
+    return std::min(eps_cur, std::max(eps_cur / 4., eps_min));
+  if(ll_err < KD_ll_err_target / 4.)
+    return std::max(eps_cur, std::min(eps_cur * 2., eps_max));
+  return eps_cur;
+}
+
 problem_data::problem_data(
   cvec &Y, cvec &cfix, cvec &ws, cvec &offsets, cvec &disp, cmat &X, cmat &Z,
   const std::vector<arma::uvec> &time_indices,
   cmat &F, cmat &Q, cmat &Q0, const std::string &fam, cvec &mu0,
   control_obj &&ctrl):
-  Y(Y), cfix(cfix), ws(ws), offsets(offsets), disp(disp), X(X), Z(Z),
-  time_indices(time_indices), F(F), Q(Q), Q0(Q0), fam(fam),
+  cfix(cfix), disp(disp), F(F), Q(Q), Q0(Q0), mu0(mu0), fam(fam),
   /* public members */
-  mu0(mu0), n_periods(time_indices.size()), ctrl(std::move(ctrl))
+  ctrl(std::move(ctrl))
   {
+    for(auto &indices : time_indices)
+      add_obs_block(Y, ws, offsets, X, Z, indices);
+
     if(ctrl.trace > 1L)
       Rcpp::Rcout << "problem_data\n"
                   << "------------\n"
@@ -46,29 +115,79 @@ problem_data::problem_data(
                   << "cfix\n" << cfix.t();
   }
 
+void problem_data::add_obs_block
+  (cvec &Y, cvec &ws, cvec &offsets, cmat &X, cmat &Z,
+   const arma::uvec &indices){
+  if(X.n_cols != Y.n_elem or Z.n_cols != Y.n_elem or ws.n_elem != Y.n_elem or
+       offsets.n_elem != Y.n_elem)
+    throw std::invalid_argument("invalid dimensions of the observations");
+  if(X.n_rows != cfix.n_elem or Z.n_rows != F.n_cols)
+    throw std::invalid_argument("invalid design matrix");
+  if(indices.n_elem > 0L and indices.max() >= Y.n_elem)
+    throw std::invalid_argument("invalid 'indices'");
+
+  obs_block blk;
+  blk.Y       = Y      (indices);
+  blk.ws      = ws     (indices);
+  blk.offsets = offsets(indices);
+  blk.X       = X.cols (indices);
+  blk.Z       = Z.cols (indices);
+  obs_blocks.push_back(std::move(blk));
+}
+
+void problem_data::add_period
+  (cvec &Y, cvec &ws, cvec &offsets, cmat &X, cmat &Z,
+   const arma::uvec &indices){
+  add_obs_block(Y, ws, offsets, X, Z, indices);
+  if(use_obs_dist_cache)
+    obs_dist_cache.resize(n_periods());
+}
+
 std::unique_ptr<cdist> problem_data::get_obs_dist(const arma::uword ti) const {
 #ifdef MSSM_DEBUG
-  if(ti >= n_periods)
+  if(ti >= n_periods())
     throw std::invalid_argument("'ti' greater than 'n_periods'");
 #endif
 
-  const arma::uvec &indices = time_indices[ti];
-  arma::vec y = Y(indices), ws_ = ws(indices), offs = offsets(indices);
-  arma::mat x = X.cols(indices), z = Z.cols(indices);
+  const obs_block &blk = obs_blocks[ti];
 
   if(ctrl.trace > 2L){
     Rprintf("Time %5d\n", ti + 1L);
     Rcpp::Rcout << "----------\n"
-                << "Y\n" << y.t()
-                << "Weights\n" << ws_.t()
-                << "Offsets\n" << offs.t()
-                << "X\n" << x
-                << "Z\n" << z;
+                << "Y\n" << blk.Y.t()
+                << "Weights\n" << blk.ws.t()
+                << "Offsets\n" << blk.offsets.t()
+                << "X\n" << blk.X
+                << "Z\n" << blk.Z;
   }
 
   return get_family(
-    fam, std::move(y), std::move(x), cfix, std::move(z), &ws_,
-    disp, std::move(offs));
+    fam, blk.Y, blk.X, cfix, blk.Z, &blk.ws, disp, blk.offsets);
+}
+
+const cdist& problem_data::get_obs_dist
+  (const arma::uword ti, std::unique_ptr<cdist> &holder) const {
+  if(!use_obs_dist_cache){
+    holder = get_obs_dist(ti);
+    return *holder;
+  }
+
+#ifdef MSSM_DEBUG
+  if(obs_dist_cache.size() != n_periods())
+    throw std::logic_error("invalid 'obs_dist_cache'");
+#endif
+  std::unique_ptr<cdist> &ele = obs_dist_cache[ti];
+  if(!ele)
+    ele = get_obs_dist(ti);
+
+  return *ele;
+}
+
+void problem_data::set_use_obs_dist_cache(const bool use_cache){
+  use_obs_dist_cache = use_cache;
+  obs_dist_cache.clear();
+  if(use_cache)
+    obs_dist_cache.resize(n_periods());
 }
 
 template<>
@@ -1,33 +1,110 @@
 #ifndef PROBLEM_DATA_H
 #define PROBLEM_DATA_H
 #include "arma.h"
+#include <deque>
 #include "dists.h"
 #include "thread_pool.h"
+#include "cloud.h"
 
 /* util class to hold information and objects used for the computations */
 class control_obj {
   std::unique_ptr<thread_pool> pool;
+  std::unique_ptr<cloud_pool> clouds;
 public:
   /* input needed for proposal distribution */
   const double nu, covar_fac, ftol_rel;
   /* number of particles */
   const arma::uword N_part;
+  /* target effective sample size and bounds on the number of particles if
+   * the number of particles is adapted. No adaptation is done if the
+   * target is not positive */
+  const double ess_target;
+  const arma::uword N_part_min, N_part_max;
   /* what to compute */
   const comp_out what_stat;
   const unsigned int trace;
   const arma::uword KD_N_min;
   const double aprx_eps;
   const bool use_antithetic;
+  /* use a counter-based random number generator to sample the particles in
+   * parallel */
+  const bool use_philox;
+  /* use single precision for the particles in the kernel evaluations with
+   * the dual k-d tree method */
+  const bool use_float;
+  /* sorted indices of the elements of the gradient which statistics are
+   * computed for. All elements are used if it is empty */
+  const arma::uvec stat_idx;
+  /* order of the Hermite expansion to use with the dual k-d tree method.
+   * Zero yields only the centroid approximation */
+  const arma::uword KD_hermite_order;
+  /* target for the bound on the error of the log-likelihood contribution in
+   * each period due to the dual k-d tree method. The eps which is used is
+   * adapted if it is positive */
+  const double KD_ll_err_target;
+  /* keep the topologies of the k-d trees in the particle clouds with the
+   * dual k-d tree method so they can be used in the smoother */
+  const bool KD_keep_trees;
+  /* add the terms in a fixed order with the dual k-d tree method so the
+   * output does not depend on the number of threads */
+  const bool KD_deterministic;
+  /* use ball trees instead of k-d trees with the dual k-d tree method */
+  const bool KD_use_balls;
+  /* compute bounds on the errors due to the dual k-d tree method. They are
+   * also computed if the eps is adapted */
+  const bool KD_aprx_err;
 
   control_obj
     (const arma::uword, const double, const double, const double,
      const arma::uword, const std::string&, const unsigned int,
-     const arma::uword, const double, const bool);
+     const arma::uword, const double, const bool, const double = 0.,
+     const arma::uword = 0L, const arma::uword = 0L, const bool = false,
+     const bool = false, const arma::uvec& = arma::uvec(),
+     const arma::uword = 0L, const double = 0., const bool = false,
+     const bool = false, const bool = false, const bool = false);
   control_obj& operator=(const control_obj&) = delete;
   control_obj(const control_obj&) = delete;
   control_obj(control_obj&&) = default;
 
   thread_pool& get_pool() const;
+  /* memory for particle clouds */
+  cloud_pool& get_cloud_pool() const;
+
+  bool is_adaptive() const {
+    return ess_target > 0.;
+  }
+  bool is_KD_eps_adaptive() const {
+    return KD_ll_err_target > 0.;
+  }
+  bool comp_KD_err() const {
+    return KD_aprx_err or is_KD_eps_adaptive();
+  }
+  /* returns the number of elements of the gradient which statistics are
+   * computed for given the number of elements of the full gradient */
+  arma::uword get_n_grad(const arma::uword) const;
+
+  /* returns the number of particles to use at the first time point */
+  arma::uword get_N_part_start() const;
+  /* returns the number of particles to use given the present number of
+   * particles and the effective sample size */
+  arma::uword get_N_part_next(const arma::uword, const double) const;
+
+  /* returns the eps to use with the dual k-d tree method. It is aprx_eps
+   * unless the eps is adapted */
+  double get_KD_eps() const {
+    return KD_eps;
+  }
+  void set_KD_eps(const double eps) const {
+    KD_eps = eps;
+  }
+  /* returns the eps to use given the present eps and the bound on the error
+   * of the log-likelihood contribution */
+  double get_KD_eps_next(const double, const double) const;
+
+private:
+  /* the eps which is currently used. It is changed by the particle filter
+   * if the eps is adapted */
+  mutable double KD_eps;
 };
 
 class problem_data {
@@ -35,23 +112,36 @@ class problem_data {
   using cmat = const arma::mat;
 
   /* objects related to observed outcomes */
-  cvec &Y;
   arma::vec cfix;
-  cvec &ws, &offsets;
   arma::vec disp;
-  cmat &X, &Z;
-  const std::vector<arma::uvec> time_indices;
+
+  /* the observations in each period stored contiguously. These are the only
+   * copies of the observations and the conditional distributions of the
+   * observed outcomes refer to them. A deque is used as references to the
+   * elements stay valid when periods are added */
+  struct obs_block {
+    arma::vec Y, ws, offsets;
+    arma::mat X, Z;
+  };
+  std::deque<obs_block> obs_blocks;
+  /* copies the observations with the passed indices to a new block */
+  void add_obs_block
+    (cvec&, cvec&, cvec&, cmat&, cmat&, const arma::uvec&);
 
   /* objects related to state-space model */
   arma::mat F, Q, Q0;
+  arma::vec mu0;
 
   const std::string fam;
 
   /* objects related to computations */
   const std::unique_ptr<thread_pool> pool;
+
+  /* cached conditional distributions of the observed outcomes. These refer
+   * to the `cfix` and `disp` members so they stay valid after updates */
+  bool use_obs_dist_cache = false;
+  mutable std::vector<std::unique_ptr<cdist> > obs_dist_cache;
 public:
-  cvec mu0;
-  const arma::uword n_periods;
   const control_obj ctrl;
 
   problem_data(
@@ -61,9 +151,25 @@ public:
   problem_data(const problem_data&) = delete;
   problem_data& operator=(const problem_data&) = delete;
 
+  arma::uword n_periods() const {
+    return obs_blocks.size();
+  }
+
+  /* adds a period with the observations with the passed indices in the
+   * passed outcomes, weights, offsets, and design matrices. The
+   * observations are copied */
+  void add_period
+    (cvec&, cvec&, cvec&, cmat&, cmat&, const arma::uvec&);
+
   /* returns an object to compute the conditional distribution of the
    * observed outcome at a given time given a state vector */
   std::unique_ptr<cdist> get_obs_dist(const arma::uword) const;
+  /* same as above but returns a cached object if caching is enabled.
+   * Otherwise, the second argument is used to hold the new object */
+  const cdist& get_obs_dist
+    (const arma::uword, std::unique_ptr<cdist>&) const;
+  /* enable or disable caching of the above objects */
+  void set_use_obs_dist_cache(const bool);
   /* returns an object to compute the conditional distribution of the state
    * at a given time given a state vector at the previous time point */
   template<typename T>
@@ -129,6 +235,18 @@ public:
   arma::mat get_Q0() const {
     return Q0;
   }
+
+  void set_mu0(const arma::vec &mu0new){
+#ifdef MSSM_DEBUG
+    if(arma::size(mu0new) != arma::size(mu0))
+      throw std::invalid_argument("Invalid new value");
+#endif
+    mu0 = mu0new;
+  }
+
+  arma::vec get_mu0() const {
+    return mu0;
+  }
 };
 
 #endif
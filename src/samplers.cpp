@@ -1,5 +1,6 @@
 #include "samplers.h"
 #include "proposal_dist.h"
+#include <R_ext/Random.h>
 
 inline void print_before_sampling(const proposal_dist *dist){
   arma::vec mean;
@@ -29,38 +30,93 @@ inline void print_before_sampling(const proposal_dist *dist){
   }
 }
 
+/* samples the particles in parallel with a counter-based random number
+ * generator. The key is drawn with R's random number generator */
+inline void sample_philox
+  (const proposal_dist &dist, arma::mat &out, const bool use_antithetic,
+   thread_pool &pool)
+{
+  const philox::key_type key = {
+    (std::uint32_t)(unif_rand() * 4294967296.),
+    (std::uint32_t)(unif_rand() * 4294967296.) };
+
+  /* the blocks have to be aligned with the groups of four with antithetic
+   * variables */
+  const arma::uword n_cols = out.n_cols,
+    resid = use_antithetic ? n_cols % 4L : 0L;
+  const arma::uword inc = ([&]{
+    arma::uword inc = get_inc_n_block(n_cols, pool).inc;
+    if(use_antithetic and inc % 4L != 0L)
+      inc += 4L - inc % 4L;
+    return inc;
+  })();
+
+  auto task = [&](const arma::uword start, const arma::uword end){
+    if(use_antithetic)
+      dist.sample_anti(out, key, start, end);
+    else
+      dist.sample     (out, key, start, end);
+  };
+
+  task_group tasks(pool);
+  for(arma::uword start = 0L; start < n_cols;){
+    arma::uword end = std::min(start + inc, n_cols);
+    if(start == 0L and resid > 0L)
+      end = std::min(resid + inc, n_cols);
+    tasks.run(std::bind(task, start, end));
+    start = end;
+  }
+
+  tasks.wait();
+}
+
 inline particle_cloud sample_util
   (const proposal_dist &dist, const problem_data &prob,
-   const cdist &state_dist, const cdist &obs_dist)
+   const cdist &state_dist, const cdist &obs_dist, const arma::uword N_part)
 {
   const comp_out what = prob.ctrl.what_stat;
   gaurd_new_comp_out(what);
 
   const arma::uword dim_state = state_dist.state_dim(),
-    stat_dim = ([&]{
-      unsigned int out =
-        state_dist.state_stat_dim_grad(what) +
-        obs_dist  .obs_stat_dim_grad  (what);
-      if(what != Hessian)
-        return out;
-
-      out *= (1L + out);
-      return out;
-    })();
-  particle_cloud out(prob.ctrl.N_part, dim_state, stat_dim);
+    stat_dim = get_stat_dim_packed(prob.ctrl.get_n_grad(
+      state_dist.state_stat_dim_grad(what) +
+        obs_dist.obs_stat_dim_grad  (what)), what);
+  particle_cloud out =
+    prob.ctrl.get_cloud_pool().get(N_part, dim_state, stat_dim);
 
   if(prob.ctrl.trace > 1L)
     print_before_sampling(&dist);
 
-  if(prob.ctrl.use_antithetic)
+  if(prob.ctrl.use_philox)
+    sample_philox(
+      dist, out.particles, prob.ctrl.use_antithetic, prob.ctrl.get_pool());
+  else if(prob.ctrl.use_antithetic)
     dist.sample_anti(out.particles);
   else
     dist.sample     (out.particles);
 
-  double *w;
-  arma::uword i;
-  for(i = 0, w = out.ws.begin(); i < prob.ctrl.N_part; ++i, ++w)
-    *w = dist.log_prop_dens(out.particles.col(i));
+  /* compute the log density of the proposal distribution in parallel */
+  {
+    thread_pool &pool = prob.ctrl.get_pool();
+    auto loop_figs = get_inc_n_block(N_part, pool);
+    task_group tasks(pool);
+
+    arma::mat &ps = out.particles;
+    auto task = [&](const arma::uword start, const arma::uword end){
+      const arma::mat ps_i(ps.colptr(start), ps.n_rows, end - start, false,
+                           true);
+      arma::vec ws_i(out.ws.memptr() + start, end - start, false, true);
+      dist.log_prop_dens(ps_i, ws_i);
+    };
+
+    for(arma::uword start = 0L; start < N_part;){
+      arma::uword end = std::min(start + loop_figs.inc, N_part);
+      tasks.run(std::bind(task, start, end));
+      start = end;
+    }
+
+    tasks.wait();
+  }
 
   return out;
 }
@@ -68,7 +124,7 @@ inline particle_cloud sample_util
 class bootstrap_sampler final : public sampler {
   particle_cloud smp_inner
   (const problem_data &prob, const arma::uword ti, const arma::vec &old_mean,
-   const cdist &obs_dist)
+   const cdist &obs_dist, const arma::uword N_part)
   const
   {
     auto state_dist = prob.get_sta_dist<cdist>(ti);
@@ -91,21 +147,22 @@ class bootstrap_sampler final : public sampler {
           return new mv_tdist(vCov, mu, nu);
         })());
 
-    return sample_util(*sampler_, prob, *state_dist, obs_dist);
+    return sample_util(*sampler_, prob, *state_dist, obs_dist, N_part);
   }
 
 public:
   particle_cloud sample_first
-  (const problem_data &prob, const cdist &obs_dist) const override final {
-    return smp_inner(prob, 0L, prob.mu0, obs_dist);
+  (const problem_data &prob, const cdist &obs_dist, const arma::uword N_part)
+  const override final {
+    return smp_inner(prob, 0L, prob.get_mu0(), obs_dist, N_part);
   }
   particle_cloud sample
   (const problem_data &prob, const cdist &obs_dist, const particle_cloud &old_cl,
-   const arma::uword ti)
+   const arma::uword ti, const arma::uword N_part)
   const override final
   {
     arma::vec old_mean = old_cl.get_cloud_mean();
-    return smp_inner(prob, ti, old_mean, obs_dist);
+    return smp_inner(prob, ti, old_mean, obs_dist, N_part);
   }
 };
 
@@ -116,7 +173,7 @@ std::unique_ptr<sampler> get_bootstrap_sampler(){
 class mode_aprx_sampler final : public sampler {
   particle_cloud smp_inner
   (const problem_data &prob, const arma::uword ti, const arma::vec &old_mean,
-   const cdist &obs_dist)
+   const cdist &obs_dist, const arma::uword N_part)
   const
   {
     if(prob.ctrl.trace > 1L)
@@ -142,21 +199,22 @@ class mode_aprx_sampler final : public sampler {
       return std::move(out.proposal);
     })();
 
-    return sample_util(*sampler_, prob, *state_dist, obs_dist);
+    return sample_util(*sampler_, prob, *state_dist, obs_dist, N_part);
   }
 
 public:
   particle_cloud sample_first
-  (const problem_data &prob, const cdist &obs_dist) const override final {
-    return smp_inner(prob, 0L, prob.mu0, obs_dist);
+  (const problem_data &prob, const cdist &obs_dist, const arma::uword N_part)
+  const override final {
+    return smp_inner(prob, 0L, prob.get_mu0(), obs_dist, N_part);
   }
   particle_cloud sample
   (const problem_data &prob, const cdist &obs_dist, const particle_cloud &old_cl,
-   const arma::uword ti)
+   const arma::uword ti, const arma::uword N_part)
   const override final
   {
     arma::vec old_mean = old_cl.get_cloud_mean();
-    return smp_inner(prob, ti, old_mean, obs_dist);
+    return smp_inner(prob, ti, old_mean, obs_dist, N_part);
   }
 };
 
@@ -6,12 +6,12 @@
 class sampler {
 public:
   /* sample new states and sets the log weights equal to the log proposal
-   * distribution density */
+   * distribution density. The last argument is the number of particles */
   virtual particle_cloud sample_first
-  (const problem_data&, const cdist&) const = 0;
+  (const problem_data&, const cdist&, const arma::uword) const = 0;
   virtual particle_cloud sample
     (const problem_data&, const cdist&, const particle_cloud&,
-     const arma::uword) const = 0;
+     const arma::uword, const arma::uword) const = 0;
 
   virtual ~sampler() = default;
 };
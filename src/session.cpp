@@ -0,0 +1,25 @@
+#include "session.h"
+
+void pf_session::append
+  (const arma::vec &Y_new, const arma::vec &ws_new,
+   const arma::vec &offsets_new, const arma::mat &X_new,
+   const arma::mat &Z_new, const arma::uvec &time_indices_elems,
+   const arma::uvec &time_indices_len){
+  const arma::uword n_new = Y_new.n_elem;
+  if(ws_new.n_elem != n_new or offsets_new.n_elem != n_new or
+       X_new.n_cols != n_new or Z_new.n_cols != n_new)
+    throw std::invalid_argument("pf_session::append: invalid dimensions");
+  if(arma::sum(time_indices_len) != time_indices_elems.n_elem)
+    throw std::invalid_argument(
+        "invalid 'time_indices_elems' and 'time_indices_len'");
+  if(time_indices_elems.n_elem > 0L and time_indices_elems.max() >= n_new)
+    throw std::invalid_argument("invalid 'time_indices_elems'");
+
+  /* the blocks of the new periods are made from the new data */
+  auto ele_begin = time_indices_elems.cbegin();
+  for(auto n_ele : time_indices_len){
+    const arma::uvec indices(ele_begin, n_ele);
+    prob->add_period(Y_new, ws_new, offsets_new, X_new, Z_new, indices);
+    ele_begin += n_ele;
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef SESSION_H
+#define SESSION_H
+#include "problem_data.h"
+#include "samplers.h"
+#include "stats-comp-helper.h"
+#include "cloud.h"
+
+/* holds the data, the thread pool, and the cached conditional distributions
+ * such that they can be re-used in repeated calls from R. Parameters are
+ * updated in place through the setters of the problem_data object. The data
+ * is only stored in the problem_data object */
+class pf_session {
+public:
+  std::unique_ptr<problem_data> prob;
+  std::unique_ptr<sampler> samp;
+  std::unique_ptr<stats_comp_helper> stats_cp;
+  const std::string which_ll_cp;
+
+  /* last particle cloud from the streaming particle filter and the number
+   * of periods it has been run for */
+  std::unique_ptr<particle_cloud> last_cloud;
+  arma::uword n_streamed = 0L;
+
+  pf_session(const std::string &which_ll_cp): which_ll_cp(which_ll_cp) { }
+  pf_session(const pf_session&) = delete;
+  pf_session& operator=(const pf_session&) = delete;
+
+  /* adds observations for new periods. The indices are relative to the
+   * new observations and the last argument is the number of observations
+   * in each of the new periods */
+  void append
+    (const arma::vec&, const arma::vec&, const arma::vec&, const arma::mat&,
+     const arma::mat&, const arma::uvec&, const arma::uvec&);
+
+  /* drops the state of the streaming particle filter */
+  void reset_stream(){
+    last_cloud.reset();
+    n_streamed = 0L;
+  }
+};
+
+#endif
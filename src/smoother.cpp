@@ -1,5 +1,6 @@
 #include "smoother.h"
 #include "fast-kernel-approx.h"
+#include "kernel-gemm.h"
 #ifdef MSSM_PROF
 #include "profile.h"
 #endif
@@ -9,7 +10,7 @@ using std::to_string;
 inline void check_smoother_input
   (problem_data &data, const std::vector<const arma::mat *> &particles,
    const std::vector<const arma::vec *> &weights){
-  const unsigned n_periods = data.n_periods;
+  const unsigned n_periods = data.n_periods();
   if(n_periods != particles.size())
     throw std::invalid_argument(
         "smoother: invalid 'particles' (size " +
@@ -44,22 +45,14 @@ namespace {
 
       for(unsigned i = start; i < end;
           ++i, state_new += state_dim, ++smooth_w, ++new_w){
-        std::fill(work_mem.begin(), work_mem.end(), 0.);
-
-        const double *state_old = old_ps.memptr();
-        double max_w = -std::numeric_limits<double>::infinity();
-        const double *old_w = old_ws.begin();
-        double *w_mem = work_mem.begin();
-        for(unsigned j = 0; j < N_old;
-            ++j, state_old += state_dim, ++old_w, ++w_mem){
-          *w_mem =
-            state_dist->operator()(state_new, state_old, state_dim, *old_w);
-          if(*w_mem > max_w)
-            max_w = *w_mem;
-        }
-
-        *smooth_w = log_sum_log(work_mem, max_w);
-        *smooth_w = log_sum_log(*smooth_w, *new_w);
+        /* the kernel is symmetric in the two particles */
+        state_dist->log_kernel_block(
+          old_ps.memptr(), N_old, state_new, state_dim, old_ws.memptr(),
+          work_mem.memptr());
+        lse::accumulator acc;
+        acc.add(work_mem.memptr(), N_old);
+
+        *smooth_w = log_sum_log(acc.get(), *new_w);
       }
     }
   };
@@ -67,14 +60,14 @@ namespace {
 
 std::vector<arma::vec> smoother
   (problem_data &data, const std::vector<const arma::mat *> &particles,
-   const std::vector<const arma::vec *> &weights){
+   const std::vector<const arma::vec *> &weights, const bool use_gemm){
 #ifdef MSSM_PROF
   profiler prof("smoother");
 #endif
 
   check_smoother_input(data, particles, weights);
 
-  const unsigned n_periods = data.n_periods,
+  const unsigned n_periods = data.n_periods(),
     state_dim = particles.at(0)->n_rows;
 
   /* handle the last period */
@@ -111,26 +104,33 @@ std::vector<arma::vec> smoother
 
     arma::vec &smooth_ws = *os;
     smooth_ws.resize(N_new);
+    if(use_gemm){
+      log_kernel_sum_gemm(old_ps, old_ws, new_ps, smooth_ws, *state_dist,
+                          pool);
+      lse::log_sum_log_block(smooth_ws.begin(), new_ws.begin(), N_new);
+
+      normalize_log_weights(smooth_ws);
+      continue;
+    }
+
     const double *state_new = new_ps.memptr();
     auto smooth_w = smooth_ws.begin();
     const double *new_w = new_ws.begin();
 
     const unsigned inc = N_new / (4L * pool.thread_count) + 1L;
     unsigned start = 0L, end = 0L;
-    std::vector<std::future<void> > futures;
-    futures.reserve(N_new / inc + 1L);
+    task_group tasks(pool);
 
     for(; start < N_new; start = end){
       end = std::min(end + inc, N_new);
       smoother_inner task {
         start, end, state_dim, N_old, state_new, smooth_w,
         new_w, state_dist.get(), old_ps, old_ws };
-      futures.push_back(pool.submit(std::move(task)));
+      tasks.run(std::move(task));
 
     }
 
-    for(auto &fu : futures)
-      fu.get();
+    tasks.wait();
 
     normalize_log_weights(smooth_ws);
   }
@@ -140,14 +140,20 @@ std::vector<arma::vec> smoother
 
 std::vector<arma::vec> smoother_aprx
   (problem_data &data, const std::vector<const arma::mat *> &particles,
-   const std::vector<const arma::vec *> &weights){
+   const std::vector<const arma::vec *> &weights,
+   const std::vector<KD_tree_topology> &old_trees,
+   const std::vector<KD_tree_topology> &new_trees){
 #ifdef MSSM_PROF
   profiler prof("smoother-k-d");
 #endif
 
   check_smoother_input(data, particles, weights);
 
-  const unsigned n_periods = data.n_periods;
+  const unsigned n_periods = data.n_periods();
+  const bool has_trees = !old_trees.empty() or !new_trees.empty();
+  if(has_trees and (
+      old_trees.size() != n_periods or new_trees.size() != n_periods))
+    throw std::invalid_argument("smoother_aprx: invalid k-d trees");
   const arma::uword N_min = data.ctrl.KD_N_min;
   const double eps = data.ctrl.aprx_eps;
 
@@ -179,23 +185,28 @@ std::vector<arma::vec> smoother_aprx
     smooth_ws.resize(N_new);
     smooth_ws.fill(-std::numeric_limits<double>::infinity());
 
+    /* use the trees from the particle filter at this time point if there
+     * are any. The source particles in the filter are the query particles
+     * here and vice versa. Only the borders of the nodes are re-computed */
+    const KD_tree_topology *X_tree = nullptr, *Y_tree = nullptr;
+    if(has_trees and !new_trees[time].empty() and !old_trees[time].empty()){
+      X_tree = &new_trees[time];
+      Y_tree = &old_trees[time];
+    }
+
     /* Notice: we assume that the function is symmetrical in the two particle
      * arguments */
     auto permu_indices = FSKA_cpp<false>(
       smooth_ws, old_ps, new_ps, old_ws, N_min, eps, *state_dist,
-      pool, true);
+      pool, true, nullptr, nullptr, FSKA_cpp_xtra_func(),
+      data.ctrl.use_float, data.ctrl.KD_hermite_order, nullptr, false,
+      X_tree, Y_tree, data.ctrl.KD_deterministic, data.ctrl.KD_use_balls);
 
     /* permutate */
     smooth_ws = smooth_ws(permu_indices.Y_perm);
 
     /* add weights from source particle */
-    {
-      double *s = smooth_ws.begin();
-      for(auto x : new_ws){
-        *s = log_sum_log(*s, x);
-        ++s;
-      }
-    }
+    lse::log_sum_log_block(smooth_ws.begin(), new_ws.begin(), new_ws.n_elem);
 
     normalize_log_weights(smooth_ws);
   }
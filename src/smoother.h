@@ -4,14 +4,21 @@
 
 /* Performs backward smoothing given a data, marix with particles, and vector
  * with normalized log weights. It returns the normalized log smoothing
- * weights. */
+ * weights. The squared distances are computed with matrix products if the
+ * last argument is true. */
 std::vector<arma::vec> smoother
   (problem_data&, const std::vector<const arma::mat *>&,
-   const std::vector<const arma::vec *>&);
+   const std::vector<const arma::vec *>&, const bool use_gemm = false);
 
-/* same as above but using a dual k-d tree approximation */
+/* same as above but using a dual k-d tree approximation. The last two
+ * arguments can be the topologies of the k-d trees which were used by the
+ * particle filter in each period. They are then used instead of building new
+ * trees. Both should be empty or have an element for each period. Empty
+ * elements are ignored */
 std::vector<arma::vec> smoother_aprx
   (problem_data&, const std::vector<const arma::mat *>&,
-   const std::vector<const arma::vec *>&);
+   const std::vector<const arma::vec *>&,
+   const std::vector<KD_tree_topology>& = std::vector<KD_tree_topology>(),
+   const std::vector<KD_tree_topology>& = std::vector<KD_tree_topology>());
 
 #endif
@@ -2,11 +2,14 @@
 #include "blas-lapack.h"
 #include "thread_pool.h"
 #include "fast-kernel-approx.h"
+#include "kernel-gemm.h"
 #include "misc.h"
+#include <R_ext/Random.h>
+#include <numeric>
 
 static constexpr double D_ONE = 1., D_M_ONE = -1.;
 static constexpr int I_ONE = 1L;
-static constexpr char C_L = 'L';
+static constexpr char C_U = 'U';
 using std::ref;
 using std::cref;
 using namespace std::placeholders;
@@ -96,74 +99,145 @@ private:
       { }
   };
   const dist_util dobs, dstat;
+
+  /* returns the indices in [start, end) of the elements of the gradient
+   * which statistics are computed for. The indices are relative to start.
+   * All elements are used if the passed indices are empty */
+  arma::uvec get_idx
+    (const arma::uvec &stat_idx, const arma::uword start,
+     const arma::uword end) const {
+    if(stat_idx.n_elem < 1L or what == log_densty){
+      arma::uvec out(end - start);
+      std::iota(out.begin(), out.end(), 0L);
+      return out;
+    }
+
+    if(stat_idx.max() >= (arma::uword)(dobs.grad_dim + dstat.grad_dim))
+      throw std::invalid_argument("comp_stat_util: invalid 'stat_idx'");
+
+    arma::uvec out = stat_idx(
+      arma::find(stat_idx >= start and stat_idx < end));
+    out -= start;
+    return out;
+  }
+
+  /* indices of the elements of the gradient w.r.t. the parameters of the
+   * observation and state distribution which are used */
+  const arma::uvec obs_idx, state_idx;
+  /* true if all elements are used */
+  const bool use_all;
+
 public:
-  const int stat_dim, grad_dim = dobs.grad_dim + dstat.grad_dim;
+  const int obs_grad_dim   = obs_idx.n_elem,
+            state_grad_dim = state_idx.n_elem,
+            grad_dim       = obs_grad_dim + state_grad_dim,
+            stat_dim       = get_stat_dim_packed(grad_dim, what);
 
 private:
+  /* adds the elements of the first argument given by the indices to the
+   * last argument */
+  static void add_sub_vec
+    (const double *x, const arma::uvec &idx, double *out) {
+    for(auto i : idx)
+      *out++ += x[i];
+  }
+
   void state_only_gradient(const arma::vec &state, double *stats) const
   {
-    dobs.di.comp_stats_state_only(state, stats, what);
+    if(use_all){
+      dobs.di.comp_stats_state_only(state, stats, what);
+      return;
+    }
+
+    M_THREAD_LOCAL std::vector<double> stat_tmp_terms;
+    if((int)stat_tmp_terms.size() < dobs.total_size)
+      stat_tmp_terms.resize(dobs.total_size);
+    double * tmp_mem = stat_tmp_terms.data();
+    std::fill(tmp_mem, tmp_mem + dobs.total_size, 0.);
+    dobs.di.comp_stats_state_only(state, tmp_mem, what);
+    add_sub_vec(tmp_mem, obs_idx, stats);
   }
 
   void state_only_Hessian(const arma::vec &state, double *stats) const
   {
     M_THREAD_LOCAL std::vector<double> stat_tmp_terms;
-    if((int)stat_tmp_terms.size() < dobs.total_size)
-      stat_tmp_terms.resize(dobs.total_size);
+    const int needed_size =
+      dobs.total_size + obs_grad_dim * (1L + obs_grad_dim);
+    if((int)stat_tmp_terms.size() < needed_size)
+      stat_tmp_terms.resize(needed_size);
 
-    /* we only compute the lower part of the Hessian. We copy it to the
-     * upper part at the end. First, we create pointer to the different
-     * elements */
-    const int obs_grad_dim = dobs.grad_dim;
+    /* the Hessian is stored in packed form with the upper part. The
+     * observation parameters come first so the upper left block is the
+     * packed Hessian of the observation parameters. First, we create
+     * pointer to the different elements */
     double * const grad_obs   = stats,
            * const grad_state = stats + obs_grad_dim,
-           * const hess_obs   = stats + grad_dim,
-           * const hess_cross = stats + grad_dim + obs_grad_dim;
+           * const hess       = stats + grad_dim;
 
     /* we compute the new gradient and hessian terms */
     double * tmp_mem = stat_tmp_terms.data();
     std::fill(tmp_mem, tmp_mem + dobs.total_size, 0.);
     dobs.di.comp_stats_state_only(state, tmp_mem, what);
-    const double * const dg  = tmp_mem,
-                 * const dgg = tmp_mem + obs_grad_dim;
+    const double *dg  = tmp_mem,
+                 *dgg = tmp_mem + dobs.grad_dim;
+    if(!use_all){
+      /* only keep the used elements */
+      double * const dg_sub  = tmp_mem + dobs.total_size,
+             * const dgg_sub = dg_sub + obs_grad_dim;
+      for(int j = 0; j < obs_grad_dim; ++j){
+        dg_sub[j] = dg[obs_idx[j]];
+        const double *col = dgg + obs_idx[j] * dobs.grad_dim;
+        for(int i = 0; i < obs_grad_dim; ++i)
+          dgg_sub[i + j * obs_grad_dim] = col[obs_idx[i]];
+      }
+      dg  = dg_sub;
+      dgg = dgg_sub;
+    }
 
     /* compute the outer products which we need to add to the Hessian.
      * \nabla g \nabla g^\top */
-    dsyr(
-        &C_L, &obs_grad_dim, &D_ONE, dg, &I_ONE,
-        hess_obs, &grad_dim);
+    dspr(&C_U, &obs_grad_dim, &D_ONE, dg, &I_ONE, hess);
 
-    /* next, we do the two outer products to the upper right block*/
-    dsyr2(
-        &C_L, &obs_grad_dim, &D_ONE, dg, &I_ONE, grad_obs, &I_ONE,
-        hess_obs, &grad_dim);
+    /* next, we do the two outer products to the upper left block*/
+    dspr2(
+        &C_U, &obs_grad_dim, &D_ONE, dg, &I_ONE, grad_obs, &I_ONE, hess);
 
-    /* then the outer product in the lower left block matrix */
-    dger(
-      &dstat.grad_dim, &obs_grad_dim, &D_ONE, grad_state, &I_ONE,
-      dg, &I_ONE, hess_cross, &grad_dim);
+    /* then the outer product in the upper right block matrix. The first
+     * elements of each column in the packed form are in this block */
+    {
+      double *h = hess + (obs_grad_dim * (obs_grad_dim + 1L)) / 2L;
+      for(int j = obs_grad_dim; j < grad_dim; h += ++j)
+        daxpy(
+            &obs_grad_dim, grad_state + j - obs_grad_dim, dg, &I_ONE, h,
+            &I_ONE);
+    }
 
     /* add the gradient and Hessian terms themself */
     {
       const double *x = dgg;
-      double *y = hess_obs;
-      for(int i = 0; i < obs_grad_dim;
-          ++i, x += obs_grad_dim, y += grad_dim)
-        daxpy(
-            &obs_grad_dim, &D_ONE, x, &I_ONE, y, &I_ONE);
+      double *y = hess;
+      for(int i = 1; i <= obs_grad_dim; x += obs_grad_dim, y += i++)
+        daxpy(&i, &D_ONE, x, &I_ONE, y, &I_ONE);
     }
     daxpy(
       &obs_grad_dim, &D_ONE, dg, &I_ONE, grad_obs, &I_ONE);
 
     /* subtract outer product of gradient from the Hessian */
-    dsyr(
-        &C_L, &grad_dim, &D_M_ONE, stats, &I_ONE,
-        stats + grad_dim, &grad_dim);
+    dspr(&C_U, &grad_dim, &D_M_ONE, stats, &I_ONE, hess);
+  }
 
-    /* copy upper half to lower half. TODO: do this in a smarter way */
-    {
-      arma::mat tmp(stats + grad_dim, grad_dim, grad_dim, false);
-      tmp = arma::symmatl(tmp);
+  /* adds the upper part of the used elements of a Hessian of the state
+   * parameters to the corresponding block of the packed Hessian in the
+   * second argument */
+  void add_state_hess(const double *hess_state, double *hess) const
+  {
+    const arma::uword n_full = dstat.grad_dim;
+    double *x = hess + (obs_grad_dim * (obs_grad_dim + 1L)) / 2L +
+      obs_grad_dim;
+    for(int k = 0; k < state_grad_dim; x += obs_grad_dim + ++k){
+      const double *t = hess_state + state_idx[k] * n_full;
+      for(int i = 0; i <= k; ++i)
+        x[i] += t[state_idx[i]];
     }
   }
 
@@ -177,14 +251,30 @@ private:
         &stat_dim, &weight, stats_old, &I_ONE, stats_new, &I_ONE);
 
     /* then compute the terms that is a function of the pair of the states */
-    double * stat_i = stats_new + dobs.grad_dim;
+    double * stat_i = stats_new + obs_grad_dim;
+    if(use_all){
+      dstat.trans_dist->comp_stats_state_state(
+          state_old, state_new, weight, stat_i, what);
+      return;
+    }
+
+    M_THREAD_LOCAL std::vector<double> stat_tmp_terms;
+    if((int)stat_tmp_terms.size() < dstat.grad_dim)
+      stat_tmp_terms.resize(dstat.grad_dim);
+    double * tmp_mem = stat_tmp_terms.data();
+    std::fill(tmp_mem, tmp_mem + dstat.grad_dim, 0.);
     dstat.trans_dist->comp_stats_state_state(
-        state_old, state_new, weight, stat_i, what);
+        state_old, state_new, weight, tmp_mem, what);
+    add_sub_vec(tmp_mem, state_idx, stat_i);
   }
 
+  /* computes the terms for a pair. The Hessian terms of the pair are
+   * not added if moments are passed. Instead, the moments of the pair are
+   * added to the last argument */
   void state_state_Hessian
     (const double *state_old, const double *state_new,
-     const double *stats_old, double *stats_new, const double log_weight) const
+     const double *stats_old, double *stats_new, const double log_weight,
+     double *moments = nullptr) const
   {
     M_THREAD_LOCAL std::vector<double> stat_tmp_terms;
     unsigned int needed_size = stat_dim + dstat.total_size;
@@ -198,53 +288,53 @@ private:
         &stat_dim, &D_ONE, stats_old, &I_ONE, stat_out, &I_ONE);
 
     /* then compute the terms that is a function of the pair of the states */
-    double * const grad_start = stat_out + dobs.grad_dim,
-           * const hess_start = stat_out + grad_dim * (1L + dobs.grad_dim) +
-                                dobs.grad_dim,
+    double * const grad_start = stat_out + obs_grad_dim,
+           * const hess_start = stat_out + grad_dim,
            * const tmp_mem    = stat_out + stat_dim;
-    const int state_grad_dim = dstat.grad_dim;
-    {
+    const double weight = std::exp(log_weight);
+    if(moments){
+      dstat.trans_dist->comp_stats_state_state_moments(
+        state_old, state_new, 1., tmp_mem, weight, moments);
+      /* add gradient terms */
+      add_sub_vec(tmp_mem, state_idx, grad_start);
+
+    } else {
       dstat.trans_dist->comp_stats_state_state(
         state_old, state_new, 1., tmp_mem, what);
       /* add gradient terms */
-      daxpy(
-          &state_grad_dim, &D_ONE, tmp_mem, &I_ONE, grad_start, &I_ONE);
+      add_sub_vec(tmp_mem, state_idx, grad_start);
       /* add hessian terms */
-      const double *t = tmp_mem + state_grad_dim;
-            double *x = hess_start;
-      for(int i = 0; i < state_grad_dim;
-          ++i, t += state_grad_dim, x += grad_dim)
-        daxpy(
-            &state_grad_dim, &D_ONE, t, &I_ONE, x, &I_ONE);
+      add_state_hess(tmp_mem + dstat.grad_dim, hess_start);
     }
 
-    /* make rank-one update. Use dsyr and assume we update the upper part
-     * later */
-    dsyr(
-        &C_L, &grad_dim,
-        &D_ONE, stat_out, &I_ONE,
-        stat_out + grad_dim, &grad_dim);
+    /* make rank-one update */
+    dspr(&C_U, &grad_dim, &D_ONE, stat_out, &I_ONE, hess_start);
 
     /* add terms */
-    const double weight = std::exp(log_weight);
     daxpy(
         &stat_dim, &weight, stat_out, &I_ONE, stats_new, &I_ONE);
   }
 
 public:
   const bool any_work = stat_dim > 0L;
-  comp_stat_util(const comp_out what, const cdist &d1, const cdist &d2):
+  /* number of elements of the moments used with state_state_moments and
+   * add_moments. Zero if the moments are not used */
+  const int moments_dim =
+    (what == Hessian and dstat.trans_dist) ?
+    dstat.trans_dist->stats_moments_dim() : 0L;
+  const bool use_moments = moments_dim > 0L;
+
+  /* the last argument is the indices of the elements of the gradient which
+   * statistics are computed for. The first elements of the gradient are
+   * w.r.t. the parameters of the first distribution. All elements are used
+   * if the indices are empty */
+  comp_stat_util(const comp_out what, const cdist &d1, const cdist &d2,
+                 const arma::uvec &stat_idx = arma::uvec()):
   what(what), dobs(d1, what), dstat(d2, what),
-  stat_dim(([&]{
-    unsigned int out = dobs.grad_dim + dstat.grad_dim;
-    gaurd_new_comp_out(what);
-
-    if(what != Hessian)
-      return out;
-
-    out = out * (1L + out);
-    return out;
-  }())) { }
+  obs_idx  (get_idx(stat_idx, 0L, dobs.grad_dim)),
+  state_idx(get_idx(stat_idx, dobs.grad_dim, dobs.grad_dim + dstat.grad_dim)),
+  use_all(obs_idx.n_elem + state_idx.n_elem ==
+    (arma::uword)(dobs.grad_dim + dstat.grad_dim)) { }
 
   void state_only(const arma::vec &state, double *stats) const
   {
@@ -275,8 +365,65 @@ public:
       state_state_Hessian(state_old, state_new, stats_old, stats_new,
                           log_weight);
   }
+
+  /* same as state_state but the Hessian terms which only depend on the
+   * pair are not added. Instead, the moments of the pair are added to the
+   * last argument. add_moments must be called after all pairs for a new
+   * state have been processed */
+  void state_state_moments
+  (const double *state_old, const double *state_new,
+   const double *stats_old, double *stats_new, const double log_weight,
+   double *moments) const
+  {
+#ifdef MSSM_DEBUG
+    if(!use_moments)
+      throw std::logic_error("state_state_moments: moments are not used");
+#endif
+    state_state_Hessian(state_old, state_new, stats_old, stats_new,
+                        log_weight, moments);
+  }
+
+  /* adds the Hessian terms given the accumulated moments */
+  void add_moments(const double *moments, double *stats_new) const
+  {
+#ifdef MSSM_DEBUG
+    if(!use_moments)
+      throw std::logic_error("add_moments: moments are not used");
+#endif
+    const int hess_dim = dstat.grad_dim * dstat.grad_dim;
+    M_THREAD_LOCAL std::vector<double> hess_state;
+    if(hess_state.size() < (unsigned)hess_dim)
+      hess_state.resize(hess_dim);
+    std::fill(hess_state.begin(), hess_state.begin() + hess_dim, 0.);
+
+    dstat.trans_dist->comp_stats_hess_from_moments(
+      moments, hess_state.data());
+    add_state_hess(hess_state.data(), stats_new + grad_dim);
+  }
 };
 
+arma::mat unpack_stats(const arma::mat &stats, const comp_out what){
+  if(what != Hessian)
+    return stats;
+
+  const arma::uword grad_dim = get_grad_dim_packed(stats.n_rows, what);
+  arma::mat out(grad_dim * (1L + grad_dim), stats.n_cols);
+  for(arma::uword k = 0; k < stats.n_cols; ++k){
+    const double *s = stats.colptr(k);
+    double *o = out.colptr(k);
+    std::copy(s, s + grad_dim, o);
+
+    /* copy the upper part to both triangular parts */
+    s += grad_dim;
+    o += grad_dim;
+    for(arma::uword j = 0; j < grad_dim; ++j)
+      for(arma::uword i = 0; i <= j; ++i, ++s)
+        o[i + j * grad_dim] = o[j + i * grad_dim] = *s;
+  }
+
+  return out;
+}
+
 inline void set_ll_state_only_
   (const cdist &obs_dist, particle_cloud &new_cloud,
    const comp_stat_util &util, const arma::uword i_start,
@@ -302,21 +449,17 @@ void stats_comp_helper::set_ll_state_only
   const arma::uword n_particles = new_cloud.N_particles();
   auto loop_figs = get_inc_n_block(n_particles, pool);
 
-  std::vector<std::future<void> > futures;
-  futures.reserve(loop_figs.n_tasks);
+  task_group tasks(pool);
 
   for(arma::uword start = 0L; start < n_particles;){
     arma::uword end = std::min(start + loop_figs.inc, n_particles);
-    futures.push_back(pool.submit(std::bind(
+    tasks.run(std::bind(
         set_ll_state_only_, cref(obs_dist), ref(new_cloud), cref(util),
-        start, end)));
+        start, end));
     start = end;
   }
 
-  while(!futures.empty()){
-    futures.back().get();
-    futures.pop_back();
-  }
+  tasks.wait();
 }
 
 void stats_comp_helper::set_ll_n_stat_
@@ -336,7 +479,7 @@ void stats_comp_helper::set_ll_n_stat_
     throw std::logic_error("'get_sta_dist' did not return a 'cdist'");
 
   comp_stat_util util(
-      dat.ctrl.what_stat, obs_dist, *trans_func_dist);
+      dat.ctrl.what_stat, obs_dist, *trans_func_dist, dat.ctrl.stat_idx);
 
 #ifdef MSSM_DEBUG
   auto gen_err_msg = []
@@ -396,6 +539,9 @@ inline void set_trans_ll_n_comp_stats_no_aprx
   const arma::uword n_old = old_cloud.N_particles(),
     dim_particle = new_cloud.dim_particle();
   arma::vec new_log_ws(n_old);
+  /* the Hessian terms which only depend on the pairs are computed once per
+   * new particle from the moments if possible */
+  std::vector<double> moments(util.moments_dim);
   for(arma::uword i = start; i < end; ++i){
     const double *d_new = new_cloud.particles.colptr(i);
     double *stats_new =
@@ -403,20 +549,29 @@ inline void set_trans_ll_n_comp_stats_no_aprx
       *n_w = new_log_ws.begin(),
       max_w = -std::numeric_limits<double>::infinity();
 
+    trans_func.log_kernel_block(
+      old_cloud.particles.memptr(), n_old, d_new, dim_particle,
+      old_cloud.ws_normalized.memptr(), new_log_ws.memptr());
+
+    if(util.use_moments)
+      std::fill(moments.begin(), moments.end(), 0.);
     for(arma::uword j = 0; j < n_old; ++j, ++n_w){
       const double
         *d_old = old_cloud.particles.colptr(j),
         *stats_old =
         (util.what == log_densty) ? nullptr : old_cloud.stats.colptr(j);
 
-      *n_w = trans_func(
-        d_old, d_new, dim_particle, old_cloud.ws_normalized(j));
-
-      util.state_state(
-        d_old, d_new, stats_old, stats_new, *n_w);
+      if(util.use_moments)
+        util.state_state_moments(
+          d_old, d_new, stats_old, stats_new, *n_w, moments.data());
+      else
+        util.state_state(
+          d_old, d_new, stats_old, stats_new, *n_w);
       if(*n_w > max_w)
         max_w = *n_w;
     }
+    if(util.use_moments)
+      util.add_moments(moments.data(), stats_new);
 
     new_cloud.ws(i) = log_sum_log(new_log_ws, max_w);
   }
@@ -432,25 +587,25 @@ void stats_comp_helper_no_aprx::set_ll_state_state
   trans_func.trans_Y(new_cloud.particles);
   thread_pool &pool = ctrl.get_pool();
 
-  {
+  if(use_gemm and util.what == log_densty)
+    log_kernel_sum_gemm(
+      old_cloud.particles, old_cloud.ws_normalized, new_cloud.particles,
+      new_cloud.ws, trans_func, pool);
+  else {
     {
       const arma::uword n_particles = new_cloud.N_particles();
       auto loop_figs = get_inc_n_block(n_particles, pool);
-      std::vector<std::future<void> > futures;
-      futures.reserve(loop_figs.n_tasks);
+      task_group tasks(pool);
 
       for(arma::uword start = 0L; start < n_particles;){
         arma::uword end = std::min(start + loop_figs.inc, n_particles);
-        futures.push_back(pool.submit(std::bind(
+        tasks.run(std::bind(
             set_trans_ll_n_comp_stats_no_aprx, ref(old_cloud), ref(new_cloud),
-            cref(trans_func), cref(util), start, end)));
+            cref(trans_func), cref(util), start, end));
         start = end;
       }
 
-      while(!futures.empty()){
-        futures.back().get();
-        futures.pop_back();
-      }
+      tasks.wait();
     }
 
     /* normalize statistics */
@@ -485,10 +640,13 @@ void stats_comp_helper_aprx_KD::set_ll_state_state
               &old_stat = old_cloud.stats;
 
     const arma::uword N_min = ctrl.KD_N_min;
-    const double eps = ctrl.aprx_eps;
+    const double eps = ctrl.get_KD_eps();
 
     thread_pool &pool = ctrl.get_pool();
 
+    /* the bounds on the errors are only computed if needed */
+    arma::vec &log_err = new_cloud.log_aprx_err;
+    arma::vec * const log_err_ptr = ctrl.comp_KD_err() ? &log_err : nullptr;
     auto permu_indices = ([&]{
       if(any_work){
         auto state_state_func = std::bind(
@@ -496,22 +654,45 @@ void stats_comp_helper_aprx_KD::set_ll_state_state
 
         return FSKA_cpp<true>(
           ws, old_particles, new_particles, old_ws, N_min, eps, trans_func,
-          pool, false, &old_stat, &new_stat, state_state_func);
+          pool, false, &old_stat, &new_stat, state_state_func,
+          ctrl.use_float, 0L, log_err_ptr, ctrl.KD_keep_trees, nullptr,
+          nullptr, ctrl.KD_deterministic, ctrl.KD_use_balls);
       }
 
       return FSKA_cpp<false>(
         ws, old_particles, new_particles, old_ws, N_min, eps, trans_func,
-        pool);
+        pool, false, nullptr, nullptr, FSKA_cpp_xtra_func(),
+        ctrl.use_float, ctrl.KD_hermite_order, log_err_ptr, ctrl.KD_keep_trees,
+        nullptr, nullptr, ctrl.KD_deterministic, ctrl.KD_use_balls);
     })();
 
+    /* the indices of the trees refer to the original order of the
+     * particles */
+    new_cloud.KD_tree_old = std::move(permu_indices.X_tree);
+    new_cloud.KD_tree_new = std::move(permu_indices.Y_tree);
+
     /* normalize statistics */
     if(new_cloud.stats.n_elem > 0L){
       arma::vec norm_conts = arma::exp(ws);
       new_cloud.stats.each_row() /= norm_conts.t();
     }
 
+    /* make the error bounds relative to the weights. They stay the same
+     * when terms are added to the log weights */
+    {
+      const double *w = ws.cbegin();
+      for(auto &e : log_err){
+        const double lw = *w++;
+        if(!(std::isinf(e) and e < 0))
+          e = lw > -std::numeric_limits<double>::infinity() ?
+            e - lw : std::numeric_limits<double>::infinity();
+      }
+    }
+
     /* permutate */
     ws = ws(permu_indices.Y_perm);
+    if(log_err_ptr)
+      log_err = log_err(permu_indices.Y_perm);
     new_particles = new_particles.cols(permu_indices.Y_perm);
 
     old_ws = old_ws(permu_indices.X_perm);
@@ -524,3 +705,262 @@ void stats_comp_helper_aprx_KD::set_ll_state_state
   }
 }
 
+
+/* draws n_out ancestors from the normalized weights where the j'th uniform
+ * variable is in [j / n_out, (j + 1) / n_out). The same uniform variable is
+ * used for all ancestors if same_u is true */
+static void sample_ancestors_sorted
+  (const arma::vec &w, const arma::uword n_out, arma::uword *out,
+   const bool same_u)
+{
+  const arma::uword n_in = w.n_elem;
+  const double u0 = same_u ? unif_rand() : 0.;
+  double cum = w[0L];
+  arma::uword j = 0L;
+  for(arma::uword i = 0; i < n_out; ++i, ++out){
+    const double u = ((double)i + (same_u ? u0 : unif_rand())) / n_out;
+    while(u > cum and j < n_in - 1L)
+      cum += w[++j];
+    *out = j;
+  }
+}
+
+arma::uvec stats_comp_helper_resample::sample_ancestors
+  (const arma::vec &ws_normalized, const arma::uword n_out,
+   const resample_scheme scheme)
+{
+  if(ws_normalized.n_elem < 1L)
+    throw std::invalid_argument("sample_ancestors: no weights");
+
+  arma::uvec out(n_out);
+  if(n_out < 1L)
+    return out;
+  arma::vec w = arma::exp(ws_normalized);
+  w /= arma::sum(w);
+
+  if(scheme == systematic)
+    sample_ancestors_sorted(w, n_out, out.begin(), true);
+  else if(scheme == stratified)
+    sample_ancestors_sorted(w, n_out, out.begin(), false);
+  else if(scheme == residual){
+    /* take the deterministic number of copies and sample the rest from the
+     * residual weights with stratified sampling */
+    arma::uword n_det = 0L;
+    for(arma::uword j = 0; j < w.n_elem; ++j){
+      const double nw = n_out * w[j];
+      arma::uword n_copies = std::floor(nw);
+      w[j] = nw - n_copies;
+      for(; n_copies > 0 and n_det < n_out; --n_copies)
+        out[n_det++] = j;
+    }
+
+    const arma::uword n_rest = n_out - n_det;
+    if(n_rest > 0L){
+      w /= arma::sum(w);
+      sample_ancestors_sorted(w, n_rest, out.begin() + n_det, false);
+    }
+  } else
+    throw std::invalid_argument("sample_ancestors: unkown scheme");
+
+  return out;
+}
+
+inline void set_trans_ll_n_comp_stats_resample
+  (particle_cloud &old_cloud, particle_cloud &new_cloud,
+   const trans_obj &trans_func, const comp_stat_util &util,
+   const arma::uvec &ancestors, const arma::vec &log_ws,
+   const arma::uword start, const arma::uword end)
+{
+  const arma::uword dim_particle = new_cloud.dim_particle();
+  for(arma::uword i = start; i < end; ++i){
+    const arma::uword j = ancestors[i];
+    const double
+      *d_new = new_cloud.particles.colptr(i),
+      *d_old = old_cloud.particles.colptr(j),
+      *stats_old =
+      (util.what == log_densty) ? nullptr : old_cloud.stats.colptr(j);
+    double *stats_new =
+      (util.what == log_densty) ? nullptr : new_cloud.stats.colptr(i);
+
+    new_cloud.ws(i) = trans_func(d_old, d_new, dim_particle, log_ws[i]);
+    /* the weights are already accounted for in the unnormalized weight */
+    util.state_state(d_old, d_new, stats_old, stats_new, 0.);
+  }
+}
+
+void stats_comp_helper_resample::set_ll_state_state
+  (const cdist &obs_dist, particle_cloud &old_cloud, particle_cloud &new_cloud,
+   const comp_stat_util &util, const control_obj &ctrl,
+   const trans_obj &trans_func)
+  const
+{
+  const arma::uword n_old = old_cloud.N_particles(),
+                    n_new = new_cloud.N_particles();
+  const arma::vec &old_ws = old_cloud.ws_normalized;
+
+  /* find the ancestors and the log weights to add. The latter are such that
+   * the mean of the unnormalized weights is an estimate of the conditional
+   * likelihood */
+  arma::uvec ancestors;
+  arma::vec log_ws;
+  {
+    const arma::vec w = arma::exp(old_ws);
+    const double ess = 1. / arma::dot(w, w);
+    if(n_old != n_new or ess < ess_threshold * n_old){
+      ancestors = sample_ancestors(old_ws, n_new, scheme);
+      log_ws.zeros(n_new);
+
+    } else {
+      ancestors = arma::regspace<arma::uvec>(0L, n_new - 1L);
+      log_ws = old_ws + std::log((double)n_old);
+
+    }
+  }
+
+  /* transform*/
+  trans_func.trans_X(old_cloud.particles);
+  trans_func.trans_Y(new_cloud.particles);
+  thread_pool &pool = ctrl.get_pool();
+
+  {
+    auto loop_figs = get_inc_n_block(n_new, pool);
+    task_group tasks(pool);
+
+    for(arma::uword start = 0L; start < n_new;){
+      arma::uword end = std::min(start + loop_figs.inc, n_new);
+      tasks.run(std::bind(
+          set_trans_ll_n_comp_stats_resample, ref(old_cloud), ref(new_cloud),
+          cref(trans_func), cref(util), cref(ancestors), cref(log_ws),
+          start, end));
+      start = end;
+    }
+
+    tasks.wait();
+  }
+
+  /* transform back */
+  trans_func.trans_inv_X(old_cloud.particles);
+  trans_func.trans_inv_Y(new_cloud.particles);
+}
+
+arma::umat stats_comp_helper_subsample::sample_subsets
+  (const arma::vec &ws_normalized, const arma::uword n_sub,
+   const arma::uword n_out, const resample_scheme scheme)
+{
+  const arma::uword n_in = ws_normalized.n_elem;
+  if(n_in < 1L)
+    throw std::invalid_argument("sample_subsets: no weights");
+  if(scheme != stats_comp_helper_resample::systematic and
+       scheme != stats_comp_helper_resample::stratified)
+    throw std::invalid_argument("sample_subsets: unkown scheme");
+
+  /* we use the cumulative weights so each subset only takes O(M log N)
+   * time */
+  arma::vec cum_w = arma::cumsum(arma::exp(ws_normalized));
+  cum_w /= cum_w[n_in - 1L];
+
+  arma::umat out(n_sub, n_out);
+  const bool same_u = scheme == stats_comp_helper_resample::systematic;
+  const double * const cw_begin = cum_w.begin(),
+               * const cw_last  = cum_w.end() - 1L;
+  for(arma::uword k = 0; k < n_out; ++k){
+    arma::uword *o = out.colptr(k);
+    const double u0 = same_u ? unif_rand() : 0.;
+    /* the uniform variables are increasing so we only search in the
+     * remaining part */
+    const double *lb = cw_begin;
+    for(arma::uword i = 0; i < n_sub; ++i, ++o){
+      const double u = ((double)i + (same_u ? u0 : unif_rand())) / n_sub;
+      lb = std::lower_bound(lb, cw_last, u);
+      *o = lb - cw_begin;
+    }
+  }
+
+  return out;
+}
+
+inline void set_trans_ll_n_comp_stats_subsample
+  (particle_cloud &old_cloud, particle_cloud &new_cloud,
+   const trans_obj &trans_func, const comp_stat_util &util,
+   const arma::umat &subsets, const arma::uword start, const arma::uword end)
+{
+  const arma::uword n_sub = subsets.n_rows,
+    dim_particle = new_cloud.dim_particle();
+  /* each sampled particle has weight 1 / M */
+  const double log_w_sub = -std::log((double)n_sub);
+  arma::vec new_log_ws(n_sub);
+  std::vector<double> moments(util.moments_dim);
+  for(arma::uword i = start; i < end; ++i){
+    const double *d_new = new_cloud.particles.colptr(i);
+    const arma::uword *idx = subsets.colptr(i);
+    double *stats_new =
+      (util.what == log_densty) ? nullptr : new_cloud.stats.colptr(i),
+      *n_w = new_log_ws.begin(),
+      max_w = -std::numeric_limits<double>::infinity();
+
+    if(util.use_moments)
+      std::fill(moments.begin(), moments.end(), 0.);
+    for(arma::uword m = 0; m < n_sub; ++m, ++n_w, ++idx){
+      const double
+        *d_old = old_cloud.particles.colptr(*idx),
+        *stats_old =
+        (util.what == log_densty) ? nullptr : old_cloud.stats.colptr(*idx);
+
+      *n_w = trans_func(d_old, d_new, dim_particle, log_w_sub);
+      if(util.use_moments)
+        util.state_state_moments(
+          d_old, d_new, stats_old, stats_new, *n_w, moments.data());
+      else
+        util.state_state(
+          d_old, d_new, stats_old, stats_new, *n_w);
+      if(*n_w > max_w)
+        max_w = *n_w;
+    }
+    if(util.use_moments)
+      util.add_moments(moments.data(), stats_new);
+
+    new_cloud.ws(i) = log_sum_log(new_log_ws, max_w);
+  }
+}
+
+void stats_comp_helper_subsample::set_ll_state_state
+  (const cdist &obs_dist, particle_cloud &old_cloud, particle_cloud &new_cloud,
+   const comp_stat_util &util, const control_obj &ctrl,
+   const trans_obj &trans_func)
+  const
+{
+  const arma::uword n_new = new_cloud.N_particles();
+  const arma::umat subsets = sample_subsets(
+    old_cloud.ws_normalized, n_sub, n_new, scheme);
+
+  /* transform*/
+  trans_func.trans_X(old_cloud.particles);
+  trans_func.trans_Y(new_cloud.particles);
+  thread_pool &pool = ctrl.get_pool();
+
+  {
+    auto loop_figs = get_inc_n_block(n_new, pool);
+    task_group tasks(pool);
+
+    for(arma::uword start = 0L; start < n_new;){
+      arma::uword end = std::min(start + loop_figs.inc, n_new);
+      tasks.run(std::bind(
+          set_trans_ll_n_comp_stats_subsample, ref(old_cloud),
+          ref(new_cloud), cref(trans_func), cref(util), cref(subsets),
+          start, end));
+      start = end;
+    }
+
+    tasks.wait();
+  }
+
+  /* normalize statistics */
+  if(new_cloud.stats.n_elem > 0L){
+    arma::vec norm_conts = arma::exp(new_cloud.ws);
+    new_cloud.stats.each_row() /= norm_conts.t();
+  }
+
+  /* transform back */
+  trans_func.trans_inv_X(old_cloud.particles);
+  trans_func.trans_inv_Y(new_cloud.particles);
+}
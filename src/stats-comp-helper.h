@@ -6,6 +6,10 @@
 
 class comp_stat_util;
 
+/* returns statistics with the full Hessian given statistics with the
+ * Hessian in packed form. Each column is a set of statistics */
+arma::mat unpack_stats(const arma::mat&, const comp_out);
+
 class stats_comp_helper {
 protected:
   /* does the computation that only depends on the present state */
@@ -41,12 +45,21 @@ public:
 };
 
 /* return an object that does the all O(N^2) computations where N is the
- * number of particles */
+ * number of particles. The squared distances are computed with matrix
+ * products if the argument to the constructor is true and only the log
+ * density is needed */
 class stats_comp_helper_no_aprx final : public stats_comp_helper {
+public:
+  stats_comp_helper_no_aprx(const bool use_gemm = false):
+    use_gemm(use_gemm) { }
+
 protected:
   void set_ll_state_state
   (const cdist&, particle_cloud&, particle_cloud&, const comp_stat_util&,
    const  control_obj&, const trans_obj&) const final override;
+
+private:
+  const bool use_gemm;
 };
 
 /* return an object that makes an O(N log(N)) time approximation */
@@ -57,4 +70,76 @@ protected:
    const control_obj&, const trans_obj&) const final override;
 };
 
+/* return an object that makes an O(N) computation by sampling one ancestor
+ * for each new particle when the effective sample size of the old particle
+ * cloud is below a given fraction of the number of particles. Otherwise,
+ * the i'th new particle is paired with the i'th old particle. The
+ * statistics are propagated along the ancestor lineages */
+class stats_comp_helper_resample final : public stats_comp_helper {
+public:
+  enum resample_scheme { systematic, stratified, residual };
+
+  stats_comp_helper_resample
+    (const resample_scheme scheme = systematic,
+     const double ess_threshold = .5):
+    scheme(scheme), ess_threshold(ess_threshold) {
+    if(ess_threshold < 0. or ess_threshold > 1.)
+      throw std::invalid_argument(
+          "stats_comp_helper_resample: invalid 'ess_threshold'");
+  }
+
+  /* returns the indices of the sampled ancestors given normalized log
+   * weights. Uses R's random number generator */
+  static arma::uvec sample_ancestors
+    (const arma::vec&, const arma::uword, const resample_scheme);
+
+protected:
+  void set_ll_state_state
+  (const cdist&, particle_cloud&, particle_cloud&, const comp_stat_util&,
+   const control_obj&, const trans_obj&) const final override;
+
+private:
+  const resample_scheme scheme;
+  const double ess_threshold;
+};
+
+/* return an object that makes an O(N M) computation where M is a fixed
+ * number of old particles which are sampled for each new particle with
+ * probabilities given by their weights. The sum of the weighted transition
+ * densities is estimated by the mean of the transition densities of the
+ * sampled particles which is unbiased */
+class stats_comp_helper_subsample final : public stats_comp_helper {
+public:
+  using resample_scheme = stats_comp_helper_resample::resample_scheme;
+
+  stats_comp_helper_subsample
+    (const arma::uword n_sub,
+     const resample_scheme scheme = stats_comp_helper_resample::systematic):
+    n_sub(n_sub), scheme(scheme) {
+    if(n_sub < 1L)
+      throw std::invalid_argument(
+          "stats_comp_helper_subsample: invalid 'n_sub'");
+    if(scheme != stats_comp_helper_resample::systematic and
+         scheme != stats_comp_helper_resample::stratified)
+      throw std::invalid_argument(
+          "stats_comp_helper_subsample: invalid 'scheme'");
+  }
+
+  /* returns a matrix with the indices of the sampled old particles in each
+   * column given normalized log weights and the number of columns. Uses R's
+   * random number generator */
+  static arma::umat sample_subsets
+    (const arma::vec&, const arma::uword, const arma::uword,
+     const resample_scheme);
+
+protected:
+  void set_ll_state_state
+  (const cdist&, particle_cloud&, particle_cloud&, const comp_stat_util&,
+   const control_obj&, const trans_obj&) const final override;
+
+private:
+  const arma::uword n_sub;
+  const resample_scheme scheme;
+};
+
 #endif
@@ -1,6 +1,7 @@
 #include <testthat.h>
 #include "utils-test.h"
 #include "cloud.h"
+#include "stats-comp-helper.h"
 
 context("Test particle_cloud") {
   test_that("Test particle_cloud and member functions") {
@@ -42,4 +43,53 @@ context("Test particle_cloud") {
 
     expect_true(is_all_aprx_equal(expected, mea));
   }
+
+  test_that("Test cloud_pool re-uses memory") {
+    cloud_pool pool;
+    particle_cloud pc = pool.get(100L, 3L, 20L);
+    expect_true(pc.N_particles() == 100L);
+    expect_true(pc.dim_particle() == 3L);
+    expect_true(pc.dim_stats() == 20L);
+    expect_true(pc.ws.n_elem == 100L);
+    expect_true(pc.ws_normalized.n_elem == 100L);
+
+    const double *stats_ptr = pc.stats.memptr();
+    pool.release(pc.stats);
+    expect_true(pc.stats.n_elem == 0L);
+
+    /* the memory for the stats is large enough */
+    particle_cloud pc_new = pool.get(50L, 2L, 20L);
+    expect_true(pc_new.stats.memptr() == stats_ptr);
+    expect_true(pc_new.N_particles() == 50L);
+    expect_true(pc_new.dim_particle() == 2L);
+    expect_true(pc_new.dim_stats() == 20L);
+
+    pool.release(pc);
+    expect_true(pc.particles.n_elem == 0L);
+    expect_true(pc.ws.n_elem == 0L);
+  }
+
+  test_that("Test unpack_stats gives the full Hessian") {
+    constexpr arma::uword grad_dim = 3L;
+    expect_true(get_stat_dim_packed(grad_dim, Hessian)  == 9L);
+    expect_true(get_stat_dim_packed(grad_dim, gradient) == grad_dim);
+    expect_true(get_grad_dim_packed(9L, Hessian)  == grad_dim);
+    expect_true(get_grad_dim_packed(3L, gradient) == grad_dim);
+
+    /* two particles with gradient and packed upper part of the Hessian */
+    auto packed = create_mat<9L, 2L>({
+      1, 2, 3, 11, 12, 22, 13, 23, 33,
+      -1, -2, -3, -11, -12, -22, -13, -23, -33 });
+    arma::mat out = unpack_stats(packed, Hessian);
+    expect_true(out.n_rows == grad_dim * (1L + grad_dim));
+    expect_true(out.n_cols == 2L);
+
+    auto expect = create_mat<12L, 2L>({
+      1, 2, 3, 11, 12, 13, 12, 22, 23, 13, 23, 33,
+      -1, -2, -3, -11, -12, -13, -12, -22, -23, -13, -23, -33 });
+    expect_true(is_all_aprx_equal(out, expect));
+
+    arma::mat grad_only = unpack_stats(packed, gradient);
+    expect_true(is_all_aprx_equal(grad_only, packed));
+  }
 }
@@ -66,6 +66,20 @@ context("Test state distribution") {
         x, nullptr, nullptr, log_densty) - expect) < 1e-8);
     expect_true(std::abs(di2.log_prop_dens(
         x                                     ) - expect) < 1e-8);
+
+    {
+      /* batched version */
+      arma::mat X(3L, 3L);
+      X.col(0) = x;
+      X.col(1) = y;
+      X.col(2) = x + y;
+      arma::vec res;
+      di2.log_prop_dens(X, res);
+      expect_true(res.n_elem == 3L);
+      for(unsigned i = 0; i < 3L; ++i)
+        expect_true(std::abs(
+            res[i] - di2.log_prop_dens(arma::vec(X.col(i)))) < 1e-8);
+    }
   }
 
   test_that("Test mv_norm_reg gives correct results in 3D") {
@@ -297,6 +311,32 @@ context("Test state distribution") {
       expect_true(is_all_aprx_equal(d_F  , d_F_expect  , 1e-4));
       expect_true(is_all_aprx_equal(d_Q  , d_Q_expect  , 1e-4));
       expect_true(is_all_aprx_equal(dd_FQ, dd_FQ_expect, 1e-4));
+
+      /* the Hessian terms from the moments match those from the pairs */
+      auto x2 = create_vec<3L>({ 1, -2, .5 });
+      auto y2 = create_vec<3L>({ 2, 1, -1 });
+      di.trans_X(x2);
+      di.trans_Y(y2);
+
+      std::fill(stat_w_Hes.data(), stat_w_Hes.end(), 0.);
+      di.comp_stats_state_state(
+        x.memptr() , y.memptr() , .3, stat_w_Hes.data(), Hessian);
+      di.comp_stats_state_state(
+        x2.memptr(), y2.memptr(), .7, stat_w_Hes.data(), Hessian);
+
+      expect_true(di.stats_moments_dim() == 1L + 3L * dimdim);
+      std::vector<double> moments(di.stats_moments_dim(), 0.);
+      arma::vec grad_mom(gdim, arma::fill::zeros);
+      di.comp_stats_state_state_moments(
+        x.memptr() , y.memptr() , .3, grad_mom.memptr(), .3, moments.data());
+      di.comp_stats_state_state_moments(
+        x2.memptr(), y2.memptr(), .7, grad_mom.memptr(), .7, moments.data());
+      arma::mat dd_FQ_mom(gdim, gdim, arma::fill::zeros);
+      di.comp_stats_hess_from_moments(moments.data(), dd_FQ_mom.memptr());
+
+      expect_true(is_all_aprx_equal(dd_FQ, dd_FQ_mom, 1e-8));
+      expect_true(is_all_aprx_equal(
+          arma::vec(stat_w_Hes.data(), gdim), grad_mom, 1e-8));
     }
   }
 
@@ -345,6 +385,20 @@ context("Test state distribution") {
         x, nullptr, nullptr, log_densty) - expect) < 1e-8);
     expect_true(std::abs(di2.log_prop_dens(
         x                                     ) - expect) < 1e-8);
+
+    {
+      /* batched version */
+      arma::mat X(3L, 3L);
+      X.col(0) = x;
+      X.col(1) = y;
+      X.col(2) = x + y;
+      arma::vec res;
+      di2.log_prop_dens(X, res);
+      expect_true(res.n_elem == 3L);
+      for(unsigned i = 0; i < 3L; ++i)
+        expect_true(std::abs(
+            res[i] - di2.log_prop_dens(arma::vec(X.col(i)))) < 1e-8);
+    }
   }
 }
 
@@ -498,3 +552,55 @@ context("testing that derivatives are correct for exponential families with a di
           0.893315267479427, -1.0580130344079 }));
   }
 }
+
+context("Test block evaluations of kernels") {
+  test_that("log_kernel_block and log_kernel_tile match the pairwise kernel") {
+    constexpr arma::uword n_x = 7L, n_y = 3L;
+    for(arma::uword dim = 1L; dim < 11L; ++dim){
+      arma::mat X(dim, n_x), Y(dim, n_y), Q(dim, dim, arma::fill::eye),
+                F(dim, dim, arma::fill::eye);
+      arma::vec ws(n_x);
+      for(arma::uword i = 0; i < X.n_elem; ++i)
+        X[i] = std::sin(1. + i);
+      for(arma::uword i = 0; i < Y.n_elem; ++i)
+        Y[i] = std::cos(2. + i);
+      for(arma::uword i = 0; i < n_x; ++i)
+        ws[i] = -std::log(1. + i);
+      Q.diag() += .5;
+      F *= .8;
+      F(0L, dim - 1L) += .1;
+
+      mvs_norm k1(dim);
+      mv_norm k2(Q);
+      mv_tdist k3(Q, 5.);
+      mv_norm_reg k4(F, Q);
+      for(const trans_obj *kernel :
+            std::vector<const trans_obj*>({ &k1, &k2, &k3, &k4 })){
+        arma::mat expect(n_x, n_y);
+        for(arma::uword j = 0; j < n_y; ++j)
+          for(arma::uword i = 0; i < n_x; ++i)
+            expect(i, j) = (*kernel)(X.colptr(i), Y.colptr(j), dim, ws[i]);
+
+        arma::vec block(n_x);
+        kernel->log_kernel_block(
+          X.memptr(), n_x, Y.colptr(1L), dim, ws.memptr(), block.memptr());
+        arma::vec expect_col = expect.col(1L);
+        expect_true(is_all_aprx_equal(block, expect_col));
+
+        arma::mat tile(n_x + 1L, n_y);
+        kernel->log_kernel_tile(
+          X.memptr(), n_x, Y.memptr(), n_y, dim, ws.memptr(), tile.memptr(),
+          tile.n_rows);
+        arma::mat tile_sub = tile.rows(0L, n_x - 1L);
+        expect_true(is_all_aprx_equal(tile_sub, expect));
+
+        arma::fmat X_f = arma::conv_to<arma::fmat>::from(X),
+                   Y_f = arma::conv_to<arma::fmat>::from(Y);
+        kernel->log_kernel_block(
+          X_f.memptr(), n_x, Y_f.colptr(1L), dim, ws.memptr(),
+          block.memptr());
+        expect_true(is_all_aprx_equal(block, expect_col, 1e-5));
+      }
+    }
+  }
+}
@@ -1,13 +1,16 @@
 #include <testthat.h>
 #include "fast-kernel-approx.h"
 #include <array>
+#include <cmath>
+#include <limits>
 #include "utils-test.h"
+#include "utils.h"
 
 using std::exp;
 using std::log;
 
-context("Test source_node") {
-  test_that("source_node gives expected result in 2D") {
+context("Test source_nodes") {
+  test_that("source_nodes gives expected result in 2D") {
     /* second rows has higher variation so it will be selected */
     auto X = create_mat<2L, 4L>({0.,   4.,
                                   .5 ,  -2.,
@@ -16,42 +19,47 @@ context("Test source_node") {
     auto ws = create_vec<4L>({ log(.1), log(.4), log(.3), log(.2) });
 
     thread_pool pool(1L);
-    KD_note node = get_KD_tree(X, 2L, pool);
-    expect_true(!node.is_leaf());
+    KD_tree tree = get_KD_tree(X, 2L, pool);
+    const KD_tree::node &root = tree.get_node(0L);
+    expect_true(!root.is_leaf());
 
-    source_node<false> pn(X, ws, node, nullptr);
-    expect_true(!pn.node.is_leaf());
+    /* the source particles must be in the order of the tree */
+    const arma::uvec idx(tree.get_indices());
+    const arma::mat X_perm = X.cols(idx);
+    const arma::vec ws_perm = ws(idx);
+    source_nodes<false> pn(tree, X_perm, ws_perm, nullptr);
 
     {
       arma::vec expected(2L, arma::fill::zeros);
       for(unsigned int i = 0; i < 4L; ++i)
         expected += exp(ws[i]) * X.col(i);
-      expect_true(is_all_aprx_equal(expected, pn.centroid));
+      arma::vec centroid = pn.centroids.col(0L);
+      expect_true(is_all_aprx_equal(expected, centroid));
 
-      expect_true(std::abs(pn.weight - 1) < 1e-12);
+      expect_true(std::abs(pn.weights[0L] - 1) < 1e-12);
     }
     {
-      auto &left = *pn.left;
-      expect_true(left.node.is_leaf());
+      expect_true(tree.get_node(root.left).is_leaf());
       arma::vec expected(2L, arma::fill::zeros);
       double w = exp(ws[1L]) + exp(ws[3L]);
       expected += exp(ws[1L]) / w * X.col(1L);
       expected += exp(ws[3L]) / w * X.col(3L);
-      expect_true(is_all_aprx_equal(expected, left.centroid));
+      arma::vec centroid = pn.centroids.col(root.left);
+      expect_true(is_all_aprx_equal(expected, centroid));
 
-      expect_true(std::abs(left.weight - w) < 1e-12);
+      expect_true(std::abs(pn.weights[root.left] - w) < 1e-12);
 
     }
     {
-      auto &right = *pn.right;
-      expect_true(right.node.is_leaf());
+      expect_true(tree.get_node(root.right()).is_leaf());
       arma::vec expected(2L, arma::fill::zeros);
       double w = exp(ws[0L]) + exp(ws[2L]);
       expected += exp(ws[0L]) / w * X.col(0L);
       expected += exp(ws[2L]) / w * X.col(2L);
-      expect_true(is_all_aprx_equal(expected, right.centroid));
+      arma::vec centroid = pn.centroids.col(root.right());
+      expect_true(is_all_aprx_equal(expected, centroid));
 
-      expect_true(std::abs(right.weight - w) < 1e-12);
+      expect_true(std::abs(pn.weights[root.right()] - w) < 1e-12);
     }
   }
 }
@@ -90,4 +98,268 @@ context("Test FSKA_cpp") {
     expect_true( is_all_equal(X_w, w_org));
     expect_true( is_all_equal(Y, Y_org));
   }
+
+  test_that("FSKA_cpp gives almost the same with single precision") {
+    arma::mat X = create_mat<2L, 4L>(
+      { 0.38, -2.00, -0.24, -0.72, -0.20,  0.49,  0.13,  0.09} );
+    arma::vec X_w = create_vec<4L>({ -2.1628, -1.2694, -1.4740, -0.9808 });
+    arma::mat Y = create_mat<2L, 5L>(
+    { 0.071,  0.350, -0.740, -0.250, -0.220,  1.300, -1.000, -1.800, 0.930,
+      1.500 });
+    thread_pool pool(1L);
+    const mvs_norm kernel(X.n_rows);
+
+    auto run = [&](const bool use_float){
+      arma::mat X_cp = X, Y_cp = Y;
+      arma::vec X_w_cp = X_w, Y_w(Y.n_cols, arma::fill::none);
+      Y_w.fill(-std::numeric_limits<double>::infinity());
+
+      auto permu = FSKA_cpp(
+        Y_w, X_cp, Y_cp, X_w_cp, 2L, .01, kernel, pool, false, nullptr,
+        nullptr, FSKA_cpp_xtra_func(), use_float);
+      arma::vec out = Y_w(permu.Y_perm);
+      return out;
+    };
+
+    arma::vec r_double = run(false), r_float = run(true);
+    expect_true(is_all_aprx_equal(r_double, r_float, 1e-5));
+  }
+
+  test_that("FSKA_cpp gives the same for any number of threads with deterministic = true") {
+    /* enough points to spawn many tasks */
+    const arma::uword n = 1000L;
+    arma::mat X(2L, n), Y(2L, n);
+    arma::vec X_w(n);
+    for(arma::uword i = 0; i < n; ++i){
+      X(0L, i) = std::sin(1.3 * i);
+      X(1L, i) = std::cos(2.1 * i);
+      Y(0L, i) = std::sin(.7 * i + .5);
+      Y(1L, i) = std::cos(1.9 * i + .2);
+      X_w[i] = -std::log((double)n) + .1 * std::sin(3.1 * i);
+    }
+    const mvs_norm kernel(X.n_rows);
+
+    auto run = [&](const unsigned n_threads, const bool deterministic,
+                   arma::vec &log_err){
+      thread_pool pool(n_threads);
+      arma::mat X_cp = X, Y_cp = Y;
+      arma::vec X_w_cp = X_w, Y_w(Y.n_cols, arma::fill::none);
+      Y_w.fill(-std::numeric_limits<double>::infinity());
+
+      auto permu = FSKA_cpp(
+        Y_w, X_cp, Y_cp, X_w_cp, 5L, .001, kernel, pool, false, nullptr,
+        nullptr, FSKA_cpp_xtra_func(), false, 0L, &log_err, false, nullptr,
+        nullptr, deterministic);
+      log_err = log_err(permu.Y_perm);
+      arma::vec out = Y_w(permu.Y_perm);
+      return out;
+    };
+
+    arma::vec err_1, err_2, err_4, err_no;
+    const arma::vec r_1 = run(1L, true, err_1), r_2 = run(2L, true, err_2),
+      r_4 = run(4L, true, err_4), r_no = run(4L, false, err_no);
+    expect_true(arma::all(r_1 == r_2));
+    expect_true(arma::all(r_1 == r_4));
+    expect_true(arma::all(err_1 == err_2));
+    expect_true(arma::all(err_1 == err_4));
+    expect_true(is_all_aprx_equal(r_1, r_no, 1e-8));
+  }
+
+  test_that("FSKA_cpp gives almost the same with ball trees") {
+    const arma::uword dim = 6L, n = 500L;
+    arma::mat X(dim, n), Y(dim, n);
+    arma::vec X_w(n);
+    for(arma::uword i = 0; i < n; ++i){
+      for(arma::uword k = 0; k < dim; ++k){
+        X(k, i) = std::sin(1.3 * i + .7 * k);
+        Y(k, i) = std::cos(.9 * i + 1.1 * k);
+      }
+      X_w[i] = -std::log((double)n);
+    }
+    const mvs_norm kernel(X.n_rows);
+    thread_pool pool(2L);
+
+    auto run = [&](const bool use_balls){
+      arma::mat X_cp = X, Y_cp = Y;
+      arma::vec X_w_cp = X_w, Y_w(Y.n_cols, arma::fill::none);
+      Y_w.fill(-std::numeric_limits<double>::infinity());
+
+      auto permu = FSKA_cpp(
+        Y_w, X_cp, Y_cp, X_w_cp, 10L, .001, kernel, pool, false, nullptr,
+        nullptr, FSKA_cpp_xtra_func(), false, 0L, nullptr, false, nullptr,
+        nullptr, false, use_balls);
+      arma::vec out = Y_w(permu.Y_perm);
+      return out;
+    };
+
+    arma::vec r_kd = run(false), r_ball = run(true);
+    expect_true(is_all_aprx_equal(r_kd, r_ball, 1e-4));
+  }
+}
+
+context("Test hermite_terms") {
+  test_that("hermite_terms gives the Gaussian kernel sum") {
+    arma::mat X = create_mat<2L, 4L>(
+      { 0.38, -0.20, -0.24, 0.49, 0.13, 0.09, -0.32, -0.15 });
+    arma::vec ws = create_vec<4L>({ .1, .4, .3, .2 });
+    arma::vec y = create_vec<2L>({ .5, -.7 });
+    const arma::vec center = create_vec<2L>({ .1, .05 }),
+      new_center = create_vec<2L>({ -.2, .3 });
+
+    hermite_terms herm(2L, 12L);
+    expect_true(herm.n_terms() == 91L);
+
+    arma::vec moments(herm.n_terms(), arma::fill::zeros),
+          moments_new(herm.n_terms(), arma::fill::zeros);
+    double expect = 0.;
+    for(unsigned i = 0; i < 4L; ++i){
+      const arma::vec d = X.col(i) - center;
+      herm.add_moments(d.memptr(), ws[i], moments.memptr());
+      expect += ws[i] * exp(-arma::dot(y - X.col(i), y - X.col(i)) / 2.);
+    }
+
+    const arma::vec t = y - center;
+    const double res = exp(-arma::dot(t, t) / 2.) *
+      herm.eval(moments.memptr(), t.memptr());
+    expect_true(std::abs(res - expect) < 1e-7);
+
+    /* shifting the moments gives the same */
+    const arma::vec shift = center - new_center, t_new = y - new_center;
+    herm.add_shifted(moments.memptr(), shift.memptr(), moments_new.memptr());
+    const double res_new = exp(-arma::dot(t_new, t_new) / 2.) *
+      herm.eval(moments_new.memptr(), t_new.memptr());
+    expect_true(std::abs(res_new - expect) < 1e-6);
+  }
+
+  test_that("hermite_terms gives a valid bound on the truncation error") {
+    /* the bound is f exp(-D^2 / 4) where D is the smallest distance between
+     * y and the line segment from the center to x */
+    bool is_valid = true;
+    for(arma::uword dim = 1L; dim < 7L; ++dim)
+      for(arma::uword order = 0L; order < 7L; ++order){
+        hermite_terms herm(dim, order);
+        arma::vec moments(herm.n_terms()), d(dim), y(dim);
+        for(unsigned i = 0; i < 50L; ++i){
+          for(arma::uword k = 0; k < dim; ++k){
+            d[k] = .8 * std::sin(1.7 * i + 2.3 * k + order + .5);
+            y[k] = d[k] * (1. + std::sin(.9 * i + k)) +
+              1.5 * std::cos(1.1 * i + 1.9 * k);
+          }
+
+          moments.zeros();
+          herm.add_moments(d.memptr(), 1., moments.memptr());
+          const double res = exp(-arma::dot(y, y) / 2.) *
+            herm.eval(moments.memptr(), y.memptr()),
+            expect = exp(-arma::dot(y - d, y - d) / 2.);
+
+          /* the center is the origin */
+          const double s = std::min(
+            1., std::max(0., arma::dot(d, y) / arma::dot(d, d)));
+          const arma::vec closest = s * d;
+          const double D2 = arma::dot(y - closest, y - closest),
+            bound = herm.error_factor(arma::norm(d)) * exp(-D2 / 4.);
+          is_valid &= std::abs(res - expect) <= bound + 1e-14;
+        }
+      }
+    expect_true(is_valid);
+  }
+}
+
+context("Test FSKA_cpp with the Hermite expansion") {
+  test_that("FSKA_cpp gives almost the same with the Hermite expansion") {
+    constexpr arma::uword n = 400L;
+    arma::mat X(2L, n), Y(2L, n);
+    arma::vec X_w(n);
+    for(arma::uword i = 0; i < n; ++i){
+      X(0L, i) = std::sin(1.3 * i);
+      X(1L, i) = std::cos(.7 * i) * 1.5;
+      Y(0L, i) = std::cos(2.1 * i) * 1.2;
+      Y(1L, i) = std::sin(.4 * i);
+      X_w[i] = std::sin(3. * i);
+    }
+    X_w -= std::log(arma::accu(arma::exp(X_w)));
+
+    const mvs_norm kernel(X.n_rows);
+    arma::vec expect(n);
+    for(arma::uword j = 0; j < n; ++j){
+      double o = -std::numeric_limits<double>::infinity();
+      for(arma::uword i = 0; i < n; ++i)
+        o = log_sum_log(
+          o, kernel(X.colptr(i), Y.colptr(j), 2L, X_w[i]));
+      expect[j] = o;
+    }
+
+    thread_pool pool(1L);
+    auto run = [&](const arma::uword order){
+      arma::mat X_cp = X, Y_cp = Y;
+      arma::vec X_w_cp = X_w, Y_w(n);
+      Y_w.fill(-std::numeric_limits<double>::infinity());
+
+      auto permu = FSKA_cpp(
+        Y_w, X_cp, Y_cp, X_w_cp, 5L, 1e-3, kernel, pool, false, nullptr,
+        nullptr, FSKA_cpp_xtra_func(), false, order);
+      arma::vec res = Y_w(permu.Y_perm);
+      return res;
+    };
+
+    const arma::vec res_centroid = run(0L), res_hermite = run(4L);
+    expect_true(arma::max(arma::abs(res_centroid - expect)) < 5e-3);
+    expect_true(arma::max(arma::abs(res_hermite  - expect)) < 5e-3);
+    /* the Hermite expansion is used */
+    expect_true(arma::any(res_hermite != res_centroid));
+  }
+}
+
+context("Test FSKA_cpp error bounds") {
+  test_that("FSKA_cpp gives valid bounds on the absolute errors") {
+    constexpr arma::uword n = 400L;
+    arma::mat X(2L, n), Y(2L, n);
+    arma::vec X_w(n);
+    for(arma::uword i = 0; i < n; ++i){
+      X(0L, i) = std::sin(1.3 * i);
+      X(1L, i) = std::cos(.7 * i) * 1.5;
+      Y(0L, i) = std::cos(2.1 * i) * 1.2;
+      Y(1L, i) = std::sin(.4 * i);
+      X_w[i] = std::sin(3. * i);
+    }
+    X_w -= std::log(arma::accu(arma::exp(X_w)));
+
+    const mvs_norm kernel(X.n_rows);
+    arma::vec expect(n);
+    for(arma::uword j = 0; j < n; ++j){
+      double o = -std::numeric_limits<double>::infinity();
+      for(arma::uword i = 0; i < n; ++i)
+        o = log_sum_log(
+          o, kernel(X.colptr(i), Y.colptr(j), 2L, X_w[i]));
+      expect[j] = o;
+    }
+
+    for(unsigned n_threads = 1L; n_threads < 3L; ++n_threads){
+      thread_pool pool(n_threads);
+      arma::vec res_centroid;
+      for(arma::uword order = 0L; order < 5L; order += 4L){
+        arma::mat X_cp = X, Y_cp = Y;
+        arma::vec X_w_cp = X_w, Y_w(n), log_err;
+        Y_w.fill(-std::numeric_limits<double>::infinity());
+
+        auto permu = FSKA_cpp(
+          Y_w, X_cp, Y_cp, X_w_cp, 5L, 1e-2, kernel, pool, false, nullptr,
+          nullptr, FSKA_cpp_xtra_func(), false, order, &log_err);
+        const arma::vec res = Y_w(permu.Y_perm),
+          err = arma::exp(log_err(permu.Y_perm));
+        expect_true(err.n_elem == n);
+
+        /* some pairs are approximated and the bounds hold */
+        expect_true(err.max() > 0.);
+        const arma::vec diff = arma::abs(arma::exp(res) - arma::exp(expect));
+        expect_true(arma::all(diff <= err * (1. + 1e-8) + 1e-14));
+
+        /* the Hermite expansion is used with the positive order */
+        if(order == 0L)
+          res_centroid = res;
+        else
+          expect_true(arma::any(res != res_centroid));
+      }
+    }
+  }
 }
@@ -1,6 +1,10 @@
 #include <testthat.h>
 #include "kd-tree.h"
 #include <array>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
 #include "utils-test.h"
 
 context("Test KD-tree") {
@@ -10,56 +14,145 @@ context("Test KD-tree") {
     thread_pool pool(1L);
 
     {
-      KD_note note = get_KD_tree(X, 10L, pool);
-      expect_true(note.is_leaf());
+      KD_tree tree = get_KD_tree(X, 10L, pool);
+      expect_true(tree.n_nodes() == 1L);
+      expect_true(tree.get_node(0L).is_leaf());
     }
     {
-      KD_note note = get_KD_tree(X, 4L, pool);
-      expect_true(note.is_leaf());
+      KD_tree tree = get_KD_tree(X, 4L, pool);
+      expect_true(tree.get_node(0L).is_leaf());
     }
     {
-      KD_note note = get_KD_tree(X, 3L, pool);
-      expect_true(!note.is_leaf());
-      auto leafs = note.get_leafs();
+      KD_tree tree = get_KD_tree(X, 3L, pool);
+      const KD_tree::node &root = tree.get_node(0L);
+      expect_true(!root.is_leaf());
+      expect_true(tree.get_depth() == 2L);
+      auto leafs = tree.get_leafs();
       expect_true(leafs.size() == 2L);
+      expect_true(leafs[0] == root.left);
+      expect_true(leafs[1] == root.right());
 
+      const std::vector<arma::uword> &indices = tree.get_indices();
       {
-        auto &left = note.get_left();
-        std::vector<arma::uword> idx = left.get_indices();
+        const KD_tree::node &left = tree.get_node(root.left);
+        expect_true(left.is_leaf());
+        std::vector<arma::uword> idx(indices.begin() + left.start,
+                                     indices.begin() + left.end);
         std::sort(idx.begin(), idx.end());
         std::array<arma::uword, 2L> expected = {1L, 2L};
         expect_true(is_all_equal(idx, expected));
       }
       {
-        auto &right = note.get_right();
-        std::vector<arma::uword> idx = right.get_indices();
+        const KD_tree::node &right = tree.get_node(root.right());
+        expect_true(right.is_leaf());
+        std::vector<arma::uword> idx(indices.begin() + right.start,
+                                     indices.begin() + right.end);
         std::sort(idx.begin(), idx.end());
         std::array<arma::uword, 2L> expected = {0L, 3L};
         expect_true(is_all_equal(idx, expected));
       }
+
+      /* borders of the nodes */
+      {
+        hyper_rectangle r = tree.get_borders(0L);
+        expect_true(*r.get_lower() == 1. and *r.get_upper() == 4.);
+      }
+      {
+        hyper_rectangle r = tree.get_borders(root.left);
+        expect_true(*r.get_lower() == 1. and *r.get_upper() == 2.);
+      }
+      {
+        hyper_rectangle r = tree.get_borders(root.right());
+        expect_true(*r.get_lower() == 3. and *r.get_upper() == 4.);
+      }
+    }
+  }
+}
+
+context("Test ball tree") {
+  test_that("ball tree gives valid nodes and bounds in 6D") {
+    const arma::uword dim = 6L, n = 200L;
+    arma::mat X(dim, n), Y(dim, n);
+    for(arma::uword i = 0; i < n; ++i)
+      for(arma::uword k = 0; k < dim; ++k){
+        X(k, i) = std::sin(1.3 * i + .7 * k);
+        Y(k, i) = std::cos(.9 * i + 1.1 * k);
+      }
+
+    thread_pool pool(1L);
+    KD_tree X_tree = get_KD_tree(X, 10L, pool, true),
+      Y_tree = get_KD_tree(Y, 10L, pool, true);
+    expect_true(X_tree.use_balls);
+
+    /* all points are in one leaf */
+    {
+      std::vector<arma::uword> idx;
+      for(auto l : X_tree.get_leafs()){
+        const KD_tree::node &nd = X_tree.get_node(l);
+        expect_true(nd.n_elem() <= 10L);
+        idx.insert(idx.end(), X_tree.get_indices().begin() + nd.start,
+                   X_tree.get_indices().begin() + nd.end);
+      }
+      std::sort(idx.begin(), idx.end());
+      std::vector<arma::uword> expected(n);
+      std::iota(expected.begin(), expected.end(), 0L);
+      expect_true(is_all_equal(idx, expected));
     }
+
+    /* the bounds contain the distances between all pairs of points */
+    auto check_bounds = [&](const KD_tree &t1, const arma::mat &X1,
+                            const KD_tree &t2, const arma::mat &X2){
+      bool is_valid = true;
+      for(arma::uword i = 0; i < t1.n_nodes(); ++i)
+        for(arma::uword j = 0; j < t2.n_nodes(); ++j){
+          const std::array<double, 2> b = t1.min_max_dist(i, t2, j);
+          const KD_tree::node &n1 = t1.get_node(i), &n2 = t2.get_node(j);
+          for(arma::uword k1 = n1.start; k1 < n1.end; ++k1)
+            for(arma::uword k2 = n2.start; k2 < n2.end; ++k2){
+              const double d = arma::accu(arma::square(
+                X1.col(t1.get_indices()[k1]) - X2.col(t2.get_indices()[k2])));
+              is_valid &= b[0L] <= d + 1e-10 and d <= b[1L] + 1e-10;
+            }
+        }
+      return is_valid;
+    };
+    expect_true(check_bounds(X_tree, X, Y_tree, Y));
+
+    /* the bounds are never looser than the bounds from the borders */
+    bool is_tighter = true;
+    for(arma::uword i = 0; i < X_tree.n_nodes(); ++i)
+      for(arma::uword j = 0; j < Y_tree.n_nodes(); ++j){
+        const std::array<double, 2>
+          b = X_tree.min_max_dist(i, Y_tree, j),
+          b_box = X_tree.get_borders(i).min_max_dist(Y_tree.get_borders(j));
+        is_tighter &= b[0L] >= b_box[0L] and b[1L] <= b_box[1L];
+      }
+    expect_true(is_tighter);
+
+    /* the same topology gives the same balls */
+    KD_tree X_copy(X_tree.get_topology(), X, true);
+    for(arma::uword i = 0; i < X_tree.n_nodes(); ++i)
+      expect_true(X_copy.get_ball_radius(i) == X_tree.get_ball_radius(i));
   }
 }
 
 context("Test hyper_rectangle") {
   test_that("hyper_rectangle gives expected result in 2D") {
     /* [0, 1] x [0, 1] */
-    auto X1 = create_mat<2L, 3L>({ 0., 0., .5, 0., 1., 1. });
+    std::array<double, 2L> lo1 = { 0., 0. }, up1 = { 1., 1. };
     /* [2, 5] x [2, 4] */
-    auto X2 = create_mat<2L, 3L>({ 3,  3, 5,  4, 2,  2});
-    auto idx = create_vec<3L, arma::uvec::fixed>({
-      (unsigned int)0, (unsigned int)1, (unsigned int)2 });
+    std::array<double, 2L> lo2 = { 2., 2. }, up2 = { 5., 4. };
+    /* [0, 5] x [0, 4] */
+    std::array<double, 2L> lo3 = { 0., 0. }, up3 = { 5., 4. };
 
-    hyper_rectangle r1(X1, idx), r2(X2, idx);
+    hyper_rectangle r1(lo1.data(), up1.data(), 2L),
+      r2(lo2.data(), up2.data(), 2L), r3(lo3.data(), up3.data(), 2L);
 
     {
       std::array<double, 2L> dists = r1.min_max_dist(r2);
       expect_true(std::abs(dists[0] - 1. * 1. - 1. * 1.) < 1e-12);
       expect_true(std::abs(dists[1] - 5. * 5. - 4. * 4.) < 1e-12);
     }
-
-    /* [0, 5] x [0, 4] */
-    hyper_rectangle r3(r1, r2);
     {
       std::array<double, 2L> dists = r3.min_max_dist(r3);
       expect_true(std::abs(dists[0]) < 1e-12);
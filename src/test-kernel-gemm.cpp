@@ -0,0 +1,36 @@
+#include <testthat.h>
+#include "kernel-gemm.h"
+#include <cmath>
+#include "utils-test.h"
+#include "utils.h"
+
+context("Test log_kernel_sum_gemm") {
+  test_that("log_kernel_sum_gemm matches the pairwise kernel far from the origin") {
+    /* there are more source particles than in one tile */
+    constexpr arma::uword dim = 2L, n_x = 300L, n_y = 200L;
+    constexpr double offset = 1e6;
+    arma::mat X(dim, n_x), Y(dim, n_y);
+    arma::vec ws(n_x);
+    for(arma::uword i = 0; i < X.n_elem; ++i)
+      X[i] = offset + std::sin(1. + i);
+    for(arma::uword i = 0; i < Y.n_elem; ++i)
+      Y[i] = offset + std::cos(2. + i);
+    for(arma::uword i = 0; i < n_x; ++i)
+      ws[i] = -std::log(1. + i);
+
+    mvs_norm kernel(dim);
+    arma::vec expect(n_y), work(n_x);
+    for(arma::uword j = 0; j < n_y; ++j){
+      kernel.log_kernel_block(
+        X.memptr(), n_x, Y.colptr(j), dim, ws.memptr(), work.memptr());
+      expect[j] = log_sum_log(work, work.max());
+    }
+
+    for(unsigned n_threads : { 1L, 2L }){
+      thread_pool pool(n_threads);
+      arma::vec res(n_y);
+      log_kernel_sum_gemm(X, ws, Y, res, kernel, pool);
+      expect_true(is_all_aprx_equal(res, expect, 1e-10));
+    }
+  }
+}
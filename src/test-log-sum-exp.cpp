@@ -0,0 +1,61 @@
+#include "utils.h"
+#include <testthat.h>
+#include <vector>
+
+context("Test log-sum-exp functions") {
+  test_that("exp_fast and log_fast are accurate") {
+    for(double x = -700.; x < 700.; x += 1.37){
+      const double expect = std::exp(x);
+      expect_true(std::abs(lse::exp_fast(x) - expect) / expect < 1e-15);
+      expect_true(std::abs(lse::log_fast(expect) - x) < 1e-13);
+    }
+
+    expect_true(lse::exp_fast(-std::numeric_limits<double>::infinity()) == 0.);
+    expect_true(lse::exp_fast(1000.) == std::numeric_limits<double>::infinity());
+    expect_true(lse::log_fast(0.) == -std::numeric_limits<double>::infinity());
+    expect_true(lse::log_fast(1.) == 0.);
+  }
+
+  test_that("the accumulator and the block functions give the correct result") {
+    constexpr double neg_inf = -std::numeric_limits<double>::infinity();
+    std::vector<double> x = { -1., 3., neg_inf, 2.5, -100., 4. };
+    double expect = 0.;
+    for(auto xi : x)
+      expect += std::exp(xi);
+    expect = std::log(expect);
+
+    lse::accumulator acc, acc_block, acc_merged, acc_1, acc_2;
+    for(auto xi : x)
+      acc.add(xi);
+    expect_true(std::abs(acc.get() - expect) < 1e-13);
+
+    acc_block.add(x.data(), 3L);
+    acc_block.add(x.data() + 3L, 3L);
+    expect_true(std::abs(acc_block.get() - expect) < 1e-13);
+
+    acc_1.add(x.data() + 3L, 3L);
+    acc_2.add(x.data(), 3L);
+    acc_merged.merge(acc_1);
+    acc_merged.merge(acc_2);
+    expect_true(std::abs(acc_merged.get() - expect) < 1e-13);
+
+    std::vector<double> a = { -1., neg_inf, 2., neg_inf },
+                        b = { 3., 1., neg_inf, neg_inf };
+    lse::log_sum_log_block(a.data(), b.data(), a.size());
+    expect_true(std::abs(a[0] - std::log(std::exp(-1.) + std::exp(3.)))
+                  < 1e-13);
+    expect_true(a[1] == 1.);
+    expect_true(a[2] == 2.);
+    expect_true(a[3] == neg_inf);
+  }
+
+  test_that("normalize_log_weights gives the correct result") {
+    arma::vec ws = { -1., 2., .5, -3. }, expect = arma::exp(ws);
+    expect /= arma::sum(expect);
+    const double ess_expect = 1. / arma::dot(expect, expect);
+
+    const double ess = normalize_log_weights(ws);
+    expect_true(std::abs(ess - ess_expect) < 1e-12);
+    expect_true(arma::abs(arma::exp(ws) - expect).max() < 1e-14);
+  }
+}
@@ -0,0 +1,93 @@
+#include <testthat.h>
+#include "philox.h"
+#include "dists.h"
+
+context("Test philox") {
+  test_that("Test philox gives the known answers") {
+    /* from the known answer tests in Random123 */
+    {
+      const philox::ctr_type res = philox::get({ 0L, 0L, 0L, 0L}, {0L, 0L});
+      expect_true(res[0L] == 0x6627e8d5);
+      expect_true(res[1L] == 0xe169c58d);
+      expect_true(res[2L] == 0xbc57ac4c);
+      expect_true(res[3L] == 0x9b00dbd8);
+    }
+    {
+      const philox::ctr_type res = philox::get(
+        { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 },
+        { 0xa4093822, 0x299f31d0 });
+      expect_true(res[0L] == 0xd16cfe09);
+      expect_true(res[1L] == 0x94fdcceb);
+      expect_true(res[2L] == 0x5001e420);
+      expect_true(res[3L] == 0x24126ea1);
+    }
+  }
+
+  test_that("Test philox::stream gives variables with the right moments") {
+    constexpr unsigned n = 100000L;
+    philox::stream rng({ 1L, 2L }, 3L);
+    double m_u = 0, m_n = 0, v_n = 0, m_c = 0;
+    for(unsigned i = 0; i < n; ++i){
+      const double u = rng.unif();
+      expect_true(u > 0. and u < 1.);
+      m_u += u / n;
+
+      const double z = rng.norm();
+      m_n += z / n;
+      v_n += z * z / n;
+
+      m_c += rng.chisq(5.) / n;
+    }
+
+    expect_true(std::abs(m_u - .5) < .01);
+    expect_true(std::abs(m_n     ) < .02);
+    expect_true(std::abs(v_n - 1.) < .02);
+    expect_true(std::abs(m_c - 5.) < .05);
+  }
+
+  test_that("Test sampling with philox does not depend on the blocks") {
+    const arma::mat Q = { { 2., 1. }, { 1., 3. } };
+    const arma::vec mu = { -1., 1. };
+    mv_tdist dist(Q, mu, 5.);
+    const philox::key_type key = { 11L, 22L };
+
+    constexpr arma::uword n = 14L;
+    arma::mat X1(2L, n), X2(2L, n);
+    dist.sample(X1, key, 0L, n);
+    dist.sample(X2, key, 0L, 5L);
+    dist.sample(X2, key, 5L, n);
+    expect_true(arma::all(arma::vectorise(X1 == X2)));
+
+    /* there are 14 %% 4 = 2 columns without antithetic variables */
+    dist.sample_anti(X1, key, 0L, n);
+    dist.sample_anti(X2, key, 0L, 6L);
+    dist.sample_anti(X2, key, 6L, n);
+    expect_true(arma::all(arma::vectorise(X1 == X2)));
+    expect_true(arma::norm(X1.col(2L) - mu + X1.col(3L) - mu) < 1e-12);
+  }
+
+  test_that("Test the scale balanced antithetic variables with philox") {
+    /* the lower tail probability of the first variable should be the upper
+     * tail probability of the third variable */
+    for(double nu : { 3., 5., 20. })
+      for(arma::uword dim : { 1L, 2L, 3L, 6L }){
+        mv_tdist dist(arma::mat(dim, dim, arma::fill::eye), nu);
+        const philox::key_type key = { 3L, 7L };
+
+        constexpr arma::uword n = 400L;
+        arma::mat X(dim, n);
+        dist.sample_anti(X, key, 0L, n);
+
+        bool is_valid = true;
+        for(arma::uword j = 0; j < n; j += 4L){
+          const double
+            u  = arma::dot(X.col(j     ), X.col(j     )) / dim,
+            up = arma::dot(X.col(j + 2L), X.col(j + 2L)) / dim,
+            p_lower = R::pf(u , dim, nu, 1, 0),
+            p_upper = R::pf(up, dim, nu, 0, 0);
+          is_valid &= std::abs(p_lower - p_upper) < 1e-10;
+        }
+        expect_true(is_valid);
+      }
+  }
+}
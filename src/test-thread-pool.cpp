@@ -0,0 +1,110 @@
+#include <testthat.h>
+#include "thread_pool.h"
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+/* sums the elements in [start, end) by splitting the range into tasks which
+ * wait for their children */
+static void sum_rec
+  (thread_pool &pool, const std::vector<int> &x, const std::size_t start,
+   const std::size_t end, long &out){
+  if(end - start < 8L){
+    out = 0L;
+    for(std::size_t i = start; i < end; ++i)
+      out += x[i];
+    return;
+  }
+
+  const std::size_t mid = start + (end - start) / 2L;
+  long left, right;
+  task_group tasks(pool);
+  tasks.run([&]{ sum_rec(pool, x, start, mid, left); });
+  sum_rec(pool, x, mid, end, right);
+  tasks.wait();
+
+  out = left + right;
+}
+
+context("Test task_group") {
+  test_that("task_group runs all tasks and tasks can wait for tasks") {
+    std::vector<int> x(1000L);
+    long expected = 0L;
+    for(std::size_t i = 0; i < x.size(); ++i){
+      x[i] = i;
+      expected += i;
+    }
+
+    for(unsigned n_threads : { 1L, 2L, 4L }){
+      thread_pool pool(n_threads);
+      long res = 0L;
+      sum_rec(pool, x, 0L, x.size(), res);
+      expect_true(res == expected);
+    }
+  }
+
+  test_that("tasks submitted from workers are run") {
+    thread_pool pool(4L);
+    std::atomic<unsigned> n_run(0L);
+    task_group tasks(pool);
+    for(unsigned i = 0; i < 4L; ++i)
+      tasks.run([&]{
+        /* more tasks than the initial size of the deques */
+        std::vector<std::future<unsigned> > futures;
+        for(unsigned j = 0; j < 1000L; ++j)
+          futures.push_back(pool.submit([&]{ return ++n_run; }));
+        for(auto &f : futures){
+          while(f.wait_for(std::chrono::seconds(0)) !=
+                  std::future_status::ready)
+            pool.run_pending_task();
+          f.get();
+        }
+      });
+    tasks.wait();
+
+    expect_true(n_run == 4000L);
+  }
+
+  test_that("task_group waits for long running tasks") {
+    /* the waiting thread runs out of queued tasks and has to block */
+    thread_pool pool(2L);
+    std::atomic<unsigned> n_done(0L);
+    {
+      task_group tasks(pool);
+      for(unsigned i = 0; i < 2L; ++i)
+        tasks.run([&]{
+          std::this_thread::sleep_for(std::chrono::milliseconds(50L));
+          ++n_done;
+        });
+      tasks.wait();
+      expect_true(n_done == 2L);
+      expect_true(tasks.n_not_done() == 0L);
+
+      for(unsigned i = 0; i < 4L; ++i)
+        tasks.run([&]{
+          std::this_thread::sleep_for(std::chrono::milliseconds(20L));
+          ++n_done;
+        });
+      tasks.throttle(2L);
+      expect_true(tasks.n_not_done() <= 2L);
+    }
+    expect_true(n_done == 6L);
+  }
+
+  test_that("task_group re-throws exceptions from the tasks") {
+    thread_pool pool(2L);
+    task_group tasks(pool);
+    for(unsigned i = 0; i < 10L; ++i)
+      tasks.run([]{ throw std::runtime_error("error"); });
+
+    bool did_throw = false;
+    try {
+      tasks.wait();
+    } catch(const std::runtime_error&) {
+      did_throw = true;
+    }
+    expect_true(did_throw);
+    expect_true(tasks.n_not_done() == 0L);
+  }
+}
@@ -11,3 +11,8 @@ join_threads::~join_threads()
     threads[i].join();
   }
 }
+
+#ifdef USE_THREAD_LOCAL
+thread_local thread_pool const *thread_pool::local_pool = nullptr;
+thread_local int thread_pool::local_index = -1;
+#endif
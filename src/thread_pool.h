@@ -33,7 +33,11 @@
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <deque>
+#include <exception>
 #include <future>
 #include <memory>
 #include <functional>
@@ -42,11 +46,15 @@
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 /*
  Listing 6.6 A thread-safe queue with fine-grained locking
- Uses a singly linked list with a seperate mutex for the head and tail
+ Uses a singly linked list with a seperate mutex for the head and tail.
+ Changed: the data is stored in the nodes to avoid an extra allocation in
+ each push. T must be default constructible
  */
 template<typename T>
 class thread_safe_queue
@@ -54,7 +62,7 @@ class thread_safe_queue
 private:
    struct node
    {
-      std::shared_ptr<T> data;
+      T data;
       std::unique_ptr<node> next;
    };
 
@@ -93,7 +101,9 @@ public:
    std::shared_ptr<T> try_pop()
    {
       std::unique_ptr<node> old_head = pop_head();
-      return old_head ? old_head->data : std::shared_ptr<T>();
+      return old_head ?
+         std::make_shared<T>(std::move(old_head->data)) :
+         std::shared_ptr<T>();
    }
 
    // Added
@@ -101,7 +111,7 @@ public:
    {
       std::unique_ptr<node> old_head = pop_head();
       if(old_head){
-        value = std::move(*old_head->data);
+        value = std::move(old_head->data);
         return true;
 
       } else{
@@ -110,14 +120,19 @@ public:
       }
    }
 
+   // Added
+   bool empty()
+   {
+      std::lock_guard<std::mutex> head_lock(head_mutex);
+      return head.get() == get_tail();
+   }
+
    void push(T new_value)
    {
-      std::shared_ptr<T> new_data(
-         std::make_shared<T>(std::move(new_value)));
       std::unique_ptr<node> p(new node);
       node* const new_tail = p.get();
       std::lock_guard<std::mutex> tail_lock(tail_mutex);
-      tail->data = new_data;
+      tail->data = std::move(new_value);
       tail->next = std::move(p);
       tail = new_tail;
    }
@@ -135,10 +150,12 @@ public:
 // Listing 9.2
 class function_wrapper
 {
+public:
   struct impl_base {
     virtual void call()=0;
     virtual ~impl_base() {}
   };
+private:
   std::unique_ptr<impl_base> impl;
   template<typename F>
   struct impl_type: impl_base
@@ -153,6 +170,9 @@ public:
     impl(new impl_type<F>(std::move(f)))
   {}
 
+  // Added: takes ownership of a task from release
+  explicit function_wrapper(impl_base *p): impl(p) {}
+
   void operator()() { impl->call(); }
   function_wrapper() = default;
   function_wrapper(function_wrapper&& other):
@@ -169,33 +189,284 @@ public:
     return (bool)impl;
   }
 
+  // Added: releases the ownership of the task
+  impl_base* release() {
+    return impl.release();
+  }
+
   function_wrapper(const function_wrapper&)=delete;
   function_wrapper(function_wrapper&)=delete;
   function_wrapper& operator=(const function_wrapper&)=delete;
 };
 
-// Listing 9.2:
+/* Added: lock-free work stealing deque from
+ *   Chase, D., & Lev, Y. (2005). Dynamic circular work-stealing deque.
+ * with the memory orderings from
+ *   Lê, N. M., Pop, A., Cohen, A., & Zappa Nardelli, F. (2013). Correct and
+ *   efficient work-stealing for weak memory models.
+ * The owning thread pushes and pops at the bottom and other threads steal
+ * from the top. The deque owns the tasks which are in it */
+class work_stealing_deque
+{
+  typedef function_wrapper::impl_base* task_ptr;
+
+  /* circular array with a size which is a power of two */
+  struct ring
+  {
+    std::int64_t const size;
+    std::unique_ptr<std::atomic<task_ptr>[]> data;
+
+    explicit ring(std::int64_t const size):
+      size(size), data(new std::atomic<task_ptr>[size])
+    {}
+
+    task_ptr get(std::int64_t const i) const
+    {
+      return data[i & (size - 1L)].load(std::memory_order_relaxed);
+    }
+    void put(std::int64_t const i, task_ptr const x)
+    {
+      data[i & (size - 1L)].store(x, std::memory_order_relaxed);
+    }
+  };
+
+  std::atomic<std::int64_t> top, bottom;
+  std::atomic<ring*> buffer;
+  /* all arrays which have been used. The old arrays are kept as other
+   * threads may still read from them */
+  std::vector<std::unique_ptr<ring> > rings;
+
+  ring* grow(ring const *old, std::int64_t const t, std::int64_t const b)
+  {
+    rings.emplace_back(new ring(2L * old->size));
+    ring *out = rings.back().get();
+    for(std::int64_t i = t; i < b; ++i)
+      out->put(i, old->get(i));
+    buffer.store(out, std::memory_order_release);
+    return out;
+  }
+
+public:
+  explicit work_stealing_deque(std::int64_t const size = 256L):
+    top(0L), bottom(0L)
+  {
+    rings.emplace_back(new ring(size));
+    buffer.store(rings.back().get(), std::memory_order_relaxed);
+  }
+  work_stealing_deque(const work_stealing_deque&) = delete;
+  work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+  ~work_stealing_deque()
+  {
+    function_wrapper task;
+    while(try_pop(task))
+      ;
+  }
+
+  /* must only be called by the owner */
+  void push(function_wrapper task)
+  {
+    std::int64_t const b = bottom.load(std::memory_order_relaxed),
+                       t = top.load(std::memory_order_acquire);
+    ring *a = buffer.load(std::memory_order_relaxed);
+    if(b - t > a->size - 1L)
+      a = grow(a, t, b);
+    a->put(b, task.release());
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1L, std::memory_order_relaxed);
+  }
+
+  /* must only be called by the owner */
+  bool try_pop(function_wrapper &res)
+  {
+    std::int64_t const b = bottom.load(std::memory_order_relaxed) - 1L;
+    ring *a = buffer.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t t = top.load(std::memory_order_relaxed);
+
+    if(t > b){
+      /* empty */
+      bottom.store(b + 1L, std::memory_order_relaxed);
+      return false;
+    }
+
+    task_ptr x = a->get(b);
+    if(t == b){
+      /* last element. Race with the thieves */
+      if(!top.compare_exchange_strong(
+          t, t + 1L, std::memory_order_seq_cst, std::memory_order_relaxed))
+        x = nullptr;
+      bottom.store(b + 1L, std::memory_order_relaxed);
+      if(!x)
+        return false;
+    }
+
+    res = function_wrapper(x);
+    return true;
+  }
+
+  /* can be called by any thread. May fail if there is a race with another
+   * thread */
+  bool try_steal(function_wrapper &res)
+  {
+    std::int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t const b = bottom.load(std::memory_order_acquire);
+    if(t >= b)
+      return false;
+
+    ring *a = buffer.load(std::memory_order_acquire);
+    task_ptr x = a->get(t);
+    if(!top.compare_exchange_strong(
+        t, t + 1L, std::memory_order_seq_cst, std::memory_order_relaxed))
+      return false;
+
+    res = function_wrapper(x);
+    return true;
+  }
+
+  bool empty() const
+  {
+    return top.load(std::memory_order_acquire) >=
+      bottom.load(std::memory_order_acquire);
+  }
+};
+
+/* Listing 9.2 changed to use work stealing as in listing 9.7 but with a
+ * lock-free deque for each worker. Tasks which are submitted by a worker are
+ * pushed to the worker's deque and tasks submitted by other threads are
+ * pushed to a global queue. Idle workers steal from a random worker */
 class thread_pool
 {
   thread_safe_queue<function_wrapper> work_queue;
   std::condition_variable cv;
   std::mutex mu;
+  /* number of workers which are waiting on cv */
+  std::atomic<unsigned> n_idle;
+
+  struct worker_data
+  {
+    work_stealing_deque queue;
+    /* state of the random number generator used to select whom to steal
+     * from. Only used by the worker */
+    std::uint32_t rng_state;
+  };
+  std::vector<std::unique_ptr<worker_data> > workers;
+  std::vector<std::thread::id> worker_ids;
+
+#ifdef USE_THREAD_LOCAL
+  static thread_local thread_pool const *local_pool;
+  static thread_local int local_index;
+#endif
+
+  /* returns the index of the calling thread if it is a worker in this pool
+   * and -1 otherwise */
+  int worker_index() const
+  {
+#ifdef USE_THREAD_LOCAL
+    return local_pool == this ? local_index : -1;
+#else
+    std::thread::id const id = std::this_thread::get_id();
+    for(unsigned i = 0; i < worker_ids.size(); ++i)
+      if(worker_ids[i] == id)
+        return i;
+    return -1;
+#endif
+  }
+
+  static std::uint32_t xorshift(std::uint32_t &state)
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  bool try_steal(int const idx, function_wrapper &task)
+  {
+    unsigned const n_workers = workers.size();
+    if(n_workers < 1L)
+      return false;
+    std::uint32_t seed;
+    if(idx >= 0)
+      seed = xorshift(workers[idx]->rng_state);
+    else {
+      seed = std::hash<std::thread::id>()(std::this_thread::get_id()) +
+        std::chrono::steady_clock::now().time_since_epoch().count();
+      if(seed == 0L)
+        seed = 1L;
+      seed = xorshift(seed);
+    }
+
+    unsigned const start = seed % n_workers;
+    for(unsigned i = 0; i < n_workers; ++i){
+      unsigned const j = (start + i) % n_workers;
+      if((int)j != idx and workers[j]->queue.try_steal(task))
+        return true;
+    }
+    return false;
+  }
+
+  bool try_pop_task(int const idx, function_wrapper &task)
+  {
+    if(idx >= 0 and workers[idx]->queue.try_pop(task))
+      return true;
+    if(work_queue.try_pop(task))
+      return true;
+    return try_steal(idx, task);
+  }
+
+  bool has_pending_task()
+  {
+    if(!work_queue.empty())
+      return true;
+    for(auto &w : workers)
+      if(!w->queue.empty())
+        return true;
+    return false;
+  }
 
-  void worker_thread()
+  void push_task(function_wrapper task)
   {
+    int const idx = worker_index();
+    if(idx >= 0)
+      workers[idx]->queue.push(std::move(task));
+    else
+      work_queue.push(std::move(task));
+
+    /* only notify if a worker may be waiting. The fence pairs with the one
+     * in worker_thread */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(n_idle.load(std::memory_order_relaxed) > 0L){
+      std::unique_lock<std::mutex> lk(mu);
+      cv.notify_one();
+    }
+  }
+
+  void worker_thread(unsigned const idx)
+  {
+#ifdef USE_THREAD_LOCAL
+    local_pool = this;
+    local_index = idx;
+#endif
+
     for(;;){
       function_wrapper task;
+      if(try_pop_task(idx, task)){
+        task();
+        continue;
+      }
+      if(done)
+        return;
 
-      bool got_task = work_queue.try_pop(task);
-      if(!got_task){
+      n_idle.fetch_add(1L);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      {
         std::unique_lock<std::mutex> lk(mu);
-        cv.wait(lk, [&]{ return work_queue.try_pop(task) or done; });
-
-        if(done and !task.has_value())
-          return;
+        cv.wait(lk, [&]{ return done or has_pending_task(); });
       }
-
-      task();
+      n_idle.fetch_sub(1L);
     }
   }
 
@@ -223,16 +494,44 @@ public:
 
     }
 
-    work_queue.push(std::move(task));
-    {
-      std::unique_lock<std::mutex> lk(mu);
-      cv.notify_one();
-    }
+    push_task(std::move(task));
     return res;
   }
 
+  // Added: same as submit but without a future. The caller has to keep
+  // track of when the task is done
+  template<typename FunctionType>
+  void post(FunctionType f)
+  {
+    if(!has_threads){
+      f();
+      return;
+    }
+
+    push_task(std::move(f));
+  }
+
+  // Added: runs a queued task if there is one and returns whether a task
+  // was run
+  bool try_run_pending_task()
+  {
+    function_wrapper task;
+    if(!try_pop_task(worker_index(), task))
+      return false;
+    task();
+    return true;
+  }
+
+  // From listing 9.4: runs a queued task if there is one
+  void run_pending_task()
+  {
+    if(!try_run_pending_task())
+      std::this_thread::yield();
+  }
+
   // From listing 9.2
   thread_pool(unsigned const n_threads = 1):
+    n_idle(0L),
     done(false),
     joiner(threads),
     thread_count(n_threads)
@@ -240,6 +539,13 @@ public:
     if(!has_threads)
       return;
 
+    /* the deques have to exist before any worker starts */
+    worker_ids.reserve(thread_count);
+    for(unsigned i = 0; i < thread_count; ++i){
+      workers.emplace_back(new worker_data());
+      workers.back()->rng_state = 2463534242UL + i;
+    }
+
     // Moved to private member
     //unsigned const thread_count=std::thread::hardware_concurrency();
     try
@@ -247,7 +553,8 @@ public:
       for(unsigned i=0;i<thread_count;++i)
       {
         threads.push_back(
-          std::thread(&thread_pool::worker_thread,this));
+          std::thread(&thread_pool::worker_thread,this,i));
+        worker_ids.push_back(threads.back().get_id());
       }
     }
     catch(...)
@@ -273,6 +580,146 @@ public:
   }
 };
 
+/* group of tasks which are run in a thread pool. The thread which waits for
+ * the tasks runs queued tasks from the pool so tasks may themselves wait for
+ * other tasks. It only blocks when it repeatedly fails to find a queued task
+ * and it is then woken up each time a task in the group is done. Tasks which
+ * use thread local memory must not wait while the memory is in use as other
+ * tasks may then be run on the same thread */
+class task_group
+{
+  /* number of failed attempts to run a queued task before blocking */
+  static constexpr unsigned n_spin_max = 64L;
+  /* the number of pending tasks is stored in the lower bits of state and the
+   * number of blocked threads in the upper bits */
+  static constexpr std::uint64_t one_waiter = std::uint64_t(1L) << 32L,
+                               pending_mask = one_waiter - 1L;
+
+  thread_pool &pool;
+  std::atomic<std::uint64_t> state;
+  /* protects err and is held when a task is marked as done while a thread
+   * is blocked */
+  std::mutex mu;
+  std::condition_variable cv;
+  /* the first exception thrown by a task */
+  std::exception_ptr err;
+
+  std::size_t n_pending(std::memory_order const order) const
+  {
+    return state.load(order) & pending_mask;
+  }
+
+  template<typename FunctionType>
+  struct task {
+    task_group *group;
+    FunctionType f;
+
+    void operator()()
+    {
+      try {
+        f();
+      } catch(...) {
+        std::lock_guard<std::mutex> lk(group->mu);
+        if(!group->err)
+          group->err = std::current_exception();
+      }
+      /* the group may be destructed after this if no thread is blocked */
+      std::uint64_t cur = group->state.load(std::memory_order_relaxed);
+      while(cur < one_waiter)
+        if(group->state.compare_exchange_weak(
+            cur, cur - 1L, std::memory_order_release,
+            std::memory_order_relaxed))
+          return;
+
+      /* the mutex is held such that the blocked threads do not miss the
+       * notification and such that the group is not destructed before the
+       * mutex is released */
+      std::lock_guard<std::mutex> lk(group->mu);
+      group->state.fetch_sub(1L, std::memory_order_release);
+      group->cv.notify_all();
+    }
+  };
+
+  void wait_for_tasks(const std::size_t n_max = 0L)
+  {
+    unsigned n_spin = 0L;
+    while(n_pending(std::memory_order_acquire) > n_max){
+      if(pool.try_run_pending_task()){
+        n_spin = 0L;
+        continue;
+      }
+
+      if(++n_spin < n_spin_max){
+        std::this_thread::yield();
+        continue;
+      }
+
+      /* block until a task in the group is done and then look for queued
+       * tasks again as the tasks may have queued other tasks */
+      {
+        std::unique_lock<std::mutex> lk(mu);
+        std::uint64_t const cur = state.fetch_add(
+          one_waiter, std::memory_order_acq_rel) + one_waiter;
+        if((cur & pending_mask) > n_max)
+          cv.wait(lk);
+        state.fetch_sub(one_waiter, std::memory_order_relaxed);
+      }
+      n_spin = 0L;
+    }
+
+    /* the last task may still hold the mutex */
+    std::lock_guard<std::mutex> lk(mu);
+  }
+
+public:
+  explicit task_group(thread_pool &pool): pool(pool), state(0L) { }
+  task_group(const task_group&) = delete;
+  task_group& operator=(const task_group&) = delete;
+
+  /* waits as the tasks may refer to objects owned by the caller */
+  ~task_group()
+  {
+    wait_for_tasks();
+  }
+
+  template<typename FunctionType>
+  void run(FunctionType f)
+  {
+    if(!pool.has_threads){
+      f();
+      return;
+    }
+
+    state.fetch_add(1L, std::memory_order_relaxed);
+    pool.post(task<FunctionType>{ this, std::move(f) });
+  }
+
+  /* returns the number of tasks which are not done */
+  std::size_t n_not_done() const
+  {
+    return n_pending(std::memory_order_relaxed);
+  }
+
+  /* runs queued tasks until at most the passed number of tasks are not
+   * done. This can be used to bound the number of queued tasks */
+  void throttle(const std::size_t n_max)
+  {
+    wait_for_tasks(n_max);
+  }
+
+  /* waits for all tasks and re-throws the first exception from the tasks if
+   * there is any */
+  void wait()
+  {
+    wait_for_tasks();
+    if(err){
+      std::exception_ptr e = err;
+      err = nullptr;
+      std::rethrow_exception(e);
+    }
+  }
+};
+
 /* returns the increament and number task when divi */
 struct get_inc_n_block_out {
   unsigned const inc, n_tasks;
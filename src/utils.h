@@ -1,23 +1,22 @@
 #ifndef MSSM_UTILS_H
 #define MSSM_UTILS_H
 #include "arma.h"
+#include "log-sum-exp.h"
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <type_traits>
 
 inline double log_sum_log(const double old, const double new_term){
-  double max = std::max(old, new_term);
-  double d1 = std::exp(old - max), d2 = std::exp(new_term - max);
+  const double max = std::max(old, new_term), min = std::min(old, new_term);
+  if(min == -std::numeric_limits<double>::infinity())
+    return max;
 
-  return std::log(d1 + d2) + max;
+  return std::log1p(std::exp(min - max)) + max;
 }
 
 inline double log_sum_log(const arma::vec &ws, const double max_weight){
-  double norm_constant = 0;
-  for(auto w : ws)
-    norm_constant += std::exp(w - max_weight);
-
-  return std::log(norm_constant) + max_weight;
+  return lse::log_sum_exp(ws.memptr(), ws.n_elem, max_weight);
 }
 
 inline double norm_square(const double *d1, const double *d2, arma::uword N){
@@ -30,6 +29,54 @@ inline double norm_square(const double *d1, const double *d2, arma::uword N){
   return dist;
 }
 
+/* single precision version of the above. The sum is in single precision */
+inline double norm_square(const float *d1, const float *d2, arma::uword N){
+  float dist = 0.f;
+  for(arma::uword i = 0; i < N; ++i, ++d1, ++d2){
+    float diff = *d1 - *d2;
+    dist += diff * diff;
+  }
+
+  return dist;
+}
+
+/* computes the squared distances between y and n points which are stored
+ * contiguously in X. The dimension is a compile time constant in the first
+ * function such that the inner loop can be unrolled */
+template<arma::uword N, typename T>
+inline void norm_square_block_fixed
+  (const T *X, const arma::uword n, const T *y, double *out){
+  T yc[N];
+  std::copy(y, y + N, yc);
+  for(arma::uword i = 0; i < n; ++i, X += N){
+    T dist = 0;
+    for(arma::uword k = 0; k < N; ++k){
+      const T diff = X[k] - yc[k];
+      dist += diff * diff;
+    }
+    out[i] = dist;
+  }
+}
+
+template<typename T>
+inline void norm_square_block
+  (const T *X, const arma::uword n, const T *y, const arma::uword N,
+   double *out){
+  switch(N){
+  case 1L: norm_square_block_fixed<1L>(X, n, y, out); return;
+  case 2L: norm_square_block_fixed<2L>(X, n, y, out); return;
+  case 3L: norm_square_block_fixed<3L>(X, n, y, out); return;
+  case 4L: norm_square_block_fixed<4L>(X, n, y, out); return;
+  case 5L: norm_square_block_fixed<5L>(X, n, y, out); return;
+  case 6L: norm_square_block_fixed<6L>(X, n, y, out); return;
+  case 7L: norm_square_block_fixed<7L>(X, n, y, out); return;
+  case 8L: norm_square_block_fixed<8L>(X, n, y, out); return;
+  }
+
+  for(arma::uword i = 0; i < n; ++i, X += N)
+    out[i] = norm_square(X, y, N);
+}
+
 /* class for arma object which takes a copy of the current value, set the
  * elements to zero and adds the copy back when this objects is
  * destructed. */
@@ -163,20 +210,19 @@ inline double normalize_log_weights(arma::vec &low_ws)
     if(d > max_w)
       max_w = d;
 
-  double norm_const = 0;
-  for(auto &d : low_ws){
-    d = std::exp(d - max_w);
-    norm_const += d;
+  /* the effective sample size is sum(w)^2 / sum(w^2) */
+  double norm_const = 0, sum_sq = 0.;
+  for(const auto d : low_ws){
+    const double w = lse::exp_fast(d - max_w);
+    norm_const += w;
+    sum_sq += w * w;
   }
 
-  double ess_inv = 0.;
-  for(auto &d: low_ws){
-    d /= norm_const;
-    ess_inv += d * d;
-    d = std::log(d);
-  }
+  const double log_norm = std::log(norm_const) + max_w;
+  for(auto &d: low_ws)
+    d -= log_norm;
 
-  return 1. / ess_inv;
+  return norm_const * norm_const / sum_sq;
 }
 
 /* wrapper for dsyr. Only updates the upper half. The latter version has an